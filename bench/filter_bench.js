@@ -0,0 +1,201 @@
+// Replays URL streams against the request filter engine and prints one JSON line with
+// compile time, cache size and load time, and per-match cost.
+//
+//   node bench/filter_bench.js [--lists a.txt,b.txt] [--urls stream.tsv|capture.har]
+//                              [--synthesize 50000] [--repeat 5] [--label name]
+//
+// URL streams are what the app writes with AIBOX_FILTER_RECORD=<file> (one
+// "type<TAB>url<TAB>source" line per request) or HAR captures from devtools. Without
+// --urls, or with --synthesize N, a deterministic EasyList-shaped list of N rules and a
+// matching URL stream are generated, so the bench also runs offline.
+//
+// scan_ns is the cost of reading every character of each URL once on this machine;
+// ns_per_match / scan_ns compares runs across machines.
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+const { FilterEngine, loadFilterEngine } = require('../src/filter_engine');
+
+function parseArgs(argv) {
+    const args = { lists: [], urls: null, synthesize: 0, repeat: 5, label: 'filter' };
+    for (let i = 2; i < argv.length; i++) {
+        const next = () => argv[++i];
+        if (argv[i] === '--lists') args.lists = next().split(',').filter(Boolean);
+        else if (argv[i] === '--urls') args.urls = next();
+        else if (argv[i] === '--synthesize') args.synthesize = parseInt(next(), 10) || 0;
+        else if (argv[i] === '--repeat') args.repeat = Math.max(1, parseInt(next(), 10) || 1);
+        else if (argv[i] === '--label') args.label = next();
+        else {
+            console.error(`unknown option ${argv[i]}`);
+            process.exit(2);
+        }
+    }
+    if (!args.urls && !args.synthesize) args.synthesize = 50000;
+    return args;
+}
+
+function readStream(file) {
+    const text = fs.readFileSync(file, 'utf8');
+    return file.endsWith('.har') ? parseHar(text) : parseStream(text);
+}
+
+function parseStream(text) {
+    return text.split('\n').filter(Boolean).map(line => {
+        const [type, url, source] = line.split('\t');
+        return url === undefined ? { type: 'other', url: type, source: '' } : { type, url, source: source || '' };
+    });
+}
+
+// Chrome writes the page URL as the HAR page title.
+function parseHar(text) {
+    const har = JSON.parse(text);
+    const pages = {};
+    (har.log.pages || []).forEach(page => {
+        pages[page.id] = page.title;
+    });
+    return har.log.entries.map(entry => ({
+        type: harType(entry),
+        url: entry.request.url,
+        source: pages[entry.pageref] || ''
+    }));
+}
+
+function harType(entry) {
+    const mime = (entry.response && entry.response.content && entry.response.content.mimeType) || '';
+    if (entry._resourceType) return { xhr: 'xmlhttprequest', fetch: 'xmlhttprequest', document: 'subdocument' }[entry._resourceType] || entry._resourceType;
+    if (mime.includes('javascript')) return 'script';
+    if (mime.startsWith('image/')) return 'image';
+    if (mime.includes('css')) return 'stylesheet';
+    return 'other';
+}
+
+// Deterministic EasyList-shaped data: mostly ||host^ rules, then path fragments,
+// size-suffixed banners, unanchored prefixes, option-scoped rules and exceptions.
+function synthesize(count) {
+    let seed = 0x2545f491;
+    const rand = n => {
+        seed = (Math.imul(seed, 1103515245) + 12345) >>> 0;
+        return (seed >>> 8) % n;
+    };
+    const stems = ['ad', 'ads', 'banner', 'track', 'pixel', 'beacon', 'promo', 'sponsor', 'analytics', 'tag'];
+    const word = () => {
+        let w = rand(3) ? '' : stems[rand(stems.length)];
+        for (let i = 0, n = 3 + rand(6); i < n; i++) w += String.fromCharCode(97 + rand(26));
+        return w;
+    };
+    const tlds = ['com', 'net', 'org', 'io', 'co.uk', 'de'];
+    const host = () => `${word()}${rand(1000)}.${tlds[rand(tlds.length)]}`;
+    const sizes = ['300x250', '728x90', '160x600', '320x50'];
+
+    const rules = [];
+    const blockedHosts = [];
+    const paths = [];
+    for (let i = 0; i < count; i++) {
+        const r = rand(100);
+        if (r < 60) {
+            const h = host();
+            blockedHosts.push(h);
+            rules.push(`||${h}^${rand(10) === 0 ? '$third-party' : ''}`);
+        } else if (r < 75) {
+            const p = `/${word()}/${word()}_`;
+            paths.push(p);
+            rules.push(p);
+        } else if (r < 85) {
+            const p = `-${word()}-${sizes[rand(sizes.length)]}.`;
+            paths.push(p);
+            rules.push(p);
+        } else if (r < 90) {
+            const p = `${word()}.`;
+            paths.push(p);
+            rules.push(p);
+        } else if (r < 95) {
+            rules.push(`||${host()}/${word()}/*.js$script,domain=${host()}|~${host()}`);
+        } else if (r < 98 || i % 2000) {
+            rules.push(`@@||${host()}^`);
+        } else {
+            rules.push(`/${word()}\\d+\\.(?:gif|png)/$image`);
+        }
+    }
+
+    const sites = Array.from({ length: 200 }, host);
+    const types = ['script', 'image', 'stylesheet', 'xmlhttprequest', 'subdocument', 'font', 'other'];
+    const stream = [];
+    for (let i = 0; i < 20000; i++) {
+        const source = `https://www.${sites[rand(sites.length)]}/`;
+        const r = rand(100);
+        let url;
+        if (r < 15 && blockedHosts.length) url = `https://${rand(2) ? 'cdn.' : ''}${blockedHosts[rand(blockedHosts.length)]}/${word()}.js?id=${rand(99999)}`;
+        else if (r < 25 && paths.length) url = `https://static.${sites[rand(sites.length)]}/assets${paths[rand(paths.length)]}${rand(100)}.gif`;
+        else url = `https://${rand(3) ? 'www.' : 'static.'}${sites[rand(sites.length)]}/${word()}/${word()}-${rand(9999)}.${rand(2) ? 'js' : 'png'}?v=${rand(1e6)}&ref=${word()}`;
+        stream.push(`${types[rand(types.length)]}\t${url}\t${source}`);
+    }
+    return { text: rules.join('\n'), requests: parseStream(stream.join('\n')) };
+}
+
+function main() {
+    const args = parseArgs(process.argv);
+    const tmp = fs.mkdtempSync(path.join(os.tmpdir(), 'filter-bench-'));
+    let lists = args.lists.length ? args.lists : [path.join(__dirname, '..', 'src', 'filters', 'default.txt')];
+    let requests = args.urls ? readStream(args.urls) : [];
+    if (args.synthesize) {
+        const data = synthesize(args.synthesize);
+        const file = path.join(tmp, 'synthetic.txt');
+        fs.writeFileSync(file, data.text);
+        lists = args.lists.length ? lists.concat(file) : [file];
+        if (!args.urls) requests = data.requests;
+    }
+
+    let started = process.hrtime.bigint();
+    const compiled = FilterEngine.compile(lists.map(p => fs.readFileSync(p, 'utf8')));
+    const compileMs = Number(process.hrtime.bigint() - started) / 1e6;
+
+    const cachePath = path.join(tmp, 'filter-cache.bin');
+    loadFilterEngine(lists, cachePath); // writes the cache
+    const warm = loadFilterEngine(lists, cachePath);
+    const engine = warm.engine;
+
+    // Warm-up pass compiles the regexes the stream needs; then time whole replays and
+    // sample single matches for the tail.
+    let blocked = 0;
+    requests.forEach(r => {
+        if (engine.shouldBlock(r.url, r.type, r.source)) blocked++;
+    });
+    started = process.hrtime.bigint();
+    for (let k = 0; k < args.repeat; k++) {
+        for (let i = 0; i < requests.length; i++) engine.shouldBlock(requests[i].url, requests[i].type, requests[i].source);
+    }
+    const totalNs = Number(process.hrtime.bigint() - started);
+    const samples = requests.map(r => {
+        const t0 = process.hrtime.bigint();
+        engine.shouldBlock(r.url, r.type, r.source);
+        return Number(process.hrtime.bigint() - t0);
+    }).sort((a, b) => a - b);
+    started = process.hrtime.bigint();
+    let checksum = 0;
+    for (let k = 0; k < args.repeat; k++) {
+        for (let i = 0; i < requests.length; i++) {
+            const url = requests[i].url;
+            for (let j = 0; j < url.length; j++) checksum += url.charCodeAt(j);
+        }
+    }
+    const scanNs = Number(process.hrtime.bigint() - started);
+    const pct = p => (samples.length ? samples[Math.min(samples.length - 1, Math.ceil(samples.length * p / 100) - 1)] : 0);
+
+    console.log(JSON.stringify({
+        label: args.label,
+        rules: engine.ruleCount,
+        compile_ms: Math.round(compileMs * 10) / 10,
+        cache_bytes: fs.statSync(cachePath).size,
+        cache_load_ms: Math.round(warm.loadMs * 10) / 10,
+        cache_hit: warm.fromCache,
+        requests: requests.length,
+        blocked,
+        ns_per_match: requests.length ? Math.round(totalNs / (requests.length * args.repeat)) : 0,
+        scan_ns: requests.length && checksum ? Math.round(scanNs / (requests.length * args.repeat)) : 0,
+        sampled_ns: { p50: pct(50), p99: pct(99), max: pct(100) },
+        agrees_with_compiled: requests.every(r => compiled.shouldBlock(r.url, r.type, r.source) === engine.shouldBlock(r.url, r.type, r.source))
+    }));
+    fs.rmSync(tmp, { recursive: true, force: true });
+}
+
+main();
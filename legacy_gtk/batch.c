@@ -0,0 +1,234 @@
+/* Headless batch mode. Each input line is {"prompt": "...", "id": <any>} or a bare JSON
+ * string; "-" reads stdin. Up to --parallel requests (GEMINI_BATCH_PARALLEL, default 4)
+ * are in flight on the network worker at once and each result is written to stdout as
+ * soon as it is delivered:
+ *   {"index":0,"id":...,"status":200,"cached":false,"ms":812.4,"text":"..."}
+ * Failures carry "error" instead of "text". The key comes from GEMINI_API_KEY, or from
+ * the credential backends: the kernel keyring once the app (or an earlier run) has
+ * unlocked it, else the key files with GEMINI_PASSPHRASE unlocking an encrypted one.
+ * --dump-stats prints the latency summary as JSON on stderr at the end. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "gemini_core.h"
+#include "batch.h"
+
+#define BATCH_DEFAULT_PARALLEL 4
+
+typedef struct {
+    GMutex lock;
+    GCond cond;
+    guint inflight;
+    guint parallel;
+    guint64 total;
+    guint64 failed;
+    guint64 cached;
+    gchar *api_key;
+} BatchRun;
+
+typedef struct {
+    BatchRun *run;
+    guint64 index;
+    gchar *id_json; /* serialized "id" from the input line, or NULL */
+    guint8 cache_key[RESPONSE_CACHE_KEY_BYTES];
+    gint64 start;
+} BatchItem;
+
+static void batch_item_free(gpointer data) {
+    BatchItem *item = (BatchItem*)data;
+    g_free(item->id_json);
+    g_free(item);
+}
+
+/* One result line. Called from the main thread and the network worker. */
+static void batch_emit(BatchRun *run, BatchItem *item, long status, gboolean cached,
+                       const char *text, const char *error) {
+    GString *line = g_string_sized_new(256);
+    g_string_append_printf(line, "{\"index\":%" G_GUINT64_FORMAT, item->index);
+    if (item->id_json) g_string_append_printf(line, ",\"id\":%s", item->id_json);
+    g_string_append_printf(line, ",\"status\":%ld,\"cached\":%s,\"ms\":", status, cached ? "true" : "false");
+    json_append_double(line, (g_get_monotonic_time() - item->start) / 1000.0);
+    g_string_append(line, error ? ",\"error\":" : ",\"text\":");
+    json_append_string(line, error ? error : text, strlen(error ? error : text));
+    g_string_append(line, "}\n");
+
+    g_mutex_lock(&run->lock);
+    fwrite(line->str, 1, line->len, stdout);
+    fflush(stdout);
+    if (error) run->failed++;
+    if (cached) run->cached++;
+    g_mutex_unlock(&run->lock);
+    g_string_free(line, TRUE);
+}
+
+static void batch_slot_release(BatchRun *run) {
+    g_mutex_lock(&run->lock);
+    run->inflight--;
+    g_cond_signal(&run->cond);
+    g_mutex_unlock(&run->lock);
+}
+
+static void batch_request_done(NetRequest *req) {
+    BatchItem *item = (BatchItem*)req->user_data;
+    if (req->cancelled) {
+        batch_emit(item->run, item, 0, FALSE, NULL, "cancelled");
+    } else if (req->result != CURLE_OK) {
+        batch_emit(item->run, item, 0, FALSE, NULL, curl_easy_strerror(req->result));
+    } else {
+        gint64 start = g_get_monotonic_time();
+        gchar *text = req->resp.len > 0 ? extract_reply_text(req->resp.data, req->resp.len) : NULL;
+        stats_record(STAT_PARSE, (g_get_monotonic_time() - start) / 1000.0);
+        if (req->http_code == 200 && text) {
+            if (!req->coalesced) response_cache_store(item->cache_key, text, strlen(text));
+            batch_emit(item->run, item, req->http_code, FALSE, text, NULL);
+        } else {
+            batch_emit(item->run, item, req->http_code, FALSE, NULL,
+                       req->resp.len > 0 ? req->resp.data : "empty response");
+        }
+        g_free(text);
+    }
+    batch_slot_release(item->run);
+}
+
+/* Parse one input line and start its request; the slot is already taken. */
+static void batch_submit(BatchRun *run, guint64 index, const char *line) {
+    BatchItem *item = g_new0(BatchItem, 1);
+    item->run = run;
+    item->index = index;
+    item->start = g_get_monotonic_time();
+
+    json_object *obj = json_tokener_parse(line);
+    json_object *prompt = obj;
+    json_object *id = NULL;
+    if (obj && json_object_is_type(obj, json_type_object)) {
+        json_object_object_get_ex(obj, "prompt", &prompt);
+        if (json_object_object_get_ex(obj, "id", &id)) {
+            item->id_json = g_strdup(json_object_to_json_string_ext(id, JSON_C_TO_STRING_PLAIN));
+        }
+    }
+    if (!prompt || !json_object_is_type(prompt, json_type_string)) {
+        batch_emit(run, item, 0, FALSE, NULL, "line has no prompt string");
+        if (obj) json_object_put(obj);
+        batch_item_free(item);
+        batch_slot_release(run);
+        return;
+    }
+
+    struct curl_slist *headers = NULL;
+    gchar *request_url = gemini_build_request(run->api_key, &headers);
+    GString *payload = g_string_sized_new(1024);
+    gint64 start = g_get_monotonic_time();
+    if (strstr(request_url, ":generateContent")) context_build_payload(payload, json_object_get_string(prompt));
+    else build_legacy_payload(payload, json_object_get_string(prompt));
+    stats_record(STAT_PAYLOAD, (g_get_monotonic_time() - start) / 1000.0);
+    json_object_put(obj);
+
+    response_cache_key(item->cache_key, request_url, payload->str, payload->len);
+    gint64 age = 0;
+    gchar *cached = response_cache_lookup(item->cache_key, &age);
+    NetRequest *req = cached ? NULL : net_request_new(batch_request_done, item, batch_item_free);
+    if (cached || !req) {
+        if (cached) batch_emit(run, item, 200, TRUE, cached, NULL);
+        else batch_emit(run, item, 0, FALSE, NULL, "failed to initialize curl");
+        g_free(cached);
+        curl_slist_free_all(headers);
+        batch_item_free(item);
+        batch_slot_release(run);
+    } else {
+        req->headers = headers;
+        net_request_set_url(req, request_url);
+        net_request_set_body(req, payload->str, payload->len);
+        net_request_set_flight_key(req, item->cache_key);
+        req->retryable = TRUE;
+        req->failover = TRUE;
+        net_worker_submit(req);
+    }
+    g_string_free(payload, TRUE);
+    g_free(request_url);
+}
+
+static char *batch_passphrase(const char *purpose, gboolean confirm, gpointer user_data) {
+    const char *pass = getenv("GEMINI_PASSPHRASE");
+    return pass && *pass ? g_strdup(pass) : NULL;
+}
+
+static void batch_report(const char *message, gpointer user_data) {
+    g_printerr("%s\n", message);
+}
+
+int batch_main(int argc, char **argv) {
+    const char *path = NULL;
+    gboolean dump_stats = FALSE;
+    const char *parallel_env = getenv("GEMINI_BATCH_PARALLEL");
+    gint64 parallel = parallel_env && *parallel_env ? g_ascii_strtoll(parallel_env, NULL, 10) : BATCH_DEFAULT_PARALLEL;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--parallel") == 0 && i + 1 < argc) parallel = g_ascii_strtoll(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--dump-stats") == 0) dump_stats = TRUE;
+        else if (!path) path = argv[i];
+    }
+    if (!path) {
+        g_printerr("usage: %s --batch prompts.jsonl|- [--parallel N] [--dump-stats]\n", argv[0]);
+        return 2;
+    }
+    FILE *in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!in) {
+        g_printerr("%s: %s\n", path, g_strerror(errno));
+        return 2;
+    }
+    if (!gemini_core_init()) return 1;
+
+    BatchRun run = { 0 };
+    g_mutex_init(&run.lock);
+    g_cond_init(&run.cond);
+    run.parallel = (guint)CLAMP(parallel, 1, 256);
+    const char *env_key = getenv("GEMINI_API_KEY");
+    if (env_key && *env_key) {
+        run.api_key = g_strdup(env_key);
+    } else {
+        GeminiCredentialUI ui = { batch_passphrase, batch_report, NULL };
+        run.api_key = get_api_key(&ui);
+    }
+    if (!run.api_key) {
+        g_printerr("No API key: set GEMINI_API_KEY, or GEMINI_PASSPHRASE for an encrypted key file.\n");
+        if (in != stdin) fclose(in);
+        gemini_core_shutdown();
+        return 1;
+    }
+
+    gint64 started = g_get_monotonic_time();
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    while ((n = getline(&line, &cap, in)) >= 0) {
+        while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r')) line[--n] = '\0';
+        if (n == 0) continue;
+        g_mutex_lock(&run.lock);
+        while (run.inflight >= run.parallel) g_cond_wait(&run.cond, &run.lock);
+        run.inflight++;
+        g_mutex_unlock(&run.lock);
+        batch_submit(&run, run.total++, line);
+    }
+    free(line);
+    if (in != stdin) fclose(in);
+
+    g_mutex_lock(&run.lock);
+    while (run.inflight > 0) g_cond_wait(&run.cond, &run.lock);
+    g_mutex_unlock(&run.lock);
+
+    g_printerr("batch: %" G_GUINT64_FORMAT " prompts, %" G_GUINT64_FORMAT " failed, %" G_GUINT64_FORMAT " cached, %"
+               G_GUINT64_FORMAT " coalesced, %.1f s\n", run.total, run.failed, run.cached,
+               stats_counter(STAT_COUNT_COALESCED), (g_get_monotonic_time() - started) / 1e6);
+    if (dump_stats) {
+        GString *out = g_string_new(NULL);
+        stats_dump_json(out);
+        g_printerr("%s\n", out->str);
+        g_string_free(out, TRUE);
+    }
+    free_api_key(run.api_key);
+    gemini_core_shutdown();
+    g_cond_clear(&run.cond);
+    g_mutex_clear(&run.lock);
+    return run.failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,8 @@
+#ifndef GEMINI_BATCH_H
+#define GEMINI_BATCH_H
+
+/* app --batch prompts.jsonl [--parallel N]: send every prompt without a display and
+ * write one JSON result per line to stdout. */
+int batch_main(int argc, char **argv);
+
+#endif
@@ -0,0 +1,37 @@
+/* LD_PRELOAD allocation counter for the benchmarks. Counts malloc/calloc/realloc calls
+ * and requested bytes process-wide; the bench drivers read it through
+ * alloc_count_snapshot (looked up with dlsym, so they also run without the shim). */
+#define _GNU_SOURCE
+#include <stddef.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long long alloc_calls;
+static unsigned long long alloc_bytes;
+
+static void count(size_t size) {
+    __atomic_add_fetch(&alloc_calls, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&alloc_bytes, size, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size) {
+    count(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    count(n * size);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    count(size);
+    return __libc_realloc(ptr, size);
+}
+
+void alloc_count_snapshot(unsigned long long *calls, unsigned long long *bytes) {
+    *calls = __atomic_load_n(&alloc_calls, __ATOMIC_RELAXED);
+    *bytes = __atomic_load_n(&alloc_bytes, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,29 @@
+#ifndef GEMINI_BENCH_H
+#define GEMINI_BENCH_H
+
+#include <dlfcn.h>
+#include <sys/resource.h>
+
+/* Allocation counters from alloc_count.so when it is preloaded; zeros otherwise. */
+typedef void (*AllocSnapshotFn)(unsigned long long *calls, unsigned long long *bytes);
+
+static inline gboolean bench_alloc_snapshot(unsigned long long *calls, unsigned long long *bytes) {
+    static AllocSnapshotFn fn;
+    static gboolean looked_up;
+    if (!looked_up) {
+        fn = (AllocSnapshotFn)dlsym(RTLD_DEFAULT, "alloc_count_snapshot");
+        looked_up = TRUE;
+    }
+    *calls = *bytes = 0;
+    if (!fn) return FALSE;
+    fn(calls, bytes);
+    return TRUE;
+}
+
+static inline long bench_maxrss_kb(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+#endif
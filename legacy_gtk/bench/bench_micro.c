@@ -0,0 +1,266 @@
+/* In-process micro benchmarks for the hot paths the pipeline bench cannot isolate.
+ * Each case prints one JSON line per variant with ns/op and, under alloc_count.so,
+ * allocations per op:
+ *   response_buffer  exact-size realloc per chunk vs curl_write_cb's geometric growth
+ *   request_body     json-c tree + to_json_string vs the GString writer, rebuilt from
+ *                    scratch and via context_build_payload's cached history prefix
+ *   prompt_body      the same two on a single 1 KiB and 1 MiB prompt, where string
+ *                    escaping dominates
+ *   reply_extract    json_tokener_parse + walk vs extract_reply_text
+ *
+ *   bench_micro [--iterations-scale N] */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gemini_core.h"
+#include "bench.h"
+
+#define MICRO_TURNS 20
+
+static double scale = 1.0;
+
+typedef struct {
+    const char *name;
+    const char *variant;
+    guint iterations;
+    gint64 start;
+    unsigned long long calls, bytes;
+} MicroTimer;
+
+static void micro_begin(MicroTimer *t, const char *name, const char *variant, guint iterations) {
+    t->name = name;
+    t->variant = variant;
+    t->iterations = MAX((guint)(iterations * scale), 1u);
+    bench_alloc_snapshot(&t->calls, &t->bytes);
+    t->start = g_get_monotonic_time();
+}
+
+static void micro_end(MicroTimer *t) {
+    gint64 elapsed = g_get_monotonic_time() - t->start;
+    unsigned long long calls, bytes;
+    gboolean have_allocs = bench_alloc_snapshot(&calls, &bytes);
+    GString *out = g_string_new("{\"case\":");
+    json_append_string(out, t->name, strlen(t->name));
+    g_string_append(out, ",\"variant\":");
+    json_append_string(out, t->variant, strlen(t->variant));
+    g_string_append_printf(out, ",\"iterations\":%u,\"ns_per_op\":", t->iterations);
+    json_append_double(out, elapsed * 1000.0 / t->iterations);
+    if (have_allocs) {
+        g_string_append(out, ",\"allocs_per_op\":");
+        json_append_double(out, (double)(calls - t->calls) / t->iterations);
+    }
+    g_string_append_c(out, '}');
+    printf("%s\n", out->str);
+    g_string_free(out, TRUE);
+}
+
+/* Response buffer: a 4 MiB body arriving in curl-sized 16 KiB writes. */
+static void naive_append(struct CurlResponse *r, const char *p, size_t n) {
+    r->data = realloc(r->data, r->len + n + 1);
+    memcpy(r->data + r->len, p, n);
+    r->len += n;
+    r->data[r->len] = '\0';
+}
+
+static void bench_response_buffer(void) {
+    const size_t body = 4 * 1024 * 1024, chunk = 16 * 1024;
+    char *src = g_malloc(chunk);
+    memset(src, 'x', chunk);
+    MicroTimer t;
+
+    micro_begin(&t, "response_buffer", "naive_realloc", 50);
+    for (guint i = 0; i < t.iterations; i++) {
+        struct CurlResponse r = { 0 };
+        for (size_t off = 0; off < body; off += chunk) naive_append(&r, src, chunk);
+        free(r.data);
+    }
+    micro_end(&t);
+
+    micro_begin(&t, "response_buffer", "geometric", 50);
+    for (guint i = 0; i < t.iterations; i++) {
+        struct CurlResponse r = { 0 };
+        for (size_t off = 0; off < body; off += chunk) curl_write_cb(src, 1, chunk, &r);
+        free(r.data);
+    }
+    micro_end(&t);
+    g_free(src);
+}
+
+/* Request body: MICRO_TURNS turns of history plus the new prompt. */
+static char *turn_text[MICRO_TURNS];
+
+static void jsonc_build(GString *body, const char *message) {
+    json_object *root = json_object_new_object();
+    json_object *contents = json_object_new_array();
+    for (int i = 0; i <= MICRO_TURNS; i++) {
+        json_object *turn = json_object_new_object();
+        json_object *parts = json_object_new_array();
+        json_object *part = json_object_new_object();
+        json_object_object_add(part, "text", json_object_new_string(i < MICRO_TURNS ? turn_text[i] : message));
+        json_object_array_add(parts, part);
+        json_object_object_add(turn, "role", json_object_new_string(i < MICRO_TURNS && i % 2 ? "model" : "user"));
+        json_object_object_add(turn, "parts", parts);
+        json_object_array_add(contents, turn);
+    }
+    json_object_object_add(root, "contents", contents);
+    json_object *config = json_object_new_object();
+    json_object_object_add(config, "maxOutputTokens", json_object_new_int(512));
+    json_object_object_add(config, "temperature", json_object_new_double(0.2));
+    json_object_object_add(root, "generationConfig", config);
+    g_string_assign(body, json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN));
+    json_object_put(root);
+}
+
+static void writer_build(GString *body, const char *message) {
+    g_string_truncate(body, 0);
+    g_string_append(body, "{\"contents\":[");
+    for (int i = 0; i <= MICRO_TURNS; i++) {
+        const char *text = i < MICRO_TURNS ? turn_text[i] : message;
+        if (i) g_string_append_c(body, ',');
+        g_string_append(body, i < MICRO_TURNS && i % 2 ? "{\"role\":\"model\",\"parts\":[{\"text\":" : "{\"role\":\"user\",\"parts\":[{\"text\":");
+        json_append_string(body, text, strlen(text));
+        g_string_append(body, "}]}");
+    }
+    g_string_append(body, "],\"generationConfig\":{\"maxOutputTokens\":512,\"temperature\":");
+    json_append_double(body, 0.2);
+    g_string_append(body, "}}");
+}
+
+static void bench_request_body(void) {
+    const char *message = "Given the discussion so far, list the three \"open\" questions\nand who owns each.";
+    for (int i = 0; i < MICRO_TURNS; i++) {
+        turn_text[i] = g_strdup_printf("Turn %d: the \"quarterly\" figures came in at 4.2%% over plan;\n"
+                                       "revenue grew in every region except EMEA, where FX ate the gains. "
+                                       "Follow-ups are tracked in the planning doc.", i);
+        context_add_turn(i % 2 ? LOG_ROLE_MODEL : LOG_ROLE_USER, turn_text[i]);
+    }
+    GString *body = g_string_sized_new(8192);
+    MicroTimer t;
+
+    micro_begin(&t, "request_body", "jsonc_tree", 20000);
+    for (guint i = 0; i < t.iterations; i++) jsonc_build(body, message);
+    micro_end(&t);
+
+    micro_begin(&t, "request_body", "writer", 20000);
+    for (guint i = 0; i < t.iterations; i++) writer_build(body, message);
+    micro_end(&t);
+
+    micro_begin(&t, "request_body", "writer_cached_prefix", 20000);
+    for (guint i = 0; i < t.iterations; i++) context_build_payload(body, message);
+    micro_end(&t);
+
+    g_string_free(body, TRUE);
+    for (int i = 0; i < MICRO_TURNS; i++) g_free(turn_text[i]);
+}
+
+/* Prompt body: one long prompt, mostly ASCII prose with the odd quote, tab, newline
+ * and multi-byte character, in the :generate shape build_legacy_payload writes. */
+static void jsonc_prompt(GString *body, const char *message) {
+    json_object *root = json_object_new_object();
+    json_object *prompt = json_object_new_object();
+    json_object_object_add(prompt, "text", json_object_new_string(message));
+    json_object_object_add(root, "prompt", prompt);
+    json_object_object_add(root, "maxOutputTokens", json_object_new_int(512));
+    json_object_object_add(root, "temperature", json_object_new_double(0.2));
+    g_string_assign(body, json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN));
+    json_object_put(root);
+}
+
+static void bench_prompt_body_size(const char *size, gsize len, guint iterations) {
+    static const char paragraph[] =
+        "The \"quarterly\" review covers revenue, churn and hiring across every region.\n"
+        "Figures below are in EUR\tunless noted; caf\xc3\xa9 and na\xc3\xafve are spelled as sent. ";
+    GString *prompt = g_string_sized_new(len + sizeof(paragraph));
+    while (prompt->len < len) g_string_append(prompt, paragraph);
+    g_string_truncate(prompt, len);
+    while (prompt->len && (prompt->str[prompt->len - 1] & 0xc0) == 0x80) g_string_truncate(prompt, prompt->len - 1);
+    if (prompt->len && (guchar)prompt->str[prompt->len - 1] >= 0xc0) g_string_truncate(prompt, prompt->len - 1);
+    GString *body = g_string_sized_new(len * 2 + 256);
+    gchar *variant;
+    MicroTimer t;
+
+    variant = g_strdup_printf("jsonc_tree_%s", size);
+    micro_begin(&t, "prompt_body", variant, iterations);
+    for (guint i = 0; i < t.iterations; i++) jsonc_prompt(body, prompt->str);
+    micro_end(&t);
+    g_free(variant);
+
+    variant = g_strdup_printf("writer_%s", size);
+    micro_begin(&t, "prompt_body", variant, iterations);
+    for (guint i = 0; i < t.iterations; i++) build_legacy_payload(body, prompt->str);
+    micro_end(&t);
+    g_free(variant);
+
+    g_string_free(body, TRUE);
+    g_string_free(prompt, TRUE);
+}
+
+static void bench_prompt_body(void) {
+    bench_prompt_body_size("1k", 1024, 50000);
+    bench_prompt_body_size("1m", 1024 * 1024, 50);
+}
+
+/* Reply extraction: an 8 KiB answer wrapped in the usual metadata. */
+static gchar *jsonc_extract(const char *data) {
+    json_object *root = json_tokener_parse(data);
+    json_object *candidates = NULL, *content = NULL, *parts = NULL;
+    gchar *out = NULL;
+    if (root && json_object_object_get_ex(root, "candidates", &candidates) &&
+        json_object_object_get_ex(json_object_array_get_idx(candidates, 0), "content", &content) &&
+        json_object_object_get_ex(content, "parts", &parts)) {
+        GString *text = g_string_new(NULL);
+        for (size_t i = 0; i < json_object_array_length(parts); i++) {
+            json_object *t = NULL;
+            if (json_object_object_get_ex(json_object_array_get_idx(parts, i), "text", &t)) {
+                g_string_append(text, json_object_get_string(t));
+            }
+        }
+        out = g_string_free(text, FALSE);
+    }
+    if (root) json_object_put(root);
+    return out;
+}
+
+static void bench_reply_extract(void) {
+    GString *text = g_string_new(NULL);
+    while (text->len < 8192) g_string_append(text, "Line of model output with \"quotes\", a tab\tand a newline\n");
+    GString *reply = g_string_new("{\"candidates\":[{\"content\":{\"parts\":[{\"text\":");
+    json_append_string(reply, text->str, text->len);
+    g_string_append(reply, "}],\"role\":\"model\"},\"finishReason\":\"STOP\",\"index\":0,\"safetyRatings\":[");
+    for (int i = 0; i < 4; i++) {
+        g_string_append_printf(reply, "%s{\"category\":\"HARM_CATEGORY_%d\",\"probability\":\"NEGLIGIBLE\"}", i ? "," : "", i);
+    }
+    g_string_append(reply, "]}],\"usageMetadata\":{\"promptTokenCount\":412,\"candidatesTokenCount\":2048,\"totalTokenCount\":2460}}");
+
+    gchar *a = jsonc_extract(reply->str), *b = extract_reply_text(reply->str, reply->len);
+    if (!a || !b || strcmp(a, b) != 0) g_printerr("reply_extract: variants disagree\n");
+    g_free(a);
+    g_free(b);
+
+    MicroTimer t;
+    micro_begin(&t, "reply_extract", "jsonc_dom", 20000);
+    for (guint i = 0; i < t.iterations; i++) g_free(jsonc_extract(reply->str));
+    micro_end(&t);
+
+    micro_begin(&t, "reply_extract", "scanner", 20000);
+    for (guint i = 0; i < t.iterations; i++) g_free(extract_reply_text(reply->str, reply->len));
+    micro_end(&t);
+
+    g_string_free(reply, TRUE);
+    g_string_free(text, TRUE);
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--iterations-scale") == 0 && i + 1 < argc) scale = g_ascii_strtod(argv[++i], NULL);
+    }
+    scale = MAX(scale, 0.001);
+    context_init();
+    bench_response_buffer();
+    bench_request_body();
+    bench_prompt_body();
+    bench_reply_extract();
+    return 0;
+}
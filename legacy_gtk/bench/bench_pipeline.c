@@ -0,0 +1,223 @@
+/* Drives the request pipeline (libgeminicore: payload build, rate limiter, network
+ * worker, transport, response parsing) headlessly against mock_gemini and prints one
+ * JSON line with throughput, end-to-end latency percentiles, allocations per request,
+ * peak RSS, the per-phase stats and the per-endpoint health.
+ *
+ *   bench_pipeline --endpoint URL[,URL...] [--requests 1000] [--parallel 8] [--stream]
+ *                  [--no-hedge] [--label name]
+ *
+ * Several endpoints are tried in order with failover and hedging, as GEMINI_ENDPOINT
+ * does in the app; --no-hedge keeps the failover and turns hedging off. The response
+ * cache is turned off so every request reaches the server. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gemini_core.h"
+#include "bench.h"
+
+typedef struct {
+    GMutex lock;
+    GCond cond;
+    guint inflight;
+    guint64 ok;
+    guint64 errors;
+    guint64 retries;
+    guint64 text_bytes;
+    GArray *latency_ms; /* double */
+} BenchRun;
+
+typedef struct {
+    BenchRun *run;
+    gint64 start;
+    JsonStream js;
+    gboolean stream;
+    gsize streamed;
+} BenchItem;
+
+static void bench_item_free(gpointer data) {
+    BenchItem *item = (BenchItem*)data;
+    if (item->stream) json_stream_clear(&item->js);
+    g_free(item);
+}
+
+static void bench_stream_object(json_object *chunk, gpointer user_data) {
+    BenchItem *item = (BenchItem*)user_data;
+    json_object *candidates = NULL, *content = NULL, *parts = NULL;
+    if (!json_object_object_get_ex(chunk, "candidates", &candidates)) return;
+    json_object *first = json_object_array_get_idx(candidates, 0);
+    if (!first || !json_object_object_get_ex(first, "content", &content) ||
+        !json_object_object_get_ex(content, "parts", &parts)) return;
+    size_t n = json_object_array_length(parts);
+    for (size_t i = 0; i < n; i++) {
+        json_object *text = NULL;
+        if (json_object_object_get_ex(json_object_array_get_idx(parts, i), "text", &text)) {
+            item->streamed += (gsize)json_object_get_string_len(text);
+        }
+    }
+}
+
+static size_t bench_stream_data(NetRequest *req, const char *data, size_t len) {
+    BenchItem *item = (BenchItem*)req->user_data;
+    long http_code = net_request_http_code(req);
+    if (http_code != 200) return curl_write_cb((void*)data, 1, len, &req->resp);
+    gint64 start = g_get_monotonic_time();
+    json_stream_feed(&item->js, data, len);
+    stats_record(STAT_PARSE, (g_get_monotonic_time() - start) / 1000.0);
+    return len;
+}
+
+static void bench_request_done(NetRequest *req) {
+    BenchItem *item = (BenchItem*)req->user_data;
+    BenchRun *run = item->run;
+    gsize text_len = item->streamed;
+    gboolean ok = req->result == CURLE_OK && req->http_code == 200;
+    if (ok && !item->stream) {
+        gint64 start = g_get_monotonic_time();
+        gchar *text = extract_reply_text(req->resp.data, req->resp.len);
+        stats_record(STAT_PARSE, (g_get_monotonic_time() - start) / 1000.0);
+        ok = text != NULL;
+        text_len = text ? strlen(text) : 0;
+        g_free(text);
+    }
+    double ms = (g_get_monotonic_time() - item->start) / 1000.0;
+
+    g_mutex_lock(&run->lock);
+    if (ok) run->ok++;
+    else run->errors++;
+    run->retries += req->attempts;
+    run->text_bytes += text_len;
+    g_array_append_val(run->latency_ms, ms);
+    run->inflight--;
+    g_cond_signal(&run->cond);
+    g_mutex_unlock(&run->lock);
+}
+
+static int double_cmp(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(GArray *sorted, guint pct) {
+    if (sorted->len == 0) return 0.0;
+    return g_array_index(sorted, double, (sorted->len * pct + 99) / 100 - 1);
+}
+
+int main(int argc, char **argv) {
+    const char *endpoint = NULL, *label = "pipeline";
+    guint requests = 1000;
+    int parallel_arg = 8;
+    gboolean stream = FALSE, hedge = TRUE;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--endpoint") == 0 && i + 1 < argc) endpoint = argv[++i];
+        else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc) requests = (guint)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--parallel") == 0 && i + 1 < argc) parallel_arg = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--label") == 0 && i + 1 < argc) label = argv[++i];
+        else if (strcmp(argv[i], "--stream") == 0) stream = TRUE;
+        else if (strcmp(argv[i], "--no-hedge") == 0) hedge = FALSE;
+    }
+    guint parallel = (guint)MAX(parallel_arg, 1);
+    if (!endpoint) {
+        g_printerr("usage: %s --endpoint URL[,URL...] [--requests N] [--parallel N] [--stream] [--no-hedge] [--label name]\n", argv[0]);
+        return 2;
+    }
+    gchar *conc = g_strdup_printf("%u", parallel);
+    g_setenv("GEMINI_ENDPOINT", endpoint, TRUE);
+    g_setenv("GEMINI_CACHE_TTL", "0", TRUE);
+    g_setenv("GEMINI_MAX_CONCURRENCY", conc, FALSE);
+    if (!hedge) g_setenv("GEMINI_HEDGE", "0", TRUE);
+    g_free(conc);
+    if (!gemini_core_init()) return 1;
+
+    BenchRun run = { 0 };
+    g_mutex_init(&run.lock);
+    g_cond_init(&run.cond);
+    run.latency_ms = g_array_sized_new(FALSE, FALSE, sizeof(double), requests);
+
+    unsigned long long calls0, bytes0, calls1, bytes1;
+    gboolean have_allocs = bench_alloc_snapshot(&calls0, &bytes0);
+    gint64 started = g_get_monotonic_time();
+    GString *payload = g_string_sized_new(1024);
+    for (guint i = 0; i < requests; i++) {
+        g_mutex_lock(&run.lock);
+        while (run.inflight >= parallel) g_cond_wait(&run.cond, &run.lock);
+        run.inflight++;
+        g_mutex_unlock(&run.lock);
+
+        BenchItem *item = g_new0(BenchItem, 1);
+        item->run = &run;
+        item->start = g_get_monotonic_time();
+        item->stream = stream;
+        struct curl_slist *headers = NULL;
+        gchar *url = gemini_build_request("AIza-bench", &headers);
+        if (stream) {
+            gchar *stream_url = make_stream_url(url);
+            g_free(url);
+            url = stream_url;
+            json_stream_init(&item->js, TRUE, bench_stream_object, item);
+        }
+        gchar *prompt = g_strdup_printf("Benchmark prompt %u: summarise the quarterly report in three bullet points.", i);
+        if (stream || strstr(url, ":generateContent")) context_build_payload(payload, prompt);
+        else build_legacy_payload(payload, prompt);
+        g_free(prompt);
+
+        NetRequest *req = net_request_new(bench_request_done, item, bench_item_free);
+        if (!req) {
+            g_printerr("bench_pipeline: failed to initialize curl\n");
+            return 1;
+        }
+        req->headers = headers;
+        if (stream) req->on_data = bench_stream_data;
+        req->retryable = TRUE;
+        req->failover = TRUE;
+        net_request_set_url(req, url);
+        net_request_set_body(req, payload->str, payload->len);
+        net_worker_submit(req);
+        g_free(url);
+    }
+    g_mutex_lock(&run.lock);
+    while (run.inflight > 0) g_cond_wait(&run.cond, &run.lock);
+    g_mutex_unlock(&run.lock);
+    double wall = (g_get_monotonic_time() - started) / 1e6;
+    bench_alloc_snapshot(&calls1, &bytes1);
+
+    g_array_sort(run.latency_ms, double_cmp);
+    GString *out = g_string_new(NULL);
+    g_string_append(out, "{\"label\":");
+    json_append_string(out, label, strlen(label));
+    g_string_append_printf(out, ",\"stream\":%s,\"requests\":%u,\"parallel\":%u,\"ok\":%" G_GUINT64_FORMAT
+                           ",\"errors\":%" G_GUINT64_FORMAT ",\"retries\":%" G_GUINT64_FORMAT ",\"text_bytes\":%" G_GUINT64_FORMAT,
+                           stream ? "true" : "false", requests, parallel, run.ok, run.errors, run.retries, run.text_bytes);
+    g_string_append(out, ",\"wall_s\":");
+    json_append_double(out, wall);
+    g_string_append(out, ",\"rps\":");
+    json_append_double(out, wall > 0 ? requests / wall : 0.0);
+    g_string_append(out, ",\"latency_ms\":{\"p50\":");
+    json_append_double(out, percentile(run.latency_ms, 50));
+    g_string_append(out, ",\"p95\":");
+    json_append_double(out, percentile(run.latency_ms, 95));
+    g_string_append(out, ",\"p99\":");
+    json_append_double(out, percentile(run.latency_ms, 99));
+    g_string_append(out, ",\"max\":");
+    json_append_double(out, percentile(run.latency_ms, 100));
+    g_string_append_c(out, '}');
+    if (have_allocs && requests > 0) {
+        g_string_append(out, ",\"allocs_per_req\":");
+        json_append_double(out, (double)(calls1 - calls0) / requests);
+        g_string_append(out, ",\"alloc_bytes_per_req\":");
+        json_append_double(out, (double)(bytes1 - bytes0) / requests);
+    }
+    g_string_append_printf(out, ",\"maxrss_kb\":%ld,\"phases\":", bench_maxrss_kb());
+    stats_dump_json(out);
+    g_string_append(out, ",\"endpoints\":");
+    net_endpoints_dump_json(out);
+    g_string_append_c(out, '}');
+    printf("%s\n", out->str);
+
+    g_string_free(out, TRUE);
+    g_string_free(payload, TRUE);
+    g_array_free(run.latency_ms, TRUE);
+    gemini_core_shutdown();
+    return run.errors > 0 ? 1 : 0;
+}
@@ -0,0 +1,58 @@
+/* Offline check of context trimming: fills a small window (GEMINI_CONTEXT_TOKENS) with
+ * user/model pairs of uneven length, so the token budget cuts at every possible turn
+ * boundary, and checks after each exchange that the packed contents still open with a
+ * user turn and end with the new prompt.
+ *
+ *   check_context */
+#include <stdio.h>
+#include <string.h>
+
+#include "gemini_core.h"
+
+#define CHECK_WINDOW_TOKENS "1024"
+#define CHECK_EXCHANGES 64
+
+static int failures;
+
+static void check(gboolean ok, const char *what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static const char *check_role(json_object *contents, size_t i) {
+    json_object *role = NULL;
+    json_object *turn = json_object_array_get_idx(contents, i);
+    return turn && json_object_object_get_ex(turn, "role", &role) ? json_object_get_string(role) : "";
+}
+
+int main(void) {
+    g_setenv("GEMINI_CONTEXT_TOKENS", CHECK_WINDOW_TOKENS, TRUE);
+    context_init();
+    GString *body = g_string_new(NULL);
+    gsize trimmed = 0;
+    for (int i = 0; i < CHECK_EXCHANGES; i++) {
+        gchar *prompt = g_strnfill(16 + (gsize)(i * 37) % 200, 'u');
+        context_build_payload(body, prompt);
+        json_object *root = json_tokener_parse(body->str);
+        json_object *contents = NULL;
+        check(root && json_object_object_get_ex(root, "contents", &contents), "body parses with contents");
+        size_t n = contents ? json_object_array_length(contents) : 0;
+        check(n > 0 && strcmp(check_role(contents, 0), "user") == 0, "first packed role is user");
+        check(n > 0 && strcmp(check_role(contents, n - 1), "user") == 0, "last packed role is user");
+        if (n < (size_t)(2 * i + 1)) trimmed++;
+        json_object_put(root);
+
+        gchar *reply = g_strnfill(64 + (gsize)(i * 53) % 700, 'm');
+        context_add_turn(LOG_ROLE_USER, prompt);
+        context_add_turn(LOG_ROLE_MODEL, reply);
+        g_free(reply);
+        g_free(prompt);
+    }
+    check(trimmed > 0, "window was filled and trimmed");
+    g_string_free(body, TRUE);
+
+    printf("%s\n", failures ? "context check failed" : "context check passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,69 @@
+/* Offline check of the kernel keyring credential backend: store, find, read, replace
+ * and expire a key through credential_backend_keyring. It joins a fresh anonymous
+ * session keyring first, so the real key in the user keyring is never touched, and
+ * skips (exit 0) where keyctl is unavailable: no CONFIG_KEYS, or a seccomp profile
+ * that refuses add_key/keyctl with ENOSYS or EPERM.
+ *
+ *   check_keyring */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/keyctl.h>
+
+#include "gemini_core.h"
+
+#define CHECK_DESCRIPTION "gemini-gtk:api_key"
+#define CHECK_TIMEOUT_SEC 1
+
+static int failures;
+
+static void check(gboolean ok, const char *what) {
+    printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok) failures++;
+}
+
+static gboolean check_unavailable(int err) {
+    return err == ENOSYS || err == EPERM || err == EACCES;
+}
+
+static gboolean check_loads(const char *expected) {
+    char *got = credential_backend_keyring.load(NULL);
+    gboolean ok = expected ? got && strcmp(got, expected) == 0 : got == NULL;
+    free_api_key(got);
+    return ok;
+}
+
+int main(void) {
+    if (syscall(SYS_keyctl, KEYCTL_JOIN_SESSION_KEYRING, NULL) < 0 ||
+        syscall(SYS_add_key, "user", "gemini-gtk:check-probe", "x", (size_t)1, KEY_SPEC_SESSION_KEYRING) < 0) {
+        if (check_unavailable(errno)) {
+            printf("skip: kernel keyring unavailable (%s)\n", g_strerror(errno));
+            return 0;
+        }
+        printf("FAIL: session keyring: %s\n", g_strerror(errno));
+        return 1;
+    }
+    g_setenv("GEMINI_KEYRING", "session", TRUE);
+    g_setenv("GEMINI_KEYRING_TIMEOUT", G_STRINGIFY(CHECK_TIMEOUT_SEC), TRUE);
+
+    check(check_loads(NULL), "empty keyring loads nothing");
+    check(credential_backend_keyring.store(NULL, "check-key-1"), "store");
+    long id = syscall(SYS_keyctl, KEYCTL_SEARCH, KEY_SPEC_SESSION_KEYRING, "user", CHECK_DESCRIPTION, 0);
+    check(id >= 0, "search finds " CHECK_DESCRIPTION);
+    char desc[256];
+    long n = id >= 0 ? syscall(SYS_keyctl, KEYCTL_DESCRIBE, id, desc, sizeof desc) : -1;
+    check(n > 0 && g_str_has_prefix(desc, "user;") && strstr(desc, ";3f0b0000;" CHECK_DESCRIPTION),
+          "user key with possessor-all, user view/read/search permissions");
+    check(check_loads("check-key-1"), "load reads the stored key");
+    check(credential_backend_keyring.store(NULL, "check-key-2") && check_loads("check-key-2"),
+          "store replaces the key");
+    g_usleep((CHECK_TIMEOUT_SEC + 1) * G_USEC_PER_SEC);
+    check(check_loads(NULL), "key expires after GEMINI_KEYRING_TIMEOUT");
+
+    printf("%s\n", failures ? "keyring check failed" : "keyring check passed");
+    return failures ? 1 : 0;
+}
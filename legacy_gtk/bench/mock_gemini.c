@@ -0,0 +1,253 @@
+/* Local stand-in for the Gemini endpoints, for benchmarks. Plain HTTP/1.1 with
+ * keep-alive, one thread per connection. Answers :generate with {candidates:[{output}]},
+ * :generateContent with {candidates:[{content:{parts:[{text}]}}]} and
+ * :streamGenerateContent with SSE events, one per chunk. Ollama's /api/generate is
+ * answered with NDJSON lines, one per chunk, ending in a done line with context tokens.
+ *
+ *   mock_gemini [--port 18080] [--latency-ms 0] [--jitter-ms 0] [--size 512]
+ *               [--chunks 1] [--chunk-delay-ms 0] [--error-rate 0] [--error-code 429]
+ *               [--slow-rate 0] [--slow-ms 0]
+ *
+ * --size is the reply text length; non-streamed replies are sent with chunked transfer
+ * encoding split into --chunks pieces. --error-rate answers that fraction of requests
+ * with --error-code (a 429 carries Retry-After: 0). --slow-rate holds that fraction of
+ * requests back another --slow-ms before answering, for a latency tail. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+typedef struct {
+    int port;
+    int latency_ms;
+    int jitter_ms;
+    size_t size;
+    int chunks;
+    int chunk_delay_ms;
+    double error_rate;
+    int error_code;
+    double slow_rate;
+    int slow_ms;
+} MockConfig;
+
+static MockConfig cfg = { 18080, 0, 0, 512, 1, 0, 0.0, 429, 0.0, 0 };
+static char *reply_text; /* cfg.size bytes of filler, NUL-terminated */
+
+static void sleep_ms(int ms) {
+    if (ms <= 0) return;
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int write_chunk(int fd, const char *buf, size_t len) {
+    char hdr[32];
+    int n = snprintf(hdr, sizeof(hdr), "%zx\r\n", len);
+    if (write_all(fd, hdr, (size_t)n) || write_all(fd, buf, len) || write_all(fd, "\r\n", 2)) return -1;
+    return 0;
+}
+
+/* Read one request; returns 0 and the path, or -1 when the peer is gone. */
+static int read_request(int fd, char *buf, size_t cap, char *path, size_t path_cap, int *keep_alive) {
+    size_t len = 0;
+    char *end = NULL;
+    while (!(end = memmem(buf, len, "\r\n\r\n", 4))) {
+        if (len == cap) return -1;
+        ssize_t n = recv(fd, buf + len, cap - len, 0);
+        if (n <= 0) return -1;
+        len += (size_t)n;
+    }
+    size_t head = (size_t)(end - buf) + 4;
+    if (sscanf(buf, "%*s %1023s", path) != 1) return -1;
+    path[path_cap - 1] = '\0';
+
+    size_t body = 0;
+    *keep_alive = 1;
+    for (char *line = strstr(buf, "\r\n"); line && line < end; line = strstr(line + 2, "\r\n")) {
+        if (strncasecmp(line + 2, "Content-Length:", 15) == 0) body = strtoul(line + 17, NULL, 10);
+        if (strncasecmp(line + 2, "Connection: close", 17) == 0) *keep_alive = 0;
+    }
+    /* Discard the body; it is not needed to build the reply. */
+    size_t have = len - head;
+    while (have < body) {
+        ssize_t n = recv(fd, buf, cap, 0);
+        if (n <= 0) return -1;
+        have += (size_t)n;
+    }
+    return 0;
+}
+
+static int send_error(int fd, int code) {
+    char resp[512], body[128];
+    int blen = snprintf(body, sizeof(body), "{\"error\":{\"code\":%d,\"message\":\"Injected by mock_gemini\"}}", code);
+    int n = snprintf(resp, sizeof(resp),
+                     "HTTP/1.1 %d Mock Error\r\nContent-Type: application/json\r\n%sContent-Length: %d\r\n\r\n",
+                     code, code == 429 ? "Retry-After: 0\r\n" : "", blen);
+    return write_all(fd, resp, (size_t)n) || write_all(fd, body, (size_t)blen) ? -1 : 0;
+}
+
+static int send_stream(int fd) {
+    const char *hdr = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nTransfer-Encoding: chunked\r\n\r\n";
+    if (write_all(fd, hdr, strlen(hdr))) return -1;
+    int chunks = cfg.chunks > 0 ? cfg.chunks : 1;
+    size_t per = (cfg.size + (size_t)chunks - 1) / (size_t)chunks;
+    char *event = malloc(per + 256);
+    for (int i = 0; i < chunks; i++) {
+        size_t off = (size_t)i * per;
+        size_t n = off >= cfg.size ? 0 : (cfg.size - off < per ? cfg.size - off : per);
+        int len = snprintf(event, per + 256,
+                           "data: {\"candidates\":[{\"content\":{\"parts\":[{\"text\":\"%.*s\"}],\"role\":\"model\"}}]}\r\n\r\n",
+                           (int)n, reply_text + off);
+        if (write_chunk(fd, event, (size_t)len)) {
+            free(event);
+            return -1;
+        }
+        if (i + 1 < chunks) sleep_ms(cfg.chunk_delay_ms);
+    }
+    free(event);
+    return write_all(fd, "0\r\n\r\n", 5);
+}
+
+static int send_ollama(int fd) {
+    const char *hdr = "HTTP/1.1 200 OK\r\nContent-Type: application/x-ndjson\r\nTransfer-Encoding: chunked\r\n\r\n";
+    if (write_all(fd, hdr, strlen(hdr))) return -1;
+    int chunks = cfg.chunks > 0 ? cfg.chunks : 1;
+    size_t per = (cfg.size + (size_t)chunks - 1) / (size_t)chunks;
+    char *line = malloc(per + 256);
+    for (int i = 0; i < chunks; i++) {
+        size_t off = (size_t)i * per;
+        size_t n = off >= cfg.size ? 0 : (cfg.size - off < per ? cfg.size - off : per);
+        int len = snprintf(line, per + 256, "{\"model\":\"mock\",\"response\":\"%.*s\",\"done\":false}\n",
+                           (int)n, reply_text + off);
+        if (write_chunk(fd, line, (size_t)len)) {
+            free(line);
+            return -1;
+        }
+        if (i + 1 < chunks) sleep_ms(cfg.chunk_delay_ms);
+    }
+    free(line);
+    static const char done[] = "{\"model\":\"mock\",\"response\":\"\",\"done\":true,\"context\":[1,2,3]}\n";
+    return write_chunk(fd, done, sizeof(done) - 1) || write_all(fd, "0\r\n\r\n", 5) ? -1 : 0;
+}
+
+static int send_reply(int fd, int legacy) {
+    /* Padding the real API adds around the text, so parsers have something to skip. */
+    static const char ratings[] =
+        "\"safetyRatings\":[{\"category\":\"HARM_CATEGORY_HARASSMENT\",\"probability\":\"NEGLIGIBLE\"},"
+        "{\"category\":\"HARM_CATEGORY_HATE_SPEECH\",\"probability\":\"NEGLIGIBLE\"},"
+        "{\"category\":\"HARM_CATEGORY_SEXUALLY_EXPLICIT\",\"probability\":\"NEGLIGIBLE\"},"
+        "{\"category\":\"HARM_CATEGORY_DANGEROUS_CONTENT\",\"probability\":\"NEGLIGIBLE\"}]";
+    size_t cap = cfg.size + 1024;
+    char *body = malloc(cap);
+    int len = legacy
+        ? snprintf(body, cap, "{\"candidates\":[{\"output\":\"%s\",%s}]}", reply_text, ratings)
+        : snprintf(body, cap, "{\"candidates\":[{\"content\":{\"parts\":[{\"text\":\"%s\"}],\"role\":\"model\"},"
+                              "\"finishReason\":\"STOP\",\"index\":0,%s}],"
+                              "\"usageMetadata\":{\"promptTokenCount\":8,\"candidatesTokenCount\":%zu,\"totalTokenCount\":%zu}}",
+                   reply_text, ratings, cfg.size / 4, cfg.size / 4 + 8);
+    const char *hdr = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nTransfer-Encoding: chunked\r\n\r\n";
+    int rc = write_all(fd, hdr, strlen(hdr));
+    int chunks = cfg.chunks > 0 ? cfg.chunks : 1;
+    size_t per = ((size_t)len + (size_t)chunks - 1) / (size_t)chunks;
+    for (size_t off = 0; rc == 0 && off < (size_t)len; off += per) {
+        rc = write_chunk(fd, body + off, (size_t)len - off < per ? (size_t)len - off : per);
+        if (rc == 0 && off + per < (size_t)len) sleep_ms(cfg.chunk_delay_ms);
+    }
+    free(body);
+    return rc || write_all(fd, "0\r\n\r\n", 5) ? -1 : 0;
+}
+
+static void *serve_connection(void *data) {
+    int fd = (int)(intptr_t)data;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    char *buf = malloc(65536);
+    char path[1024];
+    unsigned int seed = (unsigned int)fd ^ (unsigned int)time(NULL);
+    int keep_alive = 1;
+    while (keep_alive && read_request(fd, buf, 65536, path, sizeof(path), &keep_alive) == 0) {
+        sleep_ms(cfg.latency_ms + (cfg.jitter_ms > 0 ? (int)(rand_r(&seed) % (unsigned int)(cfg.jitter_ms + 1)) : 0));
+        if (cfg.slow_rate > 0 && rand_r(&seed) / (double)RAND_MAX < cfg.slow_rate) sleep_ms(cfg.slow_ms);
+        int rc;
+        if (cfg.error_rate > 0 && rand_r(&seed) / (double)RAND_MAX < cfg.error_rate) rc = send_error(fd, cfg.error_code);
+        else if (strstr(path, ":streamGenerateContent")) rc = send_stream(fd);
+        else if (strstr(path, "/api/generate")) rc = send_ollama(fd);
+        else rc = send_reply(fd, strstr(path, ":generateContent") == NULL);
+        if (rc) break;
+    }
+    free(buf);
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const char *opt = argv[i], *val = argv[i + 1];
+        if (strcmp(opt, "--port") == 0) cfg.port = atoi(val);
+        else if (strcmp(opt, "--latency-ms") == 0) cfg.latency_ms = atoi(val);
+        else if (strcmp(opt, "--jitter-ms") == 0) cfg.jitter_ms = atoi(val);
+        else if (strcmp(opt, "--size") == 0) cfg.size = strtoul(val, NULL, 10);
+        else if (strcmp(opt, "--chunks") == 0) cfg.chunks = atoi(val);
+        else if (strcmp(opt, "--chunk-delay-ms") == 0) cfg.chunk_delay_ms = atoi(val);
+        else if (strcmp(opt, "--error-rate") == 0) cfg.error_rate = atof(val);
+        else if (strcmp(opt, "--error-code") == 0) cfg.error_code = atoi(val);
+        else if (strcmp(opt, "--slow-rate") == 0) cfg.slow_rate = atof(val);
+        else if (strcmp(opt, "--slow-ms") == 0) cfg.slow_ms = atoi(val);
+        else {
+            fprintf(stderr, "unknown option %s\n", opt);
+            return 2;
+        }
+    }
+    reply_text = malloc(cfg.size + 1);
+    for (size_t i = 0; i < cfg.size; i++) reply_text[i] = "lorem ipsum dolor sit amet "[i % 27];
+    reply_text[cfg.size] = '\0';
+
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons((uint16_t)cfg.port) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(lfd, 128) != 0) {
+        perror("mock_gemini: bind");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "mock_gemini: listening on 127.0.0.1:%d\n", cfg.port);
+    for (;;) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            perror("mock_gemini: accept");
+            return 1;
+        }
+        pthread_t t;
+        if (pthread_create(&t, NULL, serve_connection, (void*)(intptr_t)fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(t);
+    }
+}
@@ -0,0 +1,88 @@
+#!/bin/bash
+# Offline benchmark run: starts mock_gemini for each scenario, drives the request
+# pipeline against it and finishes with the micro benchmarks. Every result is one
+# JSON line on stdout, so the output can be diffed or collected in CI.
+#
+#   BENCH_PORT       port for the mock server (default 18080; the failover scenarios
+#                    add a second one on the next port)
+#   BENCH_REQUESTS   requests per pipeline scenario (default 1000)
+#   BENCH_SCALE      iteration multiplier for the micro benchmarks (default 1)
+
+cd "$(dirname "$0")" || exit 1
+PORT=${BENCH_PORT:-18080}
+REQUESTS=${BENCH_REQUESTS:-1000}
+SCALE=${BENCH_SCALE:-1}
+PRELOAD=$(pwd)/alloc_count.so
+PORT2=$((PORT + 1))
+BASE="http://127.0.0.1:$PORT/v1beta/models/mock"
+BASE2="http://127.0.0.1:$PORT2/v1beta/models/mock"
+status=0
+MOCK_PIDS=
+
+stop_mock() {
+    for pid in $MOCK_PIDS; do
+        kill "$pid" 2>/dev/null
+        wait "$pid" 2>/dev/null
+    done
+    MOCK_PIDS=
+}
+trap stop_mock EXIT INT TERM
+
+# start_mock <port> <mock options>: one more server; stop_mock stops them all.
+start_mock() {
+    port=$1
+    shift
+    ./mock_gemini --port "$port" "$@" &
+    MOCK_PIDS="$MOCK_PIDS $!"
+    for _ in 1 2 3 4 5 6 7 8 9 10; do
+        if (exec 3<>"/dev/tcp/127.0.0.1/$port") 2>/dev/null || nc -z 127.0.0.1 "$port" 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.2
+    done
+    return 0
+}
+
+# scenario <label> <requests> <parallel> <stream 0|1> -- <mock options>
+scenario() {
+    label=$1 requests=$2 parallel=$3 stream=$4
+    shift 5
+    stop_mock
+    start_mock "$PORT" "$@"
+    set -- --endpoint "$BASE:generateContent" --requests "$requests" --parallel "$parallel" --label "$label"
+    [ "$stream" = 1 ] && set -- "$@" --stream
+    LD_PRELOAD=$PRELOAD ./bench_pipeline "$@" || status=1
+}
+
+# Two identical servers where 2% of replies stall for 400 ms. Hedging sends a stalled
+# request to the second server after the first one's p95; compare latency_ms.p99 and
+# phases.counters.hedges / hedge_wins between the two runs. A hedge needs room in the
+# concurrency window, so both runs get twice --parallel.
+hedged() {
+    label=$1
+    shift
+    stop_mock
+    start_mock "$PORT" --size 1024 --latency-ms 5 --jitter-ms 5 --slow-rate 0.02 --slow-ms 400
+    start_mock "$PORT2" --size 1024 --latency-ms 5 --jitter-ms 5 --slow-rate 0.02 --slow-ms 400
+    GEMINI_MAX_CONCURRENCY=16 LD_PRELOAD=$PRELOAD ./bench_pipeline --endpoint "$BASE:generateContent,$BASE2:generateContent" \
+        --requests "$REQUESTS" --parallel 8 --label "$label" "$@" || status=1
+}
+
+scenario baseline "$REQUESTS" 8 0 -- --size 512
+scenario streaming "$REQUESTS" 8 1 -- --size 4096 --chunks 16
+scenario large_reply $((REQUESTS / 5)) 4 0 -- --size 262144 --chunks 64
+scenario tail_latency $((REQUESTS / 2)) 32 0 -- --size 1024 --latency-ms 20 --jitter-ms 80
+scenario throttled "$REQUESTS" 8 0 -- --size 512 --error-rate 0.05 --error-code 429
+hedged two_servers_unhedged --no-hedge
+hedged two_servers_hedged
+
+# The first endpoint refuses connections: requests fail over to the second, which stays
+# first in rotation while the first cools down.
+stop_mock
+start_mock "$PORT2" --size 512
+LD_PRELOAD=$PRELOAD ./bench_pipeline --endpoint "http://127.0.0.1:$((PORT + 2))/v1beta/models/mock:generateContent,$BASE2:generateContent" \
+    --requests "$REQUESTS" --parallel 8 --label dead_primary || status=1
+stop_mock
+
+LD_PRELOAD=$PRELOAD ./bench_micro --iterations-scale "$SCALE" || status=1
+exit $status
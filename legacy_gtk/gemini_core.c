@@ -0,0 +1,2956 @@
+/* Request engine shared by the GTK app and the headless batch mode: transport and
+ * network worker, credential storage, conversation log, context, response cache and
+ * JSON helpers. Nothing here touches GTK. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/keyctl.h>
+
+#include <glib-unix.h>
+#include <sodium.h>
+
+#include "gemini_core.h"
+
+static const char *MAGIC = "GEMINIENC1";
+
+gchar *get_api_key_enc_path(void) {
+    const gchar *config_dir = g_get_user_config_dir();
+    return g_build_filename(config_dir, "gemini-gtk", "api_key.enc", NULL);
+}
+
+gchar *get_api_key_plain_path(void) {
+    const gchar *config_dir = g_get_user_config_dir();
+    return g_build_filename(config_dir, "gemini-gtk", "api_key.txt", NULL);
+}
+
+/* Curl response. The buffer grows geometrically so large bodies are copied O(n)
+ * times in total rather than once per chunk. */
+#define RESPONSE_INITIAL_CAP 4096
+#define RESPONSE_PRESIZE_MAX (16 * 1024 * 1024)
+
+static gboolean curl_response_reserve(struct CurlResponse *r, size_t extra) {
+    if (extra > G_MAXSIZE - r->len - 1) return FALSE;
+    size_t need = r->len + extra + 1;
+    if (need <= r->cap) return TRUE;
+    size_t cap = r->cap ? r->cap : RESPONSE_INITIAL_CAP;
+    while (cap < need) cap = cap > G_MAXSIZE / 2 ? need : cap * 2;
+    char *newp = realloc(r->data, cap);
+    if (!newp) return FALSE;
+    r->data = newp;
+    r->cap = cap;
+    return TRUE;
+}
+
+size_t curl_write_cb(void *ptr, size_t size, size_t nmemb, void *userp) {
+    size_t realsize = size * nmemb;
+    struct CurlResponse *r = (struct CurlResponse*)userp;
+    if (!curl_response_reserve(r, realsize)) return 0;
+    memcpy(&(r->data[r->len]), ptr, realsize);
+    r->len += realsize;
+    r->data[r->len] = '\0';
+    return realsize;
+}
+
+/* Buffers are recycled across requests on the network worker; anything that grew
+ * past RESPONSE_ARENA_MAX_CAP is released instead of being pinned. */
+#define RESPONSE_ARENA_SLOTS 8
+#define RESPONSE_ARENA_MAX_CAP (1024 * 1024)
+
+typedef struct {
+    struct CurlResponse slots[RESPONSE_ARENA_SLOTS];
+    guint n;
+} ResponseArena;
+
+static void response_arena_take(ResponseArena *a, struct CurlResponse *r) {
+    if (a->n > 0) {
+        *r = a->slots[--a->n];
+    } else {
+        memset(r, 0, sizeof(*r));
+    }
+    r->len = 0;
+    if (r->data) r->data[0] = '\0';
+}
+
+static void response_arena_give(ResponseArena *a, struct CurlResponse *r) {
+    if (r->data && r->cap <= RESPONSE_ARENA_MAX_CAP && a->n < RESPONSE_ARENA_SLOTS) {
+        a->slots[a->n++] = *r;
+    } else {
+        free(r->data);
+    }
+    memset(r, 0, sizeof(*r));
+}
+
+static void response_arena_clear(ResponseArena *a) {
+    while (a->n > 0) free(a->slots[--a->n].data);
+}
+
+/* Incremental JSON stream. One persistent json_tokener is fed bytes as they arrive and
+ * on_object runs for every complete top-level value. In SSE mode only the payload of
+ * "data:" lines is fed to the tokener; other fields and blank lines are skipped. */
+enum { SSE_LINE_START, SSE_FIELD, SSE_DATA_SPACE, SSE_DATA, SSE_SKIP };
+
+void json_stream_init(JsonStream *js, gboolean sse, JsonStreamFn on_object, gpointer user_data) {
+    memset(js, 0, sizeof(*js));
+    js->tok = json_tokener_new();
+    js->sse = sse;
+    js->state = SSE_LINE_START;
+    js->on_object = on_object;
+    js->user_data = user_data;
+}
+
+void json_stream_clear(JsonStream *js) {
+    if (js->tok) json_tokener_free(js->tok);
+    js->tok = NULL;
+}
+
+static void json_stream_feed_json(JsonStream *js, const char *p, size_t n) {
+    while (n > 0) {
+        json_object *obj = json_tokener_parse_ex(js->tok, p, (int)n);
+        if (!obj) {
+            /* Either the value continues in the next chunk, or it is malformed and we
+             * drop the rest of this run and start over. */
+            if (json_tokener_get_error(js->tok) != json_tokener_continue) json_tokener_reset(js->tok);
+            return;
+        }
+        size_t used = json_tokener_get_parse_end(js->tok);
+        json_tokener_reset(js->tok);
+        js->on_object(obj, js->user_data);
+        json_object_put(obj);
+        if (used == 0 || used > n) return;
+        p += used;
+        n -= used;
+    }
+}
+
+void json_stream_feed(JsonStream *js, const char *data, size_t len) {
+    if (!js->sse) {
+        json_stream_feed_json(js, data, len);
+        return;
+    }
+    size_t i = 0;
+    while (i < len) {
+        char c = data[i];
+        switch (js->state) {
+        case SSE_LINE_START:
+            if (c == '\n' || c == '\r') { i++; break; }
+            js->field_len = 0;
+            js->state = SSE_FIELD;
+            break;
+        case SSE_FIELD:
+            if (c == ':') {
+                js->state = (js->field_len == 4 && memcmp(js->field, "data", 4) == 0) ? SSE_DATA_SPACE : SSE_SKIP;
+            } else if (c == '\n') {
+                js->state = SSE_LINE_START;
+            } else {
+                if (js->field_len < sizeof(js->field)) js->field[js->field_len] = c;
+                js->field_len++;
+            }
+            i++;
+            break;
+        case SSE_DATA_SPACE:
+            if (c == ' ') i++;
+            js->state = SSE_DATA;
+            break;
+        case SSE_DATA:
+        case SSE_SKIP: {
+            const char *nl = memchr(data + i, '\n', len - i);
+            size_t run = nl ? (size_t)(nl - (data + i)) : len - i;
+            if (js->state == SSE_DATA) json_stream_feed_json(js, data + i, run);
+            i += run;
+            if (nl) {
+                js->state = SSE_LINE_START;
+                i++;
+            }
+            break;
+        }
+        }
+    }
+}
+
+/* Request serializer. Request bodies have a fixed shape, so they are written straight
+ * into a caller-owned, reused GString instead of going through a json-c tree. Strings
+ * are scanned eight bytes at a time and copied in runs; only bytes that JSON requires
+ * to be escaped ('"', '\\' and controls) take the slow path. UTF-8 passes through. */
+static const char json_hex[] = "0123456789abcdef";
+
+static gboolean json_word_is_plain(guint64 w) {
+    const guint64 ones = 0x0101010101010101ULL, highs = 0x8080808080808080ULL;
+    guint64 quote = w ^ (ones * '"');
+    guint64 bslash = w ^ (ones * '\\');
+    guint64 special = ((w - ones * 0x20) & ~w) | ((quote - ones) & ~quote) | ((bslash - ones) & ~bslash);
+    return (special & highs) == 0;
+}
+
+void json_append_string(GString *out, const char *s, gsize len) {
+    g_string_append_c(out, '"');
+    gsize run = 0; /* start of the pending unescaped run */
+    gsize i = 0;
+    while (i < len) {
+        if (i + 8 <= len) {
+            guint64 w;
+            memcpy(&w, s + i, sizeof(w));
+            if (json_word_is_plain(w)) {
+                i += 8;
+                continue;
+            }
+        }
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            i++;
+            continue;
+        }
+        g_string_append_len(out, s + run, (gssize)(i - run));
+        switch (c) {
+        case '"': g_string_append_len(out, "\\\"", 2); break;
+        case '\\': g_string_append_len(out, "\\\\", 2); break;
+        case '\n': g_string_append_len(out, "\\n", 2); break;
+        case '\r': g_string_append_len(out, "\\r", 2); break;
+        case '\t': g_string_append_len(out, "\\t", 2); break;
+        case '\b': g_string_append_len(out, "\\b", 2); break;
+        case '\f': g_string_append_len(out, "\\f", 2); break;
+        default: {
+            char esc[6] = { '\\', 'u', '0', '0', json_hex[c >> 4], json_hex[c & 0xf] };
+            g_string_append_len(out, esc, sizeof(esc));
+        }
+        }
+        run = ++i;
+    }
+    g_string_append_len(out, s + run, (gssize)(len - run));
+    g_string_append_c(out, '"');
+}
+
+/* Appends a locale-independent JSON number. */
+void json_append_double(GString *out, double v) {
+    char buf[G_ASCII_DTOSTR_BUF_SIZE];
+    g_string_append(out, g_ascii_formatd(buf, sizeof(buf), "%.15g", v));
+}
+
+/* Reply extractor. Scans a generate/generateContent response in place and stops as
+ * soon as it has the first candidate's text, so safety ratings, usage metadata and the
+ * like are skipped without being parsed into objects. The only allocation is the
+ * returned text. Understands candidates[0] as a string, candidates[0].output/.text,
+ * candidates[0].content as a string or as {parts:[{text}]}, and top-level
+ * output/response as fallbacks. Returns NULL if no text was found. */
+typedef struct { const char *p; const char *end; } JsonScan;
+
+#define JSON_KEY_IS(k, n, lit) ((n) == sizeof(lit) - 1 && memcmp((k), (lit), (n)) == 0)
+
+static void json_scan_ws(JsonScan *s) {
+    while (s->p < s->end && (*s->p == ' ' || *s->p == '\t' || *s->p == '\n' || *s->p == '\r')) s->p++;
+}
+
+static gboolean json_scan_peek(JsonScan *s, char c) {
+    json_scan_ws(s);
+    return s->p < s->end && *s->p == c;
+}
+
+static gboolean json_scan_enter(JsonScan *s, char open) {
+    if (!json_scan_peek(s, open)) return FALSE;
+    s->p++;
+    return TRUE;
+}
+
+static gboolean json_scan_skip_string(JsonScan *s) {
+    const char *p = s->p + 1;
+    for (;;) {
+        const char *q = memchr(p, '"', (size_t)(s->end - p));
+        if (!q) return FALSE;
+        const char *b = q;
+        while (b > p && b[-1] == '\\') b--;
+        if (((q - b) & 1) == 0) {
+            s->p = q + 1;
+            return TRUE;
+        }
+        p = q + 1;
+    }
+}
+
+static gboolean json_scan_skip_value(JsonScan *s) {
+    json_scan_ws(s);
+    if (s->p >= s->end) return FALSE;
+    char c = *s->p;
+    if (c == '"') return json_scan_skip_string(s);
+    if (c == '{' || c == '[') {
+        int depth = 0;
+        while (s->p < s->end) {
+            c = *s->p;
+            if (c == '"') {
+                if (!json_scan_skip_string(s)) return FALSE;
+                continue;
+            }
+            if (c == '{' || c == '[') {
+                depth++;
+            } else if ((c == '}' || c == ']') && --depth == 0) {
+                s->p++;
+                return TRUE;
+            }
+            s->p++;
+        }
+        return FALSE;
+    }
+    while (s->p < s->end && *s->p != ',' && *s->p != '}' && *s->p != ']' &&
+           *s->p != ' ' && *s->p != '\t' && *s->p != '\n' && *s->p != '\r') s->p++;
+    return TRUE;
+}
+
+/* Next key of the current object, leaving the cursor on its value. Returns FALSE (having
+ * consumed the closing brace) at the end of the object, or on malformed input. */
+static gboolean json_scan_next_key(JsonScan *s, const char **key, gsize *klen) {
+    json_scan_ws(s);
+    if (s->p < s->end && *s->p == ',') {
+        s->p++;
+        json_scan_ws(s);
+    }
+    if (s->p >= s->end || *s->p != '"') {
+        if (s->p < s->end && *s->p == '}') s->p++;
+        return FALSE;
+    }
+    const char *start = s->p + 1;
+    if (!json_scan_skip_string(s)) return FALSE;
+    *key = start;
+    *klen = (gsize)(s->p - 1 - start);
+    return json_scan_enter(s, ':');
+}
+
+/* Advance to the next array element; FALSE (closing bracket consumed) at the end. */
+static gboolean json_scan_next_elem(JsonScan *s) {
+    json_scan_ws(s);
+    if (s->p < s->end && *s->p == ',') {
+        s->p++;
+        json_scan_ws(s);
+    }
+    if (s->p >= s->end || *s->p == ']') {
+        if (s->p < s->end) s->p++;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static int json_scan_hex4(const char *p, const char *end) {
+    if (end - p < 4) return -1;
+    int v = 0;
+    for (int i = 0; i < 4; i++) {
+        int d = g_ascii_xdigit_value(p[i]);
+        if (d < 0) return -1;
+        v = (v << 4) | d;
+    }
+    return v;
+}
+
+/* Decode the string at the cursor into out. */
+static gboolean json_scan_read_string(JsonScan *s, GString *out) {
+    if (!json_scan_enter(s, '"')) return FALSE;
+    const char *p = s->p;
+    while (p < s->end) {
+        const char *run = p;
+        while (p < s->end && *p != '"' && *p != '\\') p++;
+        g_string_append_len(out, run, (gssize)(p - run));
+        if (p >= s->end) return FALSE;
+        if (*p == '"') {
+            s->p = p + 1;
+            return TRUE;
+        }
+        if (++p >= s->end) return FALSE;
+        char e = *p++;
+        switch (e) {
+        case '"': case '\\': case '/': g_string_append_c(out, e); break;
+        case 'b': g_string_append_c(out, '\b'); break;
+        case 'f': g_string_append_c(out, '\f'); break;
+        case 'n': g_string_append_c(out, '\n'); break;
+        case 'r': g_string_append_c(out, '\r'); break;
+        case 't': g_string_append_c(out, '\t'); break;
+        case 'u': {
+            int cp = json_scan_hex4(p, s->end);
+            if (cp < 0) return FALSE;
+            p += 4;
+            if (cp >= 0xD800 && cp <= 0xDBFF && s->end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                int lo = json_scan_hex4(p + 2, s->end);
+                if (lo >= 0xDC00 && lo <= 0xDFFF) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    p += 6;
+                }
+            }
+            if (cp >= 0xD800 && cp <= 0xDFFF) cp = 0xFFFD; /* unpaired surrogate */
+            char utf8[6];
+            g_string_append_len(out, utf8, g_unichar_to_utf8((gunichar)cp, utf8));
+            break;
+        }
+        default:
+            return FALSE;
+        }
+    }
+    return FALSE;
+}
+
+/* Text of the first candidate, read from a private copy of the cursor. */
+static gboolean json_scan_first_candidate(JsonScan c, GString *out) {
+    if (!json_scan_enter(&c, '[')) return FALSE;
+    if (json_scan_peek(&c, '"')) return json_scan_read_string(&c, out);
+    if (!json_scan_enter(&c, '{')) return FALSE;
+    const char *key;
+    gsize klen;
+    while (json_scan_next_key(&c, &key, &klen)) {
+        if (JSON_KEY_IS(key, klen, "content") && json_scan_peek(&c, '{')) {
+            JsonScan content = c;
+            json_scan_enter(&content, '{');
+            while (json_scan_next_key(&content, &key, &klen)) {
+                if (!JSON_KEY_IS(key, klen, "parts") || !json_scan_enter(&content, '[')) {
+                    if (!json_scan_skip_value(&content)) break;
+                    continue;
+                }
+                while (json_scan_next_elem(&content)) {
+                    if (!json_scan_enter(&content, '{')) {
+                        if (!json_scan_skip_value(&content)) break;
+                        continue;
+                    }
+                    while (json_scan_next_key(&content, &key, &klen)) {
+                        if (JSON_KEY_IS(key, klen, "text") && json_scan_peek(&content, '"')) {
+                            if (!json_scan_read_string(&content, out)) return out->len > 0;
+                        } else if (!json_scan_skip_value(&content)) {
+                            return out->len > 0;
+                        }
+                    }
+                }
+                return out->len > 0;
+            }
+            if (!json_scan_skip_value(&c)) return FALSE;
+        } else if ((JSON_KEY_IS(key, klen, "content") || JSON_KEY_IS(key, klen, "output") ||
+                    JSON_KEY_IS(key, klen, "text")) && json_scan_peek(&c, '"')) {
+            return json_scan_read_string(&c, out);
+        } else if (!json_scan_skip_value(&c)) {
+            return FALSE;
+        }
+    }
+    return FALSE;
+}
+
+gchar *extract_reply_text(const char *data, gsize len) {
+    JsonScan s = { data, data + len };
+    JsonScan output = { NULL, NULL }, response = { NULL, NULL };
+    const char *key;
+    gsize klen;
+    if (!json_scan_enter(&s, '{')) return NULL;
+    GString *out = g_string_new(NULL);
+    while (json_scan_next_key(&s, &key, &klen)) {
+        if (JSON_KEY_IS(key, klen, "candidates") && json_scan_first_candidate(s, out)) {
+            return g_string_free(out, FALSE);
+        }
+        g_string_truncate(out, 0);
+        if (JSON_KEY_IS(key, klen, "output") && !output.p && json_scan_peek(&s, '"')) output = s;
+        if (JSON_KEY_IS(key, klen, "response") && !response.p && json_scan_peek(&s, '"')) response = s;
+        if (!json_scan_skip_value(&s)) break;
+    }
+    if ((output.p && json_scan_read_string(&output, out)) ||
+        (response.p && json_scan_read_string(&response, out))) {
+        return g_string_free(out, FALSE);
+    }
+    g_string_free(out, TRUE);
+    return NULL;
+}
+
+/* Shared transport. A single CURLSH holds the DNS cache, TLS sessions and the
+ * connection cache, and idle easy handles are kept around so back-to-back requests
+ * reuse a warm (HTTP/2, keep-alive) connection instead of a fresh handshake. */
+#define TRANSPORT_MAX_IDLE_HANDLES 4
+
+typedef struct {
+    CURLSH *share;
+    GMutex share_locks[CURL_LOCK_DATA_LAST];
+    GMutex pool_lock;
+    GQueue idle; /* CURL* */
+} Transport;
+static Transport transport;
+
+static void transport_share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userp) {
+    g_mutex_lock(&transport.share_locks[data]);
+}
+
+static void transport_share_unlock(CURL *handle, curl_lock_data data, void *userp) {
+    g_mutex_unlock(&transport.share_locks[data]);
+}
+
+void transport_init(void) {
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) g_mutex_init(&transport.share_locks[i]);
+    g_mutex_init(&transport.pool_lock);
+    g_queue_init(&transport.idle);
+    transport.share = curl_share_init();
+    if (!transport.share) return;
+    curl_share_setopt(transport.share, CURLSHOPT_LOCKFUNC, transport_share_lock);
+    curl_share_setopt(transport.share, CURLSHOPT_UNLOCKFUNC, transport_share_unlock);
+    curl_share_setopt(transport.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(transport.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(transport.share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+}
+
+static void transport_apply_defaults(CURL *curl) {
+    if (transport.share) curl_easy_setopt(curl, CURLOPT_SHARE, transport.share);
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, 60L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, 30L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+}
+
+/* Lease an easy handle attached to the shared caches. Return it with transport_release. */
+static CURL *transport_lease(void) {
+    g_mutex_lock(&transport.pool_lock);
+    CURL *curl = g_queue_pop_head(&transport.idle);
+    g_mutex_unlock(&transport.pool_lock);
+    if (!curl) curl = curl_easy_init();
+    if (curl) transport_apply_defaults(curl);
+    return curl;
+}
+
+static void transport_release(CURL *curl) {
+    if (!curl) return;
+    curl_easy_reset(curl);
+    g_mutex_lock(&transport.pool_lock);
+    if (g_queue_get_length(&transport.idle) < TRANSPORT_MAX_IDLE_HANDLES) {
+        g_queue_push_head(&transport.idle, curl);
+        curl = NULL;
+    }
+    g_mutex_unlock(&transport.pool_lock);
+    if (curl) curl_easy_cleanup(curl);
+}
+
+void transport_cleanup(void) {
+    CURL *curl;
+    while ((curl = g_queue_pop_head(&transport.idle)) != NULL) curl_easy_cleanup(curl);
+    if (transport.share) curl_share_cleanup(transport.share);
+    transport.share = NULL;
+}
+
+/* Time to first byte in ms, and whether the request rode an existing connection. */
+double transport_ttfb_ms(CURL *curl, gboolean *reused) {
+    curl_off_t ttfb = 0;
+    long new_conns = 0;
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &new_conns);
+    if (reused) *reused = new_conns == 0;
+    return ttfb / 1000.0;
+}
+
+/* Latency statistics. Each phase keeps its last STATS_WINDOW samples in a ring, so
+ * percentiles track recent behaviour; they are computed on demand by sorting a copy. */
+#define STATS_WINDOW 1024
+
+typedef struct { float samples[STATS_WINDOW]; guint next; guint64 count; } StatRing;
+
+static struct { GMutex lock; StatRing rings[STAT_PHASES]; guint64 counters[STAT_COUNTERS]; } stats;
+
+static const char *stat_phase_names[STAT_PHASES] = {
+    "key", "payload", "queue", "dns", "connect", "tls", "ttfb", "total", "parse", "ui_insert", "first_paint"
+};
+
+static const char *stat_counter_names[STAT_COUNTERS] = { "flights", "coalesced", "hedges", "hedge_wins", "failovers" };
+
+const char *stats_phase_name(StatPhase phase) {
+    return stat_phase_names[phase];
+}
+
+const char *stats_counter_name(StatCounter counter) {
+    return stat_counter_names[counter];
+}
+
+void stats_count(StatCounter counter) {
+    g_mutex_lock(&stats.lock);
+    stats.counters[counter]++;
+    g_mutex_unlock(&stats.lock);
+}
+
+guint64 stats_counter(StatCounter counter) {
+    g_mutex_lock(&stats.lock);
+    guint64 n = stats.counters[counter];
+    g_mutex_unlock(&stats.lock);
+    return n;
+}
+
+void stats_record(StatPhase phase, double ms) {
+    g_mutex_lock(&stats.lock);
+    StatRing *r = &stats.rings[phase];
+    r->samples[r->next] = (float)ms;
+    r->next = (r->next + 1) % STATS_WINDOW;
+    r->count++;
+    g_mutex_unlock(&stats.lock);
+}
+
+/* Network phases of a completed transfer. curl's times are cumulative from the start;
+ * DNS, connect and TLS are only meaningful when a new connection was opened. */
+static void stats_record_transfer(CURL *curl) {
+    curl_off_t dns = 0, connect = 0, tls = 0, ttfb = 0, total = 0;
+    long connects = 0;
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+    if (connects > 0) {
+        stats_record(STAT_DNS, dns / 1000.0);
+        stats_record(STAT_CONNECT, (connect - dns) / 1000.0);
+        if (tls > 0) stats_record(STAT_TLS, (tls - connect) / 1000.0);
+    }
+    stats_record(STAT_TTFB, ttfb / 1000.0);
+    stats_record(STAT_TOTAL, total / 1000.0);
+}
+
+static int stats_float_cmp(const void *a, const void *b) {
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+void stats_summary(StatPhase phase, StatSummary *out) {
+    float sorted[STATS_WINDOW];
+    g_mutex_lock(&stats.lock);
+    StatRing *r = &stats.rings[phase];
+    guint n = (guint)MIN(r->count, (guint64)STATS_WINDOW);
+    memcpy(sorted, r->samples, n * sizeof(float));
+    out->count = r->count;
+    g_mutex_unlock(&stats.lock);
+
+    out->p50 = out->p95 = out->p99 = out->max = 0.0;
+    if (n == 0) return;
+    qsort(sorted, n, sizeof(float), stats_float_cmp);
+    /* Nearest rank. */
+    out->p50 = sorted[(n * 50 + 99) / 100 - 1];
+    out->p95 = sorted[(n * 95 + 99) / 100 - 1];
+    out->p99 = sorted[(n * 99 + 99) / 100 - 1];
+    out->max = sorted[n - 1];
+}
+
+/* One JSON object: {"phase":{"count":n,"p50":ms,"p95":ms,"p99":ms,"max":ms},...,
+ * "counters":{"name":n,...}} */
+void stats_dump_json(GString *out) {
+    g_string_append_c(out, '{');
+    for (int i = 0; i < STAT_PHASES; i++) {
+        StatSummary sum;
+        stats_summary((StatPhase)i, &sum);
+        g_string_append_printf(out, "%s\"%s\":{\"count\":%" G_GUINT64_FORMAT ",\"p50\":", i ? "," : "", stat_phase_names[i], sum.count);
+        json_append_double(out, sum.p50);
+        g_string_append(out, ",\"p95\":");
+        json_append_double(out, sum.p95);
+        g_string_append(out, ",\"p99\":");
+        json_append_double(out, sum.p99);
+        g_string_append(out, ",\"max\":");
+        json_append_double(out, sum.max);
+        g_string_append_c(out, '}');
+    }
+    g_string_append(out, ",\"counters\":{");
+    for (int i = 0; i < STAT_COUNTERS; i++) {
+        g_string_append_printf(out, "%s\"%s\":%" G_GUINT64_FORMAT, i ? "," : "", stat_counter_names[i], stats_counter((StatCounter)i));
+    }
+    g_string_append(out, "}}");
+}
+
+/* Network worker. One thread runs its own GMainContext; curl_multi sockets and
+ * timeouts are attached to it as GSources, so every in-flight request is multiplexed
+ * on that thread instead of getting an OS thread each. Completions are handed back
+ * in submission order.
+ *
+ * Admission is rate limited. Submitted requests wait in a priority queue until the
+ * request and token buckets (GEMINI_RATE_RPM / GEMINI_RATE_TPM per minute, unlimited
+ * when unset) can pay for them and the AIMD concurrency window has room. The window
+ * grows by 1/window per success up to GEMINI_MAX_CONCURRENCY, halves on 429/503 and
+ * honours Retry-After. Retryable requests are resent after 429/5xx or a failed
+ * transfer that received nothing, with full-jitter exponential backoff.
+ *
+ * Single flight: the first request with a given flight key leads; identical ones
+ * submitted before it finishes attach to it instead of being queued. The leader's write
+ * callback fans every chunk out to them (a late follower first gets the bytes seen so
+ * far) and its result is copied to them on completion. Cancelling a leader by id hands
+ * its live transfer to the first follower, so the others are not disturbed.
+ *
+ * Deadlines and endpoints. A request must see its first response byte within
+ * GEMINI_TIMEOUT_MS (default 120 s) of submission, queueing and retries included, and
+ * after that may not go that long without another byte: every accepted chunk moves the
+ * deadline forward and the transfer's progress callback aborts it once the deadline
+ * passes. A stream that keeps producing is never cut off, however long it runs, and
+ * callers that expect a slow first byte (a model still loading) pass a longer
+ * timeout_ms. GEMINI_ENDPOINT may list several interchangeable endpoints in
+ * order of preference (separated by commas or whitespace); requests are built for the
+ * first, and a failover request is moved to another by swapping the URL up to the
+ * method (":generateContent") and keeping the rest. Each endpoint keeps a health score
+ * (EWMA of outcomes) and the first-byte times of its recent successes; two failures in
+ * a row take it out of rotation for a cooldown that doubles while it keeps failing.
+ * Transfers go to the first endpoint in rotation, retries prefer a different one and
+ * skip the backoff when they get it. When the first response byte is later than the
+ * endpoint's p95, a duplicate is sent to the next endpoint in rotation (GEMINI_HEDGE=0
+ * turns this off): the first to deliver a 2xx byte wins and the other is aborted; if
+ * one fails before that, the other carries on alone. */
+#define NET_DEFAULT_MAX_CONCURRENCY 8
+#define NET_DEFAULT_MAX_RETRIES 4
+#define NET_BACKOFF_BASE_MS 500
+#define NET_BACKOFF_MAX_MS 30000
+#define NET_DEFAULT_TIMEOUT_MS 120000
+#define NET_CONNECT_TIMEOUT_MS 10000
+#define NET_ENDPOINT_WINDOW 128
+#define NET_ENDPOINT_TRIP 2          /* consecutive failures before a cooldown */
+#define NET_ENDPOINT_COOLDOWN_MS 1000
+#define NET_ENDPOINT_COOLDOWN_MAX_MS 30000
+#define NET_HEDGE_MIN_SAMPLES 20     /* below this the p95 is not trusted */
+#define NET_HEDGE_COLD_MS 1000       /* hedge delay until then */
+#define NET_HEDGE_MIN_MS 10
+
+enum { NET_REQ_QUEUED, NET_REQ_ACTIVE, NET_REQ_BACKOFF, NET_REQ_ATTACHED, NET_REQ_DONE };
+
+/* Race between req->curl and req->hedge: open until one delivers a 2xx byte. */
+enum { NET_RACE_NONE, NET_RACE_OPEN, NET_RACE_PRIMARY, NET_RACE_HEDGE };
+
+typedef struct {
+    double rpm, tpm;         /* budgets per minute, 0 = unlimited */
+    double req_level;        /* bucket levels */
+    double tok_level;
+    gint64 refilled;         /* monotonic us */
+    double window;           /* AIMD concurrency window */
+    double max_window;
+    guint active;
+    guint max_retries;
+    gint64 hold_until;       /* Retry-After: nothing starts before this */
+    gint64 last_decrease;
+    GQueue pending;          /* NetRequest*, by priority then id */
+    GSource *wake;
+} NetLimiter;
+
+typedef struct {
+    gchar *stem;             /* URL without the query and the :method suffix */
+    float ttfb[NET_ENDPOINT_WINDOW]; /* first-byte ms of recent successes */
+    guint next;
+    guint64 samples;
+    double p95_ms;
+    double health;           /* EWMA of outcomes, 1 = all recent transfers succeeded */
+    guint failures;          /* in a row */
+    gint64 down_until;       /* out of rotation until then */
+    guint64 sent, ok, failed, hedges, wins;
+} NetEndpoint;
+
+typedef struct {
+    GThread *thread;
+    GMainContext *context;
+    GMainLoop *loop;
+    CURLM *multi;
+    GSource *timer;
+    GQueue order; /* NetRequest*, in submission order */
+    gint next_id;
+    ResponseArena arena;
+    NetLimiter limiter;
+    GHashTable *flights; /* flight key -> leading NetRequest */
+    GMutex endpoint_lock; /* endpoints are read by net_endpoints_dump_json */
+    NetEndpoint *endpoints;
+    guint n_endpoints;
+    gint64 timeout_ms;
+    gboolean hedging;
+    GQueue settled;      /* NetRequest* whose race was decided inside a curl callback */
+} NetWorker;
+static NetWorker net_worker;
+
+/* How long req may wait for its first byte, and then between bytes. */
+static gint64 net_request_timeout_us(const NetRequest *req) {
+    return (req->timeout_ms > 0 ? req->timeout_ms : net_worker.timeout_ms) * 1000;
+}
+
+static void net_worker_check_multi_info(void);
+static guint response_cache_hash(gconstpointer key);
+static gboolean response_cache_equal(gconstpointer a, gconstpointer b);
+
+static void net_worker_invoke(GSourceFunc func, gpointer data) {
+    GSource *src = g_idle_source_new();
+    g_source_set_priority(src, G_PRIORITY_DEFAULT);
+    g_source_set_callback(src, func, data, NULL);
+    g_source_attach(src, net_worker.context);
+    g_source_unref(src);
+}
+
+static gboolean net_worker_socket_ready(gint fd, GIOCondition cond, gpointer data) {
+    int ev = 0;
+    if (cond & G_IO_IN) ev |= CURL_CSELECT_IN;
+    if (cond & G_IO_OUT) ev |= CURL_CSELECT_OUT;
+    if (cond & (G_IO_ERR | G_IO_HUP)) ev |= CURL_CSELECT_ERR;
+    int running = 0;
+    curl_multi_socket_action(net_worker.multi, fd, ev, &running);
+    net_worker_check_multi_info();
+    return G_SOURCE_CONTINUE;
+}
+
+static int net_worker_socket_cb(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp) {
+    GSource *src = (GSource*)socketp;
+    if (src) {
+        g_source_destroy(src);
+        g_source_unref(src);
+        src = NULL;
+    }
+    if (what != CURL_POLL_REMOVE) {
+        GIOCondition cond = 0;
+        if (what & CURL_POLL_IN) cond |= G_IO_IN;
+        if (what & CURL_POLL_OUT) cond |= G_IO_OUT;
+        src = g_unix_fd_source_new(s, cond);
+        g_source_set_callback(src, (GSourceFunc)(void (*)(void))net_worker_socket_ready, NULL, NULL);
+        g_source_attach(src, net_worker.context);
+    }
+    curl_multi_assign(net_worker.multi, s, src);
+    return 0;
+}
+
+static gboolean net_worker_timeout(gpointer data) {
+    g_source_unref(net_worker.timer);
+    net_worker.timer = NULL;
+    int running = 0;
+    curl_multi_socket_action(net_worker.multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    net_worker_check_multi_info();
+    return G_SOURCE_REMOVE;
+}
+
+static int net_worker_timer_cb(CURLM *multi, long timeout_ms, void *userp) {
+    if (net_worker.timer) {
+        g_source_destroy(net_worker.timer);
+        g_source_unref(net_worker.timer);
+        net_worker.timer = NULL;
+    }
+    if (timeout_ms >= 0) {
+        net_worker.timer = g_timeout_source_new((guint)timeout_ms);
+        g_source_set_callback(net_worker.timer, net_worker_timeout, NULL, NULL);
+        g_source_attach(net_worker.timer, net_worker.context);
+    }
+    return 0;
+}
+
+/* Drop req's role as a flight leader; followers still attached are left on their own. */
+static void net_flight_forget(NetRequest *req) {
+    if (!req->followers) return;
+    if (g_hash_table_lookup(net_worker.flights, req->flight_key) == req) {
+        g_hash_table_remove(net_worker.flights, req->flight_key);
+    }
+    for (guint i = 0; i < req->followers->len; i++) ((NetRequest*)g_ptr_array_index(req->followers, i))->leader = NULL;
+    g_ptr_array_free(req->followers, TRUE);
+    req->followers = NULL;
+    if (req->flight_data) g_string_free(req->flight_data, TRUE);
+    req->flight_data = NULL;
+}
+
+static void net_request_free(NetRequest *req) {
+    net_flight_forget(req);
+    if (req->destroy) req->destroy(req->user_data);
+    response_arena_give(&net_worker.arena, &req->resp);
+    curl_slist_free_all(req->headers);
+    transport_release(req->curl);
+    g_free(req->url);
+    g_free(req);
+}
+
+/* Deliver finished requests from the head of the queue so callers see results in the
+ * order they submitted them, even when a later request completes first. */
+static void net_worker_deliver(void) {
+    NetRequest *req;
+    while ((req = g_queue_peek_head(&net_worker.order)) != NULL && req->finished) {
+        g_queue_pop_head(&net_worker.order);
+        if (req->on_done) req->on_done(req);
+        net_request_free(req);
+    }
+}
+
+static void net_limiter_init(NetLimiter *l) {
+    const char *rpm = getenv("GEMINI_RATE_RPM");
+    const char *tpm = getenv("GEMINI_RATE_TPM");
+    const char *conc = getenv("GEMINI_MAX_CONCURRENCY");
+    const char *retries = getenv("GEMINI_MAX_RETRIES");
+    l->rpm = rpm && *rpm ? MAX(g_ascii_strtod(rpm, NULL), 0.0) : 0.0;
+    l->tpm = tpm && *tpm ? MAX(g_ascii_strtod(tpm, NULL), 0.0) : 0.0;
+    l->req_level = l->rpm;
+    l->tok_level = l->tpm;
+    l->refilled = g_get_monotonic_time();
+    l->max_window = conc && *conc ? CLAMP(g_ascii_strtod(conc, NULL), 1.0, 256.0) : NET_DEFAULT_MAX_CONCURRENCY;
+    l->window = l->max_window;
+    l->max_retries = retries && *retries ? (guint)CLAMP(g_ascii_strtoll(retries, NULL, 10), 0, 16) : NET_DEFAULT_MAX_RETRIES;
+    g_queue_init(&l->pending);
+}
+
+static void net_limiter_refill(NetLimiter *l, gint64 now) {
+    double minutes = (now - l->refilled) / (60.0 * G_USEC_PER_SEC);
+    l->refilled = now;
+    l->req_level = MIN(l->rpm, l->req_level + l->rpm * minutes);
+    l->tok_level = MIN(l->tpm, l->tok_level + l->tpm * minutes);
+}
+
+/* Microseconds until the buckets can pay for req, 0 if they can now. */
+static gint64 net_limiter_wait(NetLimiter *l, const NetRequest *req) {
+    double wait_min = 0.0;
+    if (l->rpm > 0 && l->req_level < 1.0) wait_min = MAX(wait_min, (1.0 - l->req_level) / l->rpm);
+    /* A request bigger than the whole budget only waits for a full bucket. */
+    double cost = MIN((double)req->tokens, l->tpm);
+    if (l->tpm > 0 && l->tok_level < cost) wait_min = MAX(wait_min, (cost - l->tok_level) / l->tpm);
+    return (gint64)(wait_min * 60.0 * G_USEC_PER_SEC);
+}
+
+static gint net_request_priority_cmp(gconstpointer a, gconstpointer b, gpointer data) {
+    const NetRequest *x = a, *y = b;
+    if (x->priority != y->priority) return y->priority - x->priority;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+gchar **net_endpoint_list(void) {
+    const char *env = getenv("GEMINI_ENDPOINT");
+    gchar **parts = g_strsplit_set(env ? env : "", ", \t\r\n", -1);
+    GPtrArray *out = g_ptr_array_new();
+    for (int i = 0; parts[i]; i++) {
+        if (*parts[i]) g_ptr_array_add(out, g_strdup(parts[i]));
+    }
+    g_strfreev(parts);
+    g_ptr_array_add(out, NULL);
+    return (gchar**)g_ptr_array_free(out, FALSE);
+}
+
+/* The URL up to the query and, in the last path segment, up to the ":method". */
+static gchar *net_endpoint_stem(const char *url) {
+    gsize len = strcspn(url, "?#");
+    const char *start = strstr(url, "://");
+    start = start && start < url + len ? start + 3 : url;
+    const char *slash = NULL;
+    for (const char *p = start; p < url + len; p++) {
+        if (*p == '/') slash = p;
+    }
+    const char *colon = slash ? memchr(slash, ':', (gsize)(url + len - slash)) : NULL;
+    return g_strndup(url, colon ? (gsize)(colon - url) : len);
+}
+
+/* Endpoint a URL was built for (longest matching stem), or -1. */
+static int net_endpoint_match(const char *url) {
+    int best = -1;
+    gsize best_len = 0;
+    for (guint i = 0; i < net_worker.n_endpoints; i++) {
+        const char *stem = net_worker.endpoints[i].stem;
+        gsize len = strlen(stem);
+        if (len > best_len && strncmp(url, stem, len) == 0 && strchr(":?#/", url[len])) {
+            best = (int)i;
+            best_len = len;
+        }
+    }
+    return best;
+}
+
+static gchar *net_endpoint_url(const char *url, int from, int to) {
+    return g_strconcat(net_worker.endpoints[to].stem, url + strlen(net_worker.endpoints[from].stem), NULL);
+}
+
+/* First endpoint in rotation other than skip; with any, the one back soonest when none
+ * is. -1 if there is no candidate. Called with endpoint_lock held. */
+static int net_endpoint_pick_locked(int skip, gboolean any, gint64 now) {
+    int soonest = -1;
+    for (guint i = 0; i < net_worker.n_endpoints; i++) {
+        const NetEndpoint *e = &net_worker.endpoints[i];
+        if ((int)i == skip) continue;
+        if (now >= e->down_until) return (int)i;
+        if (soonest < 0 || e->down_until < net_worker.endpoints[soonest].down_until) soonest = (int)i;
+    }
+    return any ? soonest : -1;
+}
+
+static gboolean net_endpoint_has_alternative(const NetRequest *req, gint64 now) {
+    if (!req->failover || req->endpoint < 0) return FALSE;
+    g_mutex_lock(&net_worker.endpoint_lock);
+    int alt = net_endpoint_pick_locked(req->endpoint, FALSE, now);
+    g_mutex_unlock(&net_worker.endpoint_lock);
+    return alt >= 0;
+}
+
+static gboolean net_transfer_ok(CURL *curl, CURLcode result) {
+    long http_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    return result == CURLE_OK && http_code != 429 && http_code < 500;
+}
+
+static void net_endpoint_report(int idx, CURL *curl, gboolean ok) {
+    if (idx < 0) return;
+    double ttfb = ok ? transport_ttfb_ms(curl, NULL) : 0.0;
+    gint64 now = g_get_monotonic_time();
+    g_mutex_lock(&net_worker.endpoint_lock);
+    NetEndpoint *e = &net_worker.endpoints[idx];
+    e->health = e->health * 0.8 + (ok ? 0.2 : 0.0);
+    if (ok) {
+        e->ok++;
+        e->failures = 0;
+        e->down_until = 0;
+        e->ttfb[e->next] = (float)ttfb;
+        e->next = (e->next + 1) % NET_ENDPOINT_WINDOW;
+        if (++e->samples % 8 == 0) {
+            float sorted[NET_ENDPOINT_WINDOW];
+            guint n = (guint)MIN(e->samples, (guint64)NET_ENDPOINT_WINDOW);
+            memcpy(sorted, e->ttfb, n * sizeof(float));
+            qsort(sorted, n, sizeof(float), stats_float_cmp);
+            e->p95_ms = sorted[(n * 95 + 99) / 100 - 1];
+        }
+    } else {
+        e->failed++;
+        if (++e->failures >= NET_ENDPOINT_TRIP) {
+            gint64 ms = MIN((gint64)NET_ENDPOINT_COOLDOWN_MS << MIN(e->failures - NET_ENDPOINT_TRIP, 5u), NET_ENDPOINT_COOLDOWN_MAX_MS);
+            e->down_until = now + ms * 1000;
+        }
+    }
+    g_mutex_unlock(&net_worker.endpoint_lock);
+}
+
+/* Point req's transfer at the endpoint it should use now. */
+static void net_endpoint_route(NetRequest *req, gint64 now) {
+    int built = req->url ? net_endpoint_match(req->url) : -1;
+    int to = built;
+    if (built < 0) {
+        req->endpoint = -1;
+        return;
+    }
+    g_mutex_lock(&net_worker.endpoint_lock);
+    if (req->failover) {
+        /* A retry avoids the endpoint that just failed while another one is up. */
+        to = net_endpoint_pick_locked(req->attempts > 0 ? req->endpoint : -1, FALSE, now);
+        if (to < 0) to = net_endpoint_pick_locked(-1, TRUE, now);
+    }
+    net_worker.endpoints[to].sent++;
+    g_mutex_unlock(&net_worker.endpoint_lock);
+    gchar *url = to == built ? NULL : net_endpoint_url(req->url, built, to);
+    curl_easy_setopt(req->curl, CURLOPT_URL, url ? url : req->url);
+    if (url) stats_count(STAT_COUNT_FAILOVERS);
+    g_free(url);
+    req->endpoint = to;
+}
+
+static size_t net_request_write_cb(void *ptr, size_t size, size_t nmemb, void *userp);
+static size_t net_hedge_write_cb(void *ptr, size_t size, size_t nmemb, void *userp);
+
+/* End a race by dropping one transfer; with keep_hedge the duplicate becomes req->curl. */
+static void net_race_drop(NetRequest *req, gboolean keep_hedge) {
+    CURL *gone = keep_hedge ? req->curl : req->hedge;
+    if (keep_hedge) {
+        req->curl = req->hedge;
+        req->endpoint = req->hedge_endpoint;
+        curl_easy_setopt(req->curl, CURLOPT_WRITEFUNCTION, net_request_write_cb);
+    }
+    req->hedge = NULL;
+    req->hedge_endpoint = -1;
+    req->race = NET_RACE_NONE;
+    g_queue_remove(&net_worker.settled, req);
+    curl_multi_remove_handle(net_worker.multi, gone);
+    transport_release(gone);
+    net_worker.limiter.active--;
+}
+
+/* Settle an open race in favour of one side. Only a duplicate that actually answered
+ * first counts as a hedge win. */
+static void net_race_settle(NetRequest *req, int side) {
+    req->race = side;
+    if (side != NET_RACE_HEDGE) return;
+    stats_count(STAT_COUNT_HEDGE_WINS);
+    g_mutex_lock(&net_worker.endpoint_lock);
+    net_worker.endpoints[req->hedge_endpoint].wins++;
+    g_mutex_unlock(&net_worker.endpoint_lock);
+}
+
+/* Stop hedging req: its timer and any duplicate still running. */
+static void net_race_clear(NetRequest *req) {
+    if (req->hedge_timer) {
+        g_source_destroy(req->hedge_timer);
+        g_source_unref(req->hedge_timer);
+        req->hedge_timer = NULL;
+    }
+    if (req->hedge) net_race_drop(req, FALSE);
+}
+
+/* From the write callbacks: TRUE if this transfer's bytes are the response. The first
+ * 2xx bytes settle an open race; the loser is dropped once curl is out of its
+ * callbacks, and refused (aborted) if it writes before that. */
+static gboolean net_race_claim(NetRequest *req, gboolean from_hedge) {
+    int side = from_hedge ? NET_RACE_HEDGE : NET_RACE_PRIMARY;
+    if (req->race == NET_RACE_OPEN) {
+        long http_code = 0;
+        curl_easy_getinfo(from_hedge ? req->hedge : req->curl, CURLINFO_RESPONSE_CODE, &http_code);
+        if (http_code / 100 != 2) return FALSE; /* an error body: let the other one answer */
+        net_race_settle(req, side);
+        g_queue_push_tail(&net_worker.settled, req);
+    }
+    return req->race == side;
+}
+
+/* A transfer of a race finished. Returns TRUE when req carries on without it, FALSE
+ * when it is req's outcome, which is then on req->curl. */
+static gboolean net_race_done(NetRequest *req, CURL *easy, CURLcode result) {
+    gboolean from_hedge = easy == req->hedge;
+    if (req->race == NET_RACE_OPEN) {
+        long http_code = 0;
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &http_code);
+        if (result == CURLE_OK && http_code / 100 == 2) {
+            net_race_settle(req, from_hedge ? NET_RACE_HEDGE : NET_RACE_PRIMARY); /* empty 2xx body */
+        } else {
+            net_endpoint_report(from_hedge ? req->hedge_endpoint : req->endpoint, easy,
+                                http_code > 0 && http_code < 500 && http_code != 429);
+            net_race_drop(req, !from_hedge);
+            return TRUE;
+        }
+    }
+    gboolean won = req->race == (from_hedge ? NET_RACE_HEDGE : NET_RACE_PRIMARY);
+    net_race_drop(req, req->race == NET_RACE_HEDGE);
+    return !won;
+}
+
+/* Send a duplicate of req to the next endpoint in rotation, if req has not heard back
+ * yet and the window and the buckets have room for it. */
+static void net_hedge_launch(NetRequest *req) {
+    NetLimiter *l = &net_worker.limiter;
+    long http_code = 0;
+    gint64 now = g_get_monotonic_time();
+    curl_easy_getinfo(req->curl, CURLINFO_RESPONSE_CODE, &http_code);
+    if (req->state != NET_REQ_ACTIVE || req->hedge || http_code != 0 || now >= req->deadline ||
+        l->active >= (guint)l->window) return;
+    net_limiter_refill(l, now);
+    if (net_limiter_wait(l, req) > 0) return;
+    g_mutex_lock(&net_worker.endpoint_lock);
+    int alt = net_endpoint_pick_locked(req->endpoint, FALSE, now);
+    g_mutex_unlock(&net_worker.endpoint_lock);
+    if (alt < 0) return;
+
+    CURL *dup = curl_easy_duphandle(req->curl);
+    if (!dup) return;
+    gchar *url = net_endpoint_url(req->url, net_endpoint_match(req->url), alt);
+    curl_easy_setopt(dup, CURLOPT_URL, url);
+    curl_easy_setopt(dup, CURLOPT_WRITEFUNCTION, net_hedge_write_cb);
+    g_free(url);
+    if (curl_multi_add_handle(net_worker.multi, dup) != CURLM_OK) {
+        curl_easy_cleanup(dup);
+        return;
+    }
+    if (l->rpm > 0) l->req_level -= 1.0;
+    if (l->tpm > 0) l->tok_level -= MIN((double)req->tokens, l->tpm);
+    l->active++;
+    req->hedge = dup;
+    req->hedge_endpoint = alt;
+    req->race = NET_RACE_OPEN;
+    stats_count(STAT_COUNT_HEDGES);
+    g_mutex_lock(&net_worker.endpoint_lock);
+    net_worker.endpoints[alt].sent++;
+    net_worker.endpoints[alt].hedges++;
+    g_mutex_unlock(&net_worker.endpoint_lock);
+}
+
+static gboolean net_hedge_timer_cb(gpointer data) {
+    NetRequest *req = (NetRequest*)data;
+    g_source_unref(req->hedge_timer);
+    req->hedge_timer = NULL;
+    net_hedge_launch(req);
+    return G_SOURCE_REMOVE;
+}
+
+/* Hedge after the endpoint's p95 time to first byte. */
+static void net_hedge_arm(NetRequest *req, gint64 now) {
+    if (!req->failover || req->endpoint < 0 || !net_worker.hedging || net_worker.n_endpoints < 2) return;
+    g_mutex_lock(&net_worker.endpoint_lock);
+    const NetEndpoint *e = &net_worker.endpoints[req->endpoint];
+    gint64 delay_ms = e->samples >= NET_HEDGE_MIN_SAMPLES ? MAX((gint64)e->p95_ms, NET_HEDGE_MIN_MS) : NET_HEDGE_COLD_MS;
+    g_mutex_unlock(&net_worker.endpoint_lock);
+    if (now + delay_ms * 1000 >= req->deadline) return;
+    req->hedge_timer = g_timeout_source_new((guint)delay_ms);
+    g_source_set_callback(req->hedge_timer, net_hedge_timer_cb, req, NULL);
+    g_source_attach(req->hedge_timer, net_worker.context);
+}
+
+static void net_worker_pump(void);
+static void net_worker_finish(NetRequest *req, CURLcode result);
+
+static gboolean net_worker_wake_cb(gpointer data) {
+    g_source_unref(net_worker.limiter.wake);
+    net_worker.limiter.wake = NULL;
+    net_worker_pump();
+    net_worker_deliver();
+    return G_SOURCE_REMOVE;
+}
+
+static void net_worker_schedule_wake(gint64 delay_us) {
+    NetLimiter *l = &net_worker.limiter;
+    if (l->wake) {
+        g_source_destroy(l->wake);
+        g_source_unref(l->wake);
+    }
+    l->wake = g_timeout_source_new((guint)MIN((delay_us + 999) / 1000, G_MAXUINT));
+    g_source_set_callback(l->wake, net_worker_wake_cb, NULL, NULL);
+    g_source_attach(l->wake, net_worker.context);
+}
+
+/* Start queued requests while the window and the buckets allow. */
+static void net_worker_pump(void) {
+    NetLimiter *l = &net_worker.limiter;
+    NetRequest *req;
+    while ((req = g_queue_peek_head(&l->pending)) != NULL && l->active < (guint)l->window) {
+        gint64 now = g_get_monotonic_time();
+        if (now >= req->deadline) {
+            g_queue_pop_head(&l->pending);
+            net_worker_finish(req, CURLE_OPERATION_TIMEDOUT);
+            continue;
+        }
+        if (now < l->hold_until) {
+            net_worker_schedule_wake(l->hold_until - now);
+            return;
+        }
+        net_limiter_refill(l, now);
+        gint64 wait = net_limiter_wait(l, req);
+        if (wait > 0) {
+            net_worker_schedule_wake(wait);
+            return;
+        }
+        g_queue_pop_head(&l->pending);
+        stats_record(STAT_QUEUE, (now - req->queued_at) / 1000.0);
+        net_endpoint_route(req, now);
+        curl_easy_setopt(req->curl, CURLOPT_CONNECTTIMEOUT_MS, (long)NET_CONNECT_TIMEOUT_MS);
+        /* curl only calls the progress callback of an idle transfer while a timer of its
+         * own is pending; the speed check keeps one armed, once a second, while no bytes
+         * arrive, and is itself a backstop for a stall of a full timeout. */
+        curl_easy_setopt(req->curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+        curl_easy_setopt(req->curl, CURLOPT_LOW_SPEED_TIME, (long)((net_request_timeout_us(req) + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC));
+        if (curl_multi_add_handle(net_worker.multi, req->curl) != CURLM_OK) {
+            /* Through finish, so the flight and its followers end with it. */
+            net_worker_finish(req, CURLE_FAILED_INIT);
+            continue;
+        }
+        if (l->rpm > 0) l->req_level -= 1.0;
+        if (l->tpm > 0) l->tok_level -= MIN((double)req->tokens, l->tpm);
+        req->state = NET_REQ_ACTIVE;
+        l->active++;
+        net_hedge_arm(req, now);
+    }
+}
+
+static void net_worker_enqueue(NetRequest *req) {
+    req->state = NET_REQ_QUEUED;
+    req->queued_at = g_get_monotonic_time();
+    g_queue_insert_sorted(&net_worker.limiter.pending, req, net_request_priority_cmp, NULL);
+    net_worker_pump();
+}
+
+/* Take req out of whichever stage it is in. */
+static void net_worker_detach(NetRequest *req) {
+    switch (req->state) {
+    case NET_REQ_QUEUED:
+        g_queue_remove(&net_worker.limiter.pending, req);
+        break;
+    case NET_REQ_ACTIVE:
+        net_race_clear(req);
+        curl_multi_remove_handle(net_worker.multi, req->curl);
+        net_worker.limiter.active--;
+        break;
+    case NET_REQ_BACKOFF:
+        g_source_destroy(req->retry_timer);
+        g_source_unref(req->retry_timer);
+        req->retry_timer = NULL;
+        break;
+    case NET_REQ_ATTACHED:
+        if (req->leader) g_ptr_array_remove(req->leader->followers, req);
+        req->leader = NULL;
+        break;
+    }
+    req->state = NET_REQ_DONE;
+}
+
+static void net_worker_finish(NetRequest *req, CURLcode result) {
+    net_worker_detach(req);
+    req->result = result;
+    curl_easy_getinfo(req->curl, CURLINFO_RESPONSE_CODE, &req->http_code);
+    req->finished = TRUE;
+    if (!req->followers) return;
+    for (guint i = 0; i < req->followers->len; i++) {
+        NetRequest *f = g_ptr_array_index(req->followers, i);
+        f->state = NET_REQ_DONE;
+        f->result = result;
+        f->http_code = req->http_code;
+        f->attempts = req->attempts;
+        f->cancelled = req->cancelled;
+        f->finished = TRUE;
+    }
+    g_ptr_array_set_size(req->followers, 0);
+    net_flight_forget(req);
+}
+
+static gboolean net_worker_retry_cb(gpointer data) {
+    NetRequest *req = (NetRequest*)data;
+    g_source_unref(req->retry_timer);
+    req->retry_timer = NULL;
+    net_worker_enqueue(req);
+    net_worker_deliver();
+    return G_SOURCE_REMOVE;
+}
+
+/* Feed a finished transfer into the window; returns TRUE if req was queued for retry. */
+static gboolean net_worker_backoff(NetRequest *req, CURLcode result) {
+    NetLimiter *l = &net_worker.limiter;
+    long http_code = 0;
+    curl_off_t retry_after = 0, received = 0;
+    gint64 now = g_get_monotonic_time();
+    curl_easy_getinfo(req->curl, CURLINFO_RESPONSE_CODE, &http_code);
+    curl_easy_getinfo(req->curl, CURLINFO_RETRY_AFTER, &retry_after);
+    curl_easy_getinfo(req->curl, CURLINFO_SIZE_DOWNLOAD_T, &received);
+
+    gboolean throttled = result == CURLE_OK && (http_code == 429 || http_code == 503);
+    if (throttled) {
+        if (now - l->last_decrease >= G_USEC_PER_SEC) {
+            l->window = MAX(1.0, l->window / 2.0);
+            l->last_decrease = now;
+        }
+        if (retry_after > 0) l->hold_until = MAX(l->hold_until, now + (gint64)retry_after * G_USEC_PER_SEC);
+    } else if (result == CURLE_OK && http_code < 400) {
+        l->window = MIN(l->max_window, l->window + 1.0 / l->window);
+    }
+
+    gboolean transient = throttled ||
+        (result == CURLE_OK && (http_code == 500 || http_code == 502 || http_code == 504)) ||
+        (result != CURLE_OK && received == 0);
+    if (!req->retryable || !transient || req->attempts >= l->max_retries) return FALSE;
+    gint64 cap_ms = MIN((gint64)NET_BACKOFF_BASE_MS << MIN(req->attempts, 16u), NET_BACKOFF_MAX_MS);
+    gint64 delay_ms = MAX((gint64)(g_random_double() * cap_ms), (gint64)retry_after * 1000);
+    /* Another endpoint is in rotation: fail over to it now rather than wait. */
+    if (!throttled && net_endpoint_has_alternative(req, now)) delay_ms = 0;
+    if (now + delay_ms * 1000 >= req->deadline) return FALSE;
+
+    net_race_clear(req);
+    curl_multi_remove_handle(net_worker.multi, req->curl);
+    l->active--;
+    req->attempts++;
+    req->resp.len = 0;
+    if (req->flight_data) g_string_truncate(req->flight_data, 0);
+    for (guint i = 0; req->followers && i < req->followers->len; i++) {
+        ((NetRequest*)g_ptr_array_index(req->followers, i))->resp.len = 0;
+    }
+    req->state = NET_REQ_BACKOFF;
+    req->retry_timer = g_timeout_source_new((guint)delay_ms);
+    g_source_set_callback(req->retry_timer, net_worker_retry_cb, req, NULL);
+    g_source_attach(req->retry_timer, net_worker.context);
+    return TRUE;
+}
+
+static void net_worker_check_multi_info(void) {
+    CURLMsg *msg;
+    int pending = 0;
+    NetRequest *req;
+    while ((req = g_queue_pop_head(&net_worker.settled)) != NULL) {
+        if (req->race == NET_RACE_PRIMARY || req->race == NET_RACE_HEDGE) net_race_drop(req, req->race == NET_RACE_HEDGE);
+    }
+    while ((msg = curl_multi_info_read(net_worker.multi, &pending)) != NULL) {
+        if (msg->msg != CURLMSG_DONE) continue;
+        CURL *easy = msg->easy_handle;
+        CURLcode result = msg->data.result;
+        /* Only net_request_progress_cb aborts a running transfer: its deadline passed. */
+        if (result == CURLE_ABORTED_BY_CALLBACK) result = CURLE_OPERATION_TIMEDOUT;
+        req = NULL;
+        curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char**)&req);
+        if (!req || (req->race != NET_RACE_NONE && net_race_done(req, easy, result))) continue;
+        net_endpoint_report(req->endpoint, req->curl, net_transfer_ok(req->curl, result));
+        if (net_worker_backoff(req, result)) continue;
+        net_worker_finish(req, result);
+        if (result == CURLE_OK) stats_record_transfer(req->curl);
+    }
+    net_worker_pump();
+    net_worker_deliver();
+}
+
+static size_t net_request_accept(NetRequest *req, const char *data, size_t len);
+
+/* Attach req to an identical in-flight request, or register it as the leader for its
+ * key. Returns TRUE if req now rides on another request's transfer. */
+static gboolean net_flight_join(NetRequest *req) {
+    if (!req->has_flight_key) return FALSE;
+    NetRequest *leader = g_hash_table_lookup(net_worker.flights, req->flight_key);
+    if (!leader) {
+        g_hash_table_insert(net_worker.flights, req->flight_key, req);
+        req->followers = g_ptr_array_new();
+        if (req->on_data) req->flight_data = g_string_new(NULL);
+        stats_count(STAT_COUNT_FLIGHTS);
+        return FALSE;
+    }
+    /* Streaming and buffered consumers of the same bytes cannot share a replay buffer. */
+    if (!leader->on_data != !req->on_data) return FALSE;
+    req->leader = leader;
+    req->coalesced = TRUE;
+    req->state = NET_REQ_ATTACHED;
+    g_ptr_array_add(leader->followers, req);
+    stats_count(STAT_COUNT_COALESCED);
+    if (leader->flight_data && leader->flight_data->len > 0) {
+        net_request_accept(req, leader->flight_data->str, leader->flight_data->len);
+    } else if (!leader->on_data && leader->resp.len > 0) {
+        net_request_accept(req, leader->resp.data, leader->resp.len);
+    }
+    return TRUE;
+}
+
+/* Hand the leader's transfer (easy handle, headers and place in the limiter) to its
+ * first follower, which leads from here on. */
+static void net_flight_promote(NetRequest *leader) {
+    /* Keep whichever transfer already answered; an undecided hedge is given up. */
+    if (leader->race == NET_RACE_PRIMARY || leader->race == NET_RACE_HEDGE) net_race_drop(leader, leader->race == NET_RACE_HEDGE);
+    net_race_clear(leader);
+    NetRequest *f = g_ptr_array_steal_index(leader->followers, 0);
+    CURL *curl = f->curl;
+    struct curl_slist *headers = f->headers;
+    f->curl = leader->curl;
+    f->headers = leader->headers;
+    leader->curl = curl;
+    leader->headers = headers;
+    curl_easy_setopt(f->curl, CURLOPT_WRITEDATA, f);
+    curl_easy_setopt(f->curl, CURLOPT_PRIVATE, f);
+    curl_easy_setopt(f->curl, CURLOPT_XFERINFODATA, f);
+    curl_easy_setopt(leader->curl, CURLOPT_WRITEDATA, leader);
+    curl_easy_setopt(leader->curl, CURLOPT_PRIVATE, leader);
+    curl_easy_setopt(leader->curl, CURLOPT_XFERINFODATA, leader);
+
+    f->leader = NULL;
+    f->coalesced = FALSE;
+    f->state = leader->state;
+    f->attempts = leader->attempts;
+    f->queued_at = leader->queued_at;
+    f->deadline = leader->deadline;
+    f->endpoint = leader->endpoint;
+    f->retry_timer = leader->retry_timer;
+    f->followers = leader->followers;
+    f->flight_data = leader->flight_data;
+    for (guint i = 0; i < f->followers->len; i++) ((NetRequest*)g_ptr_array_index(f->followers, i))->leader = f;
+    if (f->state == NET_REQ_QUEUED) {
+        g_queue_find(&net_worker.limiter.pending, leader)->data = f;
+    } else if (f->state == NET_REQ_BACKOFF) {
+        g_source_set_callback(f->retry_timer, net_worker_retry_cb, f, NULL);
+    }
+    g_hash_table_remove(net_worker.flights, leader->flight_key);
+    g_hash_table_insert(net_worker.flights, f->flight_key, f);
+
+    leader->state = NET_REQ_DONE;
+    leader->retry_timer = NULL;
+    leader->followers = NULL;
+    leader->flight_data = NULL;
+}
+
+static gboolean net_worker_add_cb(gpointer data) {
+    NetRequest *req = (NetRequest*)data;
+    response_arena_take(&net_worker.arena, &req->resp);
+    req->deadline = g_get_monotonic_time() + net_request_timeout_us(req);
+    g_queue_push_tail(&net_worker.order, req);
+    if (!net_flight_join(req)) net_worker_enqueue(req);
+    net_worker_deliver();
+    return G_SOURCE_REMOVE;
+}
+
+/* Allocate a request with a leased easy handle; set URL and headers on req->curl, the
+ * body with net_request_set_body, and then hand it to net_worker_submit. */
+NetRequest *net_request_new(NetRequestDone on_done, gpointer user_data, GDestroyNotify destroy) {
+    CURL *curl = transport_lease();
+    if (!curl) return NULL;
+    NetRequest *req = g_new0(NetRequest, 1);
+    req->curl = curl;
+    req->on_done = on_done;
+    req->user_data = user_data;
+    req->destroy = destroy;
+    req->endpoint = req->hedge_endpoint = -1;
+    return req;
+}
+
+/* Failover requests need their URL set this way to be moved between endpoints. */
+void net_request_set_url(NetRequest *req, const char *url) {
+    g_free(req->url);
+    req->url = g_strdup(url);
+    curl_easy_setopt(req->curl, CURLOPT_URL, url);
+}
+
+void net_request_set_flight_key(NetRequest *req, const guint8 key[RESPONSE_CACHE_KEY_BYTES]) {
+    memcpy(req->flight_key, key, RESPONSE_CACHE_KEY_BYTES);
+    req->has_flight_key = TRUE;
+}
+
+/* The transfer whose bytes req receives: its leader's, and the hedge once that won. */
+static CURL *net_request_transfer(NetRequest *req) {
+    NetRequest *lead = req->leader ? req->leader : req;
+    return lead->race == NET_RACE_HEDGE ? lead->hedge : lead->curl;
+}
+
+long net_request_http_code(NetRequest *req) {
+    long http_code = 0;
+    curl_easy_getinfo(net_request_transfer(req), CURLINFO_RESPONSE_CODE, &http_code);
+    return http_code;
+}
+
+static size_t net_request_accept(NetRequest *req, const char *data, size_t len) {
+    if (req->on_data) return req->on_data(req, data, len);
+    if (req->resp.len == 0) {
+        /* Size the buffer once from Content-Length when the server sends one. */
+        curl_off_t content_length = -1;
+        curl_easy_getinfo(net_request_transfer(req), CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
+        if (content_length > 0 && content_length <= RESPONSE_PRESIZE_MAX) {
+            curl_response_reserve(&req->resp, (size_t)content_length);
+        }
+    }
+    return curl_write_cb((void*)data, 1, len, &req->resp);
+}
+
+static size_t net_request_fan_out(NetRequest *req, const char *ptr, size_t len) {
+    req->deadline = g_get_monotonic_time() + net_request_timeout_us(req);
+    if (req->followers) {
+        if (req->flight_data) g_string_append_len(req->flight_data, ptr, (gssize)len);
+        for (guint i = 0; i < req->followers->len; i++) net_request_accept(g_ptr_array_index(req->followers, i), ptr, len);
+    }
+    return net_request_accept(req, ptr, len);
+}
+
+static size_t net_request_write_cb(void *ptr, size_t size, size_t nmemb, void *userp) {
+    NetRequest *req = (NetRequest*)userp;
+    if (req->race != NET_RACE_NONE && !net_race_claim(req, FALSE)) return 0;
+    return net_request_fan_out(req, ptr, size * nmemb);
+}
+
+/* A hedge transfer writes on behalf of the request it races for (its WRITEDATA). */
+static size_t net_hedge_write_cb(void *ptr, size_t size, size_t nmemb, void *userp) {
+    NetRequest *req = (NetRequest*)userp;
+    if (!net_race_claim(req, TRUE)) return 0;
+    return net_request_fan_out(req, ptr, size * nmemb);
+}
+
+/* Called by curl while a transfer (or its hedge, which shares the data pointer) runs. */
+static int net_request_progress_cb(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+    NetRequest *req = (NetRequest*)clientp;
+    return g_get_monotonic_time() >= req->deadline;
+}
+
+guint64 net_worker_submit(NetRequest *req) {
+    req->id = (guint64)g_atomic_int_add(&net_worker.next_id, 1) + 1;
+    curl_easy_setopt(req->curl, CURLOPT_HTTPHEADER, req->headers);
+    curl_easy_setopt(req->curl, CURLOPT_WRITEFUNCTION, net_request_write_cb);
+    curl_easy_setopt(req->curl, CURLOPT_WRITEDATA, req);
+    curl_easy_setopt(req->curl, CURLOPT_PRIVATE, req);
+    curl_easy_setopt(req->curl, CURLOPT_XFERINFOFUNCTION, net_request_progress_cb);
+    curl_easy_setopt(req->curl, CURLOPT_XFERINFODATA, req);
+    curl_easy_setopt(req->curl, CURLOPT_NOPROGRESS, 0L);
+    net_worker_invoke(net_worker_add_cb, req);
+    return req->id;
+}
+
+static gboolean net_worker_cancel_cb(gpointer data) {
+    guint64 id = *(guint64*)data;
+    g_free(data);
+    for (GList *l = net_worker.order.head; l; l = l->next) {
+        NetRequest *req = l->data;
+        if (req->finished || (id != 0 && req->id != id)) continue;
+        if (id != 0 && req->followers && req->followers->len > 0) net_flight_promote(req);
+        req->cancelled = TRUE;
+        net_worker_finish(req, CURLE_ABORTED_BY_CALLBACK);
+    }
+    net_worker_pump();
+    net_worker_deliver();
+    return G_SOURCE_REMOVE;
+}
+
+/* Cancel one in-flight request by id, or all of them when id is 0. The request's
+ * on_done still runs (with req->cancelled set) to keep delivery ordered. */
+void net_worker_cancel(guint64 id) {
+    guint64 *p = g_new(guint64, 1);
+    *p = id;
+    net_worker_invoke(net_worker_cancel_cb, p);
+}
+
+static gpointer net_worker_thread(gpointer data) {
+    g_main_context_push_thread_default(net_worker.context);
+    g_main_loop_run(net_worker.loop);
+    g_main_context_pop_thread_default(net_worker.context);
+    return NULL;
+}
+
+void net_worker_start(void) {
+    g_queue_init(&net_worker.order);
+    g_queue_init(&net_worker.settled);
+    net_limiter_init(&net_worker.limiter);
+    const char *timeout = getenv("GEMINI_TIMEOUT_MS");
+    const char *hedge = getenv("GEMINI_HEDGE");
+    net_worker.timeout_ms = timeout && *timeout ? MAX(g_ascii_strtoll(timeout, NULL, 10), 1000) : NET_DEFAULT_TIMEOUT_MS;
+    net_worker.hedging = !(hedge && strcmp(hedge, "0") == 0);
+    gchar **urls = net_endpoint_list();
+    net_worker.n_endpoints = g_strv_length(urls);
+    net_worker.endpoints = g_new0(NetEndpoint, MAX(net_worker.n_endpoints, 1));
+    for (guint i = 0; i < net_worker.n_endpoints; i++) {
+        net_worker.endpoints[i].stem = net_endpoint_stem(urls[i]);
+        net_worker.endpoints[i].health = 1.0;
+    }
+    g_strfreev(urls);
+    net_worker.flights = g_hash_table_new(response_cache_hash, response_cache_equal);
+    net_worker.context = g_main_context_new();
+    net_worker.loop = g_main_loop_new(net_worker.context, FALSE);
+    net_worker.multi = curl_multi_init();
+    curl_multi_setopt(net_worker.multi, CURLMOPT_SOCKETFUNCTION, net_worker_socket_cb);
+    curl_multi_setopt(net_worker.multi, CURLMOPT_TIMERFUNCTION, net_worker_timer_cb);
+    curl_multi_setopt(net_worker.multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+    net_worker.thread = g_thread_new("net-worker", net_worker_thread, NULL);
+}
+
+static gboolean net_worker_quit_cb(gpointer data) {
+    NetRequest *req;
+    while ((req = g_queue_pop_head(&net_worker.order)) != NULL) {
+        if (!req->finished) net_worker_detach(req);
+        net_request_free(req);
+    }
+    g_main_loop_quit(net_worker.loop);
+    return G_SOURCE_REMOVE;
+}
+
+void net_worker_stop(void) {
+    if (!net_worker.thread) return;
+    net_worker_invoke(net_worker_quit_cb, NULL);
+    g_thread_join(net_worker.thread);
+    net_worker.thread = NULL;
+    if (net_worker.timer) {
+        g_source_destroy(net_worker.timer);
+        g_source_unref(net_worker.timer);
+        net_worker.timer = NULL;
+    }
+    if (net_worker.limiter.wake) {
+        g_source_destroy(net_worker.limiter.wake);
+        g_source_unref(net_worker.limiter.wake);
+        net_worker.limiter.wake = NULL;
+    }
+    curl_multi_cleanup(net_worker.multi);
+    g_hash_table_destroy(net_worker.flights);
+    for (guint i = 0; i < net_worker.n_endpoints; i++) g_free(net_worker.endpoints[i].stem);
+    g_free(net_worker.endpoints);
+    net_worker.endpoints = NULL;
+    net_worker.n_endpoints = 0;
+    response_arena_clear(&net_worker.arena);
+    g_main_loop_unref(net_worker.loop);
+    g_main_context_unref(net_worker.context);
+}
+
+/* [{"url":stem,"up":bool,"health":x,"p95_ms":ms,"sent":n,"ok":n,"failed":n,"hedges":n,"wins":n},...]
+ * sent counts hedges too; wins are hedges whose answer was used. */
+void net_endpoints_dump_json(GString *out) {
+    gint64 now = g_get_monotonic_time();
+    g_string_append_c(out, '[');
+    g_mutex_lock(&net_worker.endpoint_lock);
+    for (guint i = 0; i < net_worker.n_endpoints; i++) {
+        const NetEndpoint *e = &net_worker.endpoints[i];
+        g_string_append(out, i ? ",{\"url\":" : "{\"url\":");
+        json_append_string(out, e->stem, strlen(e->stem));
+        g_string_append_printf(out, ",\"up\":%s,\"health\":", now >= e->down_until ? "true" : "false");
+        json_append_double(out, e->health);
+        g_string_append(out, ",\"p95_ms\":");
+        json_append_double(out, e->p95_ms);
+        g_string_append_printf(out, ",\"sent\":%" G_GUINT64_FORMAT ",\"ok\":%" G_GUINT64_FORMAT ",\"failed\":%" G_GUINT64_FORMAT
+                               ",\"hedges\":%" G_GUINT64_FORMAT ",\"wins\":%" G_GUINT64_FORMAT "}",
+                               e->sent, e->ok, e->failed, e->hedges, e->wins);
+    }
+    g_mutex_unlock(&net_worker.endpoint_lock);
+    g_string_append_c(out, ']');
+}
+
+/* Encryption storage. The passphrase prompt and error reporting belong to the caller. */
+static char *credential_ui_passphrase(const GeminiCredentialUI *ui, const char *purpose, gboolean confirm) {
+    return ui && ui->passphrase ? ui->passphrase(purpose, confirm, ui->user_data) : NULL;
+}
+
+static void credential_ui_report(const GeminiCredentialUI *ui, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    gchar *msg = g_strdup_vprintf(fmt, ap);
+    va_end(ap);
+    if (ui && ui->report) ui->report(msg, ui->user_data);
+    else g_warning("%s", msg);
+    g_free(msg);
+}
+
+/* Key file formats. v1 is MAGIC + salt + nonce + ciphertext and was always derived with
+ * the INTERACTIVE limits (64 MiB). v2 records the KDF parameters so they can be tuned
+ * per machine:
+ *   "GEMINIENC2" | alg u8 | opslimit u64le | memlimit u64le | salt | nonce | ciphertext
+ * The header up to the salt is authenticated as associated data. A v1 file, or a v2 file
+ * whose parameters differ from the current profile, is rewritten after a good unlock. */
+static const char *MAGIC_V2 = "GEMINIENC2";
+#define KDF_HEADER_LEN (10 + 1 + 8 + 8)
+#define KDF_MEMLIMIT_CAP (256ULL * 1024 * 1024) /* refuse files asking for more */
+#define KDF_OPSLIMIT_CAP 32ULL
+#define KDF_DEFAULT_TARGET_MS 250
+
+typedef struct {
+    unsigned long long opslimit;
+    size_t memlimit;
+} KdfProfile;
+
+static gboolean kdf_derive(unsigned char *key, size_t key_len, const char *pass,
+                           const unsigned char *salt, const KdfProfile *kdf) {
+    return crypto_pwhash(key, key_len, pass, strlen(pass), salt, kdf->opslimit, kdf->memlimit,
+                         crypto_pwhash_ALG_ARGON2ID13) == 0;
+}
+
+static gchar *get_kdf_profile_path(void) {
+    return g_build_filename(g_get_user_config_dir(), "gemini-gtk", "kdf_profile", NULL);
+}
+
+/* Memory for the KDF: GEMINI_KDF_MEMLIMIT_MB if set, otherwise the INTERACTIVE 64 MiB
+ * capped at 1/64 of physical RAM so thin clients do not swap during unlock. */
+static size_t kdf_memlimit(void) {
+    const char *env = getenv("GEMINI_KDF_MEMLIMIT_MB");
+    guint64 mem = crypto_pwhash_MEMLIMIT_INTERACTIVE;
+    if (env && *env) {
+        mem = g_ascii_strtoull(env, NULL, 10) * 1024 * 1024;
+    } else {
+        long pages = sysconf(_SC_PHYS_PAGES), page_size = sysconf(_SC_PAGESIZE);
+        if (pages > 0 && page_size > 0) mem = MIN(mem, (guint64)pages * (guint64)page_size / 64);
+    }
+    mem &= ~(guint64)(1024 * 1024 - 1);
+    return (size_t)CLAMP(mem, 8ULL * 1024 * 1024, KDF_MEMLIMIT_CAP);
+}
+
+/* Times one pass at the chosen memory and scales the pass count to GEMINI_KDF_TARGET_MS.
+ * When memory is below 64 MiB the pass count never drops under what keeps the total
+ * work at the INTERACTIVE level, so a smaller footprint costs time, not strength. */
+static KdfProfile kdf_benchmark(size_t memlimit, guint target_ms) {
+    static const unsigned char salt[crypto_pwhash_SALTBYTES] = { 0 };
+    unsigned char out[32];
+    KdfProfile kdf = { crypto_pwhash_OPSLIMIT_MIN, memlimit };
+    gint64 start = g_get_monotonic_time();
+    gboolean ok = kdf_derive(out, sizeof out, "gemini-kdf-benchmark", salt, &kdf);
+    double pass_ms = MAX((g_get_monotonic_time() - start) / 1000.0, 0.1);
+    sodium_memzero(out, sizeof out);
+
+    guint64 floor_ops = (crypto_pwhash_OPSLIMIT_INTERACTIVE * crypto_pwhash_MEMLIMIT_INTERACTIVE + memlimit - 1) / memlimit;
+    guint64 ops = ok ? (guint64)(target_ms / pass_ms) : 0;
+    kdf.opslimit = CLAMP(MAX(ops, floor_ops), crypto_pwhash_OPSLIMIT_INTERACTIVE, KDF_OPSLIMIT_CAP);
+    return kdf;
+}
+
+/* The profile used for writing key files. Benchmarking costs a few KDF passes, so the
+ * result is kept in ~/.config/gemini-gtk/kdf_profile together with the inputs it was
+ * measured for, and rerun only when those change. */
+static KdfProfile kdf_profile(void) {
+    const char *target_env = getenv("GEMINI_KDF_TARGET_MS");
+    guint target_ms = target_env && *target_env ? (guint)g_ascii_strtoull(target_env, NULL, 10) : KDF_DEFAULT_TARGET_MS;
+    size_t memlimit = kdf_memlimit();
+
+    gchar *path = get_kdf_profile_path();
+    gchar *content = NULL;
+    if (g_file_get_contents(path, &content, NULL, NULL)) {
+        guint64 ops = 0, mem = 0, cached_target = 0;
+        if (sscanf(content, "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT, &ops, &mem, &cached_target) == 3 &&
+            mem == memlimit && cached_target == target_ms && ops >= crypto_pwhash_OPSLIMIT_MIN && ops <= KDF_OPSLIMIT_CAP) {
+            g_free(content);
+            g_free(path);
+            return (KdfProfile){ ops, memlimit };
+        }
+        g_free(content);
+    }
+
+    KdfProfile kdf = kdf_benchmark(memlimit, target_ms);
+    gchar *line = g_strdup_printf("%llu %" G_GUINT64_FORMAT " %u\n", kdf.opslimit, (guint64)kdf.memlimit, target_ms);
+    gchar *dir = g_path_get_dirname(path);
+    g_mkdir_with_parents(dir, 0700);
+    g_file_set_contents(path, line, -1, NULL);
+    g_free(dir);
+    g_free(line);
+    g_free(path);
+    return kdf;
+}
+
+static void kdf_header_write(unsigned char *p, const KdfProfile *kdf) {
+    guint64 ops = GUINT64_TO_LE((guint64)kdf->opslimit), mem = GUINT64_TO_LE((guint64)kdf->memlimit);
+    memcpy(p, MAGIC_V2, 10);
+    p[10] = (unsigned char)crypto_pwhash_ALG_ARGON2ID13;
+    memcpy(p + 11, &ops, 8);
+    memcpy(p + 19, &mem, 8);
+}
+
+static gboolean kdf_header_read(const unsigned char *p, KdfProfile *kdf) {
+    guint64 ops, mem;
+    if (p[10] != (unsigned char)crypto_pwhash_ALG_ARGON2ID13) return FALSE;
+    memcpy(&ops, p + 11, 8);
+    memcpy(&mem, p + 19, 8);
+    ops = GUINT64_FROM_LE(ops);
+    mem = GUINT64_FROM_LE(mem);
+    if (ops < crypto_pwhash_OPSLIMIT_MIN || ops > KDF_OPSLIMIT_CAP ||
+        mem < crypto_pwhash_MEMLIMIT_MIN || mem > KDF_MEMLIMIT_CAP) return FALSE;
+    kdf->opslimit = ops;
+    kdf->memlimit = (size_t)mem;
+    return TRUE;
+}
+
+/* Seal m under a key derived from pass and write header | salt | nonce | ciphertext to path. */
+static gboolean kdf_seal_file(const GeminiCredentialUI *ui, const char *path, const char *pass,
+                              const unsigned char *m, size_t mlen, const KdfProfile *kdf) {
+    unsigned char salt[crypto_pwhash_SALTBYTES];
+    randombytes_buf(salt, sizeof(salt));
+
+    unsigned char key[crypto_aead_xchacha20poly1305_ietf_KEYBYTES];
+    if (!kdf_derive(key, sizeof key, pass, salt, kdf)) {
+        credential_ui_report(ui, "Error deriving key from passphrase (out of memory)");
+        return FALSE;
+    }
+
+    unsigned char nonce[crypto_aead_xchacha20poly1305_ietf_NPUBBYTES];
+    randombytes_buf(nonce, sizeof(nonce));
+    size_t total = KDF_HEADER_LEN + sizeof(salt) + sizeof(nonce) + mlen + crypto_aead_xchacha20poly1305_ietf_ABYTES;
+    unsigned char *buf = malloc(total);
+    unsigned char *p = buf;
+    kdf_header_write(p, kdf); p += KDF_HEADER_LEN;
+    memcpy(p, salt, sizeof(salt)); p += sizeof(salt);
+    memcpy(p, nonce, sizeof(nonce)); p += sizeof(nonce);
+    unsigned long long actual_clen = 0;
+    crypto_aead_xchacha20poly1305_ietf_encrypt(p, &actual_clen,
+                                               m, mlen,
+                                               buf, KDF_HEADER_LEN, NULL,
+                                               nonce, key);
+
+    GError *error = NULL;
+    gboolean ok = g_file_set_contents(path, (const char*)buf, total, &error);
+    if (!ok) {
+        credential_ui_report(ui, "Failed to write encrypted key: %s", error ? error->message : "unknown");
+        if (error) g_error_free(error);
+    }
+
+    sodium_memzero(key, sizeof(key));
+    free(buf);
+    return ok;
+}
+
+static gboolean write_encrypted_key(const GeminiCredentialUI *ui, const char *pass, const char *api_key, const KdfProfile *kdf) {
+    gchar *path = get_api_key_enc_path();
+    gboolean ok = kdf_seal_file(ui, path, pass, (const unsigned char*)api_key, strlen(api_key), kdf);
+    g_free(path);
+    return ok;
+}
+
+gboolean encrypt_and_store_api_key(const GeminiCredentialUI *ui, const char *api_key) {
+    char *pass = credential_ui_passphrase(ui, "the API key", TRUE);
+    if (!pass) return FALSE;
+    KdfProfile kdf = kdf_profile();
+    gboolean ok = write_encrypted_key(ui, pass, api_key, &kdf);
+    sodium_memzero(pass, strlen(pass));
+    g_free(pass);
+    return ok;
+}
+
+char *read_and_decrypt_api_key(const GeminiCredentialUI *ui) {
+    gchar *enc_path = get_api_key_enc_path();
+    char *data = NULL;
+    gsize length = 0;
+    GError *error = NULL;
+    if (!g_file_get_contents(enc_path, &data, &length, &error)) {
+        g_free(enc_path);
+        if (error) g_error_free(error);
+        return NULL;
+    }
+    g_free(enc_path);
+
+    size_t magic_len = strlen(MAGIC);
+    if (length < magic_len) {
+        g_free(data);
+        return NULL;
+    }
+    gboolean v2 = memcmp(data, MAGIC_V2, magic_len) == 0;
+    if (!v2 && memcmp(data, MAGIC, magic_len) != 0) {
+        char *plain = g_strdup(data);
+        g_free(data);
+        return plain;
+    }
+
+    KdfProfile kdf = { crypto_pwhash_OPSLIMIT_INTERACTIVE, crypto_pwhash_MEMLIMIT_INTERACTIVE };
+    size_t header_len = v2 ? KDF_HEADER_LEN : magic_len;
+    size_t min_len = header_len + crypto_pwhash_SALTBYTES + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES +
+                     crypto_aead_xchacha20poly1305_ietf_ABYTES;
+    if (length < min_len || (v2 && !kdf_header_read((const unsigned char*)data, &kdf))) {
+        credential_ui_report(ui, "Encrypted key file is corrupted or uses unsupported parameters");
+        g_free(data);
+        return NULL;
+    }
+
+    const unsigned char *p = (const unsigned char*)data + header_len;
+    const unsigned char *salt = p; p += crypto_pwhash_SALTBYTES;
+    const unsigned char *nonce = p; p += crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
+    const unsigned char *cipher = p;
+    size_t cipherlen = length - (header_len + crypto_pwhash_SALTBYTES + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES);
+
+    char *pass = credential_ui_passphrase(ui, "the API key", FALSE);
+    if (!pass) {
+        g_free(data);
+        return NULL;
+    }
+
+    unsigned char key[crypto_aead_xchacha20poly1305_ietf_KEYBYTES];
+    if (!kdf_derive(key, sizeof key, pass, salt, &kdf)) {
+        credential_ui_report(ui, "Error deriving key from passphrase");
+        sodium_memzero(pass, strlen(pass));
+        g_free(pass);
+        g_free(data);
+        return NULL;
+    }
+
+    unsigned long long mlen = 0;
+    unsigned char *m = malloc(cipherlen + 1);
+    if (crypto_aead_xchacha20poly1305_ietf_decrypt(m, &mlen,
+                                                  NULL,
+                                                  cipher, cipherlen,
+                                                  v2 ? (const unsigned char*)data : NULL, v2 ? KDF_HEADER_LEN : 0,
+                                                  nonce, key) != 0) {
+        credential_ui_report(ui, "Incorrect passphrase or corrupted file");
+        sodium_memzero(key, sizeof(key));
+        sodium_memzero(pass, strlen(pass));
+        g_free(pass);
+        free(m);
+        g_free(data);
+        return NULL;
+    }
+
+    char *out = g_strndup((char*)m, (gsize)mlen);
+
+    /* Migrate v1 files and files written under another profile while the passphrase is
+     * at hand; a failure here leaves the old, still valid file in place. */
+    KdfProfile want = kdf_profile();
+    if (!v2 || want.opslimit != kdf.opslimit || want.memlimit != kdf.memlimit) {
+        write_encrypted_key(ui, pass, out, &want);
+    }
+
+    sodium_memzero(key, sizeof(key));
+    sodium_memzero(m, cipherlen + 1);
+    sodium_memzero(pass, strlen(pass));
+    g_free(pass);
+    free(m);
+    g_free(data);
+    return out;
+}
+
+/* Credential backends, tried in the order given by GEMINI_CREDENTIAL_BACKENDS (default
+ * "keyring,file,plain"). The kernel keyring holds the decrypted key for the user (or,
+ * with GEMINI_KEYRING=session, the login session) so later launches and batch runs read
+ * it with keyctl instead of prompting and running the KDF. It is filled automatically
+ * after a file unlock and expires after GEMINI_KEYRING_TIMEOUT seconds (default 8 h,
+ * 0 keeps it until logout). Inspect it with: keyctl print %user:gemini-gtk:api_key;
+ * make check runs bench/check_keyring against a private session keyring. */
+#define KEYRING_DESCRIPTION "gemini-gtk:api_key"
+#define KEYRING_DEFAULT_TIMEOUT_SEC (8 * 60 * 60)
+#define KEYRING_PERM 0x3f0b0000 /* possessor: all; user: view, read, search */
+#define CREDENTIAL_MAX_BACKENDS 4
+
+static long keyring_target(void) {
+    const char *env = getenv("GEMINI_KEYRING");
+    return env && strcmp(env, "session") == 0 ? KEY_SPEC_SESSION_KEYRING : KEY_SPEC_USER_KEYRING;
+}
+
+static char *keyring_load(const GeminiCredentialUI *ui) {
+    long id = syscall(SYS_keyctl, KEYCTL_SEARCH, keyring_target(), "user", KEYRING_DESCRIPTION, 0);
+    if (id < 0) return NULL;
+    char buf[1024];
+    long n = syscall(SYS_keyctl, KEYCTL_READ, id, buf, sizeof buf);
+    char *out = NULL;
+    if (n > 0 && (size_t)n <= sizeof buf) {
+        out = g_strndup(buf, (gsize)n);
+    } else if (n > 0) {
+        char *big = g_malloc((gsize)n);
+        long m = syscall(SYS_keyctl, KEYCTL_READ, id, big, n);
+        if (m > 0 && m <= n) out = g_strndup(big, (gsize)m);
+        sodium_memzero(big, (size_t)n);
+        g_free(big);
+    }
+    sodium_memzero(buf, sizeof buf);
+    return out;
+}
+
+static gboolean keyring_store(const GeminiCredentialUI *ui, const char *api_key) {
+    long id = syscall(SYS_add_key, "user", KEYRING_DESCRIPTION, api_key, strlen(api_key), keyring_target());
+    if (id < 0) return FALSE;
+    const char *env = getenv("GEMINI_KEYRING_TIMEOUT");
+    long timeout = env && *env ? (long)g_ascii_strtoll(env, NULL, 10) : KEYRING_DEFAULT_TIMEOUT_SEC;
+    syscall(SYS_keyctl, KEYCTL_SETPERM, id, KEYRING_PERM);
+    if (timeout > 0) syscall(SYS_keyctl, KEYCTL_SET_TIMEOUT, id, timeout);
+    return TRUE;
+}
+
+static char *plain_file_load(const GeminiCredentialUI *ui) {
+    gchar *plain_path = get_api_key_plain_path();
+    gchar *content = NULL;
+    if (!g_file_get_contents(plain_path, &content, NULL, NULL)) content = NULL;
+    g_free(plain_path);
+    return content;
+}
+
+const CredentialBackend credential_backend_keyring = { "keyring", keyring_load, keyring_store, TRUE };
+const CredentialBackend credential_backend_file = { "file", read_and_decrypt_api_key, encrypt_and_store_api_key, FALSE };
+const CredentialBackend credential_backend_plain = { "plain", plain_file_load, NULL, FALSE };
+
+static const CredentialBackend *cred_backends[CREDENTIAL_MAX_BACKENDS + 1];
+
+static void credential_backends_init(void) {
+    static const CredentialBackend *const known[] = {
+        &credential_backend_keyring, &credential_backend_file, &credential_backend_plain
+    };
+    const char *env = getenv("GEMINI_CREDENTIAL_BACKENDS");
+    gchar **names = g_strsplit(env && *env ? env : "keyring,file,plain", ",", -1);
+    guint n = 0;
+    for (gchar **name = names; *name && n < CREDENTIAL_MAX_BACKENDS; name++) {
+        g_strstrip(*name);
+        for (gsize i = 0; i < G_N_ELEMENTS(known); i++) {
+            if (strcmp(*name, known[i]->name) == 0) cred_backends[n++] = known[i];
+        }
+    }
+    cred_backends[n] = NULL;
+    g_strfreev(names);
+}
+
+/* Decrypted credential cache. The key is decrypted once per session and kept in
+ * sodium_malloc'd memory that is mprotect'd NOACCESS except while being copied out.
+ * An idle timer wipes it so the passphrase is asked for again after inactivity. */
+#define CREDENTIAL_IDLE_TIMEOUT_SEC 900
+
+typedef struct {
+    GMutex lock;
+    GMutex unlock_lock; /* serialises passphrase prompts on a cache miss */
+    char *key;          /* sodium_malloc'd, NUL-terminated */
+    size_t len;
+    gint64 last_used;
+} CredentialCache;
+static CredentialCache cred_cache;
+
+static void credential_cache_clear_locked(void) {
+    if (cred_cache.key) {
+        sodium_free(cred_cache.key);
+        cred_cache.key = NULL;
+        cred_cache.len = 0;
+    }
+}
+
+void credential_cache_clear(void) {
+    g_mutex_lock(&cred_cache.lock);
+    credential_cache_clear_locked();
+    g_mutex_unlock(&cred_cache.lock);
+}
+
+static gboolean credential_cache_relock_cb(gpointer data) {
+    g_mutex_lock(&cred_cache.lock);
+    if (cred_cache.key &&
+        g_get_monotonic_time() - cred_cache.last_used >= (gint64)CREDENTIAL_IDLE_TIMEOUT_SEC * G_USEC_PER_SEC) {
+        credential_cache_clear_locked();
+    }
+    g_mutex_unlock(&cred_cache.lock);
+    return G_SOURCE_CONTINUE;
+}
+
+void credential_cache_store(const char *api_key) {
+    size_t len = strlen(api_key);
+    char *k = sodium_malloc(len + 1);
+    if (!k) return;
+    memcpy(k, api_key, len + 1);
+    sodium_mprotect_noaccess(k);
+
+    g_mutex_lock(&cred_cache.lock);
+    credential_cache_clear_locked();
+    cred_cache.key = k;
+    cred_cache.len = len;
+    cred_cache.last_used = g_get_monotonic_time();
+    g_mutex_unlock(&cred_cache.lock);
+}
+
+/* Returns a copy of the cached key (free with free_api_key) or NULL on a miss. */
+static char *credential_cache_dup(void) {
+    char *out = NULL;
+    g_mutex_lock(&cred_cache.lock);
+    if (cred_cache.key) {
+        sodium_mprotect_readonly(cred_cache.key);
+        out = g_strndup(cred_cache.key, cred_cache.len);
+        sodium_mprotect_noaccess(cred_cache.key);
+        cred_cache.last_used = g_get_monotonic_time();
+    }
+    g_mutex_unlock(&cred_cache.lock);
+    return out;
+}
+
+void credential_cache_init(void) {
+    g_mutex_init(&cred_cache.lock);
+    g_mutex_init(&cred_cache.unlock_lock);
+    credential_backends_init();
+    g_timeout_add_seconds(60, credential_cache_relock_cb, NULL);
+}
+
+void free_api_key(char *api_key) {
+    if (!api_key) return;
+    sodium_memzero(api_key, strlen(api_key));
+    g_free(api_key);
+}
+
+/* Cheap accessor for the request path: only the first call (or the first after an
+ * idle re-lock) goes to the backends. A key found by a slower backend is copied into
+ * the earlier backfill ones, so the next launch finds it in the keyring. */
+char *get_api_key(const GeminiCredentialUI *ui) {
+    char *api_key = credential_cache_dup();
+    if (api_key) return api_key;
+
+    g_mutex_lock(&cred_cache.unlock_lock);
+    api_key = credential_cache_dup();
+    for (guint i = 0; !api_key && cred_backends[i]; i++) {
+        api_key = cred_backends[i]->load(ui);
+        if (!api_key) continue;
+        for (guint j = 0; j < i; j++) {
+            if (cred_backends[j]->backfill && cred_backends[j]->store) cred_backends[j]->store(ui, api_key);
+        }
+        credential_cache_store(api_key);
+    }
+    g_mutex_unlock(&cred_cache.unlock_lock);
+    return api_key;
+}
+
+/* Persistent backends (the encrypted file) are written first; backfill ones only once
+ * one of those has taken the key, so a cancelled passphrase leaves nothing behind. */
+gboolean credential_store(const GeminiCredentialUI *ui, const char *api_key) {
+    gboolean persistent = FALSE, stored = FALSE;
+    for (guint i = 0; cred_backends[i]; i++) {
+        if (cred_backends[i]->backfill || !cred_backends[i]->store) continue;
+        persistent = TRUE;
+        if (!cred_backends[i]->store(ui, api_key)) return FALSE;
+        stored = TRUE;
+    }
+    for (guint i = 0; cred_backends[i]; i++) {
+        if (cred_backends[i]->backfill && cred_backends[i]->store && cred_backends[i]->store(ui, api_key)) stored = TRUE;
+    }
+    if (!persistent && !stored) {
+        credential_ui_report(ui, "No credential backend could store the key (GEMINI_CREDENTIAL_BACKENDS)");
+        return FALSE;
+    }
+    credential_cache_store(api_key);
+    return TRUE;
+}
+
+/* Conversation log. Turns are appended to history.log as length-prefixed records and
+ * their offsets to history.idx; both are mmap'd on open so startup never parses the
+ * log. Records may be sealed with XChaCha20-Poly1305 (header bound as AD) once a key
+ * is set. A torn tail from a crash is cut off on open. Each record carries its role
+ * and the chat backend (LOG_BACKEND_*) the turn was exchanged with. */
+static const char *LOG_MAGIC = "GEMINILOG1";
+
+#define LOG_FLAG_ENCRYPTED 0x01
+#define LOG_FLAG_HISTORY_KEY 0x02 /* sealed with the history.key key, not the legacy one */
+
+typedef struct {
+    guint32 len;    /* payload bytes following the header */
+    guint8 flags;
+    guint8 role;
+    guint8 backend;   /* LOG_BACKEND_*; 0 in records written before it existed */
+    guint8 reserved;
+    gint64 timestamp; /* g_get_real_time() */
+} LogRecordHeader;
+
+typedef struct {
+    GMutex lock;
+    int fd;
+    int idx_fd;
+    GMappedFile *map;     /* history.log, remapped when reading past its end */
+    GMappedFile *idx_map; /* history.idx as of open */
+    gsize idx_mapped;     /* offsets available from idx_map */
+    GArray *idx_tail;     /* guint64 offsets appended since open */
+    gsize log_end;
+    unsigned char key[crypto_aead_xchacha20poly1305_ietf_KEYBYTES];
+    gboolean have_key;
+    unsigned char legacy_key[crypto_aead_xchacha20poly1305_ietf_KEYBYTES];
+    gboolean have_legacy_key;
+    gboolean legacy_sealed; /* the log holds records sealed with the legacy key */
+} ConversationLog;
+static ConversationLog conv_log = { .fd = -1, .idx_fd = -1 };
+
+static gchar *get_history_path(const char *name) {
+    const gchar *config_dir = g_get_user_config_dir();
+    return g_build_filename(config_dir, "gemini-gtk", name, NULL);
+}
+
+static gsize conversation_log_count_locked(void) {
+    return conv_log.idx_mapped + conv_log.idx_tail->len;
+}
+
+static guint64 conversation_log_offset_locked(gsize i) {
+    if (i < conv_log.idx_mapped) {
+        guint64 off;
+        memcpy(&off, g_mapped_file_get_contents(conv_log.idx_map) + i * sizeof(guint64), sizeof(off));
+        return off;
+    }
+    return g_array_index(conv_log.idx_tail, guint64, i - conv_log.idx_mapped);
+}
+
+static gboolean conversation_log_write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return FALSE;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return TRUE;
+}
+
+/* Walk records from off, indexing each complete one; returns the end of the last. */
+static gsize conversation_log_scan(const char *data, gsize size, gsize off) {
+    while (off + sizeof(LogRecordHeader) <= size) {
+        LogRecordHeader h;
+        memcpy(&h, data + off, sizeof(h));
+        if (h.len > size - off - sizeof(h)) break;
+        guint64 rec = off;
+        if ((h.flags & (LOG_FLAG_ENCRYPTED | LOG_FLAG_HISTORY_KEY)) == LOG_FLAG_ENCRYPTED) conv_log.legacy_sealed = TRUE;
+        g_array_append_val(conv_log.idx_tail, rec);
+        conversation_log_write_all(conv_log.idx_fd, &rec, sizeof(rec));
+        off += sizeof(h) + h.len;
+    }
+    return off;
+}
+
+void conversation_log_open(void) {
+    gchar *log_path = get_history_path("history.log");
+    gchar *idx_path = get_history_path("history.idx");
+    gchar *dir = g_path_get_dirname(log_path);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+
+    g_mutex_init(&conv_log.lock);
+    conv_log.idx_tail = g_array_new(FALSE, FALSE, sizeof(guint64));
+    conv_log.fd = open(log_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    conv_log.idx_fd = open(idx_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (conv_log.fd < 0 || conv_log.idx_fd < 0) {
+        g_warning("Failed to open conversation log: %s", g_strerror(errno));
+        goto out;
+    }
+
+    struct stat st;
+    size_t magic_len = strlen(LOG_MAGIC);
+    if (fstat(conv_log.fd, &st) == 0 && st.st_size == 0) {
+        conversation_log_write_all(conv_log.fd, LOG_MAGIC, magic_len);
+        if (ftruncate(conv_log.idx_fd, 0) != 0) g_warning("Failed to reset history index");
+    }
+
+    conv_log.map = g_mapped_file_new(log_path, FALSE, NULL);
+    const char *data = conv_log.map ? g_mapped_file_get_contents(conv_log.map) : NULL;
+    gsize size = conv_log.map ? g_mapped_file_get_length(conv_log.map) : 0;
+    if (size < magic_len || memcmp(data, LOG_MAGIC, magic_len) != 0) {
+        g_warning("Conversation log %s is not a history file; history disabled", log_path);
+        close(conv_log.fd);
+        conv_log.fd = -1;
+        goto out;
+    }
+
+    /* Trust the index up to the first entry that doesn't fit the log, then rescan. */
+    conv_log.idx_map = g_mapped_file_new(idx_path, FALSE, NULL);
+    gsize entries = conv_log.idx_map ? g_mapped_file_get_length(conv_log.idx_map) / sizeof(guint64) : 0;
+    gsize end = magic_len;
+    for (gsize i = 0; i < entries; i++) {
+        guint64 off;
+        LogRecordHeader h;
+        memcpy(&off, g_mapped_file_get_contents(conv_log.idx_map) + i * sizeof(guint64), sizeof(off));
+        if (off != end || off + sizeof(h) > size) break;
+        memcpy(&h, data + off, sizeof(h));
+        if (h.len > size - off - sizeof(h)) break;
+        if ((h.flags & (LOG_FLAG_ENCRYPTED | LOG_FLAG_HISTORY_KEY)) == LOG_FLAG_ENCRYPTED) conv_log.legacy_sealed = TRUE;
+        end = off + sizeof(h) + h.len;
+        conv_log.idx_mapped = i + 1;
+    }
+    if (conv_log.idx_mapped < entries &&
+        ftruncate(conv_log.idx_fd, (off_t)(conv_log.idx_mapped * sizeof(guint64))) != 0) {
+        g_warning("Failed to trim history index");
+    }
+    end = conversation_log_scan(data, size, end);
+    if (end < size) {
+        if (ftruncate(conv_log.fd, (off_t)end) != 0) g_warning("Failed to trim torn history record");
+        g_mapped_file_unref(conv_log.map);
+        conv_log.map = NULL; /* remapped on the next read */
+    }
+    conv_log.log_end = end;
+
+out:
+    g_free(log_path);
+    g_free(idx_path);
+}
+
+/* Records written before history.key existed were sealed with a key hashed from the API
+ * key. They are still read with it when history_unlock is given that key. */
+static void conversation_log_set_legacy_key_locked(const char *api_key) {
+    crypto_generichash_state st;
+    static const char context[] = "gemini-gtk history key v1";
+    crypto_generichash_init(&st, NULL, 0, sizeof(conv_log.legacy_key));
+    crypto_generichash_update(&st, (const unsigned char*)context, sizeof(context));
+    crypto_generichash_update(&st, (const unsigned char*)api_key, strlen(api_key));
+    crypto_generichash_final(&st, conv_log.legacy_key, sizeof(conv_log.legacy_key));
+    conv_log.have_legacy_key = TRUE;
+    sodium_memzero(&st, sizeof(st));
+}
+
+gboolean conversation_log_append(int role, int backend, const char *text) {
+    size_t tlen = strlen(text);
+    gboolean ok = FALSE;
+    g_mutex_lock(&conv_log.lock);
+    if (conv_log.fd < 0) goto out;
+
+    gboolean seal = conv_log.have_key;
+    size_t plen = seal ? crypto_aead_xchacha20poly1305_ietf_NPUBBYTES + tlen + crypto_aead_xchacha20poly1305_ietf_ABYTES : tlen;
+    if (plen > G_MAXUINT32) goto out;
+    LogRecordHeader h = { .len = (guint32)plen, .flags = seal ? LOG_FLAG_ENCRYPTED | LOG_FLAG_HISTORY_KEY : 0,
+                          .role = (guint8)role, .backend = (guint8)backend, .timestamp = g_get_real_time() };
+    unsigned char *rec = g_malloc(sizeof(h) + plen);
+    memcpy(rec, &h, sizeof(h));
+    unsigned char *payload = rec + sizeof(h);
+    if (seal) {
+        unsigned char *nonce = payload;
+        randombytes_buf(nonce, crypto_aead_xchacha20poly1305_ietf_NPUBBYTES);
+        crypto_aead_xchacha20poly1305_ietf_encrypt(nonce + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES, NULL,
+                                                   (const unsigned char*)text, tlen,
+                                                   rec, sizeof(h), NULL, nonce, conv_log.key);
+    } else {
+        memcpy(payload, text, tlen);
+    }
+
+    guint64 off = conv_log.log_end;
+    if (conversation_log_write_all(conv_log.fd, rec, sizeof(h) + plen)) {
+        conversation_log_write_all(conv_log.idx_fd, &off, sizeof(off));
+        g_array_append_val(conv_log.idx_tail, off);
+        conv_log.log_end += sizeof(h) + plen;
+        ok = TRUE;
+    }
+    g_free(rec);
+out:
+    g_mutex_unlock(&conv_log.lock);
+    return ok;
+}
+
+gsize conversation_log_count(void) {
+    g_mutex_lock(&conv_log.lock);
+    gsize n = conv_log.idx_tail ? conversation_log_count_locked() : 0;
+    g_mutex_unlock(&conv_log.lock);
+    return n;
+}
+
+/* Read record i; returns a newly allocated string, or NULL if it can't be read
+ * (including sealed records when no key is set). */
+char *conversation_log_read(gsize i, int *role, int *backend, gint64 *timestamp) {
+    char *out = NULL;
+    g_mutex_lock(&conv_log.lock);
+    if (conv_log.fd < 0 || i >= conversation_log_count_locked()) goto out;
+    guint64 off = conversation_log_offset_locked(i);
+    if (!conv_log.map || off + sizeof(LogRecordHeader) > g_mapped_file_get_length(conv_log.map)) {
+        gchar *log_path = get_history_path("history.log");
+        if (conv_log.map) g_mapped_file_unref(conv_log.map);
+        conv_log.map = g_mapped_file_new(log_path, FALSE, NULL);
+        g_free(log_path);
+        if (!conv_log.map) goto out;
+    }
+    const char *data = g_mapped_file_get_contents(conv_log.map);
+    gsize size = g_mapped_file_get_length(conv_log.map);
+    LogRecordHeader h;
+    if (off + sizeof(h) > size) goto out;
+    memcpy(&h, data + off, sizeof(h));
+    if (h.len > size - off - sizeof(h)) goto out;
+    const unsigned char *payload = (const unsigned char*)data + off + sizeof(h);
+
+    if (h.flags & LOG_FLAG_ENCRYPTED) {
+        size_t overhead = crypto_aead_xchacha20poly1305_ietf_NPUBBYTES + crypto_aead_xchacha20poly1305_ietf_ABYTES;
+        gboolean current = (h.flags & LOG_FLAG_HISTORY_KEY) != 0;
+        if (!(current ? conv_log.have_key : conv_log.have_legacy_key) || h.len < overhead) goto out;
+        unsigned long long mlen = 0;
+        out = g_malloc(h.len - overhead + 1);
+        if (crypto_aead_xchacha20poly1305_ietf_decrypt((unsigned char*)out, &mlen, NULL,
+                                                       payload + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES,
+                                                       h.len - crypto_aead_xchacha20poly1305_ietf_NPUBBYTES,
+                                                       (const unsigned char*)data + off, sizeof(h),
+                                                       payload, current ? conv_log.key : conv_log.legacy_key) != 0) {
+            g_free(out);
+            out = NULL;
+            goto out;
+        }
+        out[mlen] = '\0';
+    } else {
+        out = g_strndup((const char*)payload, h.len);
+    }
+    if (role) *role = h.role;
+    if (backend) *backend = h.backend;
+    if (timestamp) *timestamp = h.timestamp;
+out:
+    g_mutex_unlock(&conv_log.lock);
+    return out;
+}
+
+/* The history key is a random key of its own, kept in history.key wrapped under a
+ * passphrase in the api_key.enc v2 format (own salt, Argon2id, header as AD), so it
+ * survives rotating or dropping the API key. */
+static gboolean history_key_unwrap(const GeminiCredentialUI *ui, const char *path, const char *data, gsize length,
+                                   const char *pass, unsigned char *out) {
+    size_t magic_len = strlen(MAGIC_V2);
+    size_t header_len = KDF_HEADER_LEN + crypto_pwhash_SALTBYTES + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
+    KdfProfile kdf;
+    if (length != header_len + crypto_aead_xchacha20poly1305_ietf_KEYBYTES + crypto_aead_xchacha20poly1305_ietf_ABYTES ||
+        memcmp(data, MAGIC_V2, magic_len) != 0 || !kdf_header_read((const unsigned char*)data, &kdf)) {
+        credential_ui_report(ui, "History key file is corrupted or uses unsupported parameters");
+        return FALSE;
+    }
+    const unsigned char *salt = (const unsigned char*)data + KDF_HEADER_LEN;
+    const unsigned char *nonce = salt + crypto_pwhash_SALTBYTES;
+    unsigned char key[crypto_aead_xchacha20poly1305_ietf_KEYBYTES];
+    if (!kdf_derive(key, sizeof key, pass, salt, &kdf)) {
+        credential_ui_report(ui, "Error deriving key from passphrase");
+        return FALSE;
+    }
+    gboolean ok = crypto_aead_xchacha20poly1305_ietf_decrypt(out, NULL, NULL,
+                                                             (const unsigned char*)data + header_len, length - header_len,
+                                                             (const unsigned char*)data, KDF_HEADER_LEN,
+                                                             nonce, key) == 0;
+    sodium_memzero(key, sizeof(key));
+    if (!ok) {
+        credential_ui_report(ui, "Incorrect passphrase or corrupted history key file");
+        return FALSE;
+    }
+    KdfProfile want = kdf_profile();
+    if (want.opslimit != kdf.opslimit || want.memlimit != kdf.memlimit) {
+        kdf_seal_file(ui, path, pass, out, crypto_aead_xchacha20poly1305_ietf_KEYBYTES, &want);
+    }
+    return TRUE;
+}
+
+/* Records are sealed only when GEMINI_HISTORY_ENCRYPT=1. The first unlock creates
+ * history.key (asking for a new passphrase); later ones unwrap it. legacy_api_key, if
+ * given, lets records sealed before history.key existed be read; new records never use it. */
+gboolean history_unlock(const GeminiCredentialUI *ui, const char *legacy_api_key) {
+    const char *encrypt_env = getenv("GEMINI_HISTORY_ENCRYPT");
+    if (!encrypt_env || strcmp(encrypt_env, "1") != 0) return TRUE;
+
+    gchar *path = get_history_path("history.key");
+    gboolean exists = g_file_test(path, G_FILE_TEST_EXISTS);
+    char *pass = credential_ui_passphrase(ui, "the chat history", !exists);
+    unsigned char key[crypto_aead_xchacha20poly1305_ietf_KEYBYTES];
+    gboolean ok = FALSE;
+    if (pass && exists) {
+        char *data = NULL;
+        gsize length = 0;
+        GError *error = NULL;
+        if (g_file_get_contents(path, &data, &length, &error)) {
+            ok = history_key_unwrap(ui, path, data, length, pass, key);
+            g_free(data);
+        } else {
+            credential_ui_report(ui, "Failed to read history key: %s", error->message);
+            g_error_free(error);
+        }
+    } else if (pass) {
+        randombytes_buf(key, sizeof key);
+        KdfProfile kdf = kdf_profile();
+        ok = kdf_seal_file(ui, path, pass, key, sizeof key, &kdf);
+    }
+    if (pass) {
+        sodium_memzero(pass, strlen(pass));
+        g_free(pass);
+    }
+    g_free(path);
+
+    g_mutex_lock(&conv_log.lock);
+    if (ok) {
+        memcpy(conv_log.key, key, sizeof(key));
+        conv_log.have_key = TRUE;
+    }
+    if (ok && legacy_api_key) conversation_log_set_legacy_key_locked(legacy_api_key);
+    g_mutex_unlock(&conv_log.lock);
+    sodium_memzero(key, sizeof(key));
+    return ok;
+}
+
+/* Whether restoring history needs the API key for records sealed before history.key. */
+gboolean history_has_legacy_records(void) {
+    g_mutex_lock(&conv_log.lock);
+    gboolean legacy = conv_log.legacy_sealed;
+    g_mutex_unlock(&conv_log.lock);
+    return legacy;
+}
+
+void conversation_log_close(void) {
+    g_mutex_lock(&conv_log.lock);
+    if (conv_log.fd >= 0) close(conv_log.fd);
+    if (conv_log.idx_fd >= 0) close(conv_log.idx_fd);
+    conv_log.fd = conv_log.idx_fd = -1;
+    if (conv_log.map) g_mapped_file_unref(conv_log.map);
+    if (conv_log.idx_map) g_mapped_file_unref(conv_log.idx_map);
+    conv_log.map = conv_log.idx_map = NULL;
+    sodium_memzero(conv_log.key, sizeof(conv_log.key));
+    sodium_memzero(conv_log.legacy_key, sizeof(conv_log.legacy_key));
+    conv_log.have_key = conv_log.have_legacy_key = FALSE;
+    g_mutex_unlock(&conv_log.lock);
+}
+
+/* Multi-turn context for generateContent-style requests. Each turn is serialized to
+ * its JSON fragment once, when it is added, and kept in a comma-joined prefix string,
+ * so building a request costs O(new turn) serialization plus one copy of the prefix.
+ * Before each send the oldest turns are dropped until the estimated token count fits
+ * the window (GEMINI_CONTEXT_TOKENS) minus the prompt and the output budget. */
+#define CONTEXT_DEFAULT_TOKENS 8192
+#define REQUEST_MAX_OUTPUT_TOKENS 512
+#define REQUEST_TEMPERATURE 0.2
+
+typedef struct { gsize tokens; gsize frag_len; int role; } ContextTurn;
+
+typedef struct {
+    GMutex lock;
+    GQueue turns;       /* ContextTurn*, oldest first */
+    GString *prefix;    /* fragments of the queued turns, comma-joined */
+    gsize prefix_start; /* bytes at the front of prefix that belong to dropped turns */
+    gsize tokens;
+    gsize window;
+} ConversationContext;
+static ConversationContext conv_context;
+
+/* Rough count: about four bytes of UTF-8 per token, plus per-turn framing. */
+static gsize context_estimate_tokens(const char *text) {
+    return strlen(text) / 4 + 4;
+}
+
+static void context_append_turn(GString *out, int role, const char *text) {
+    g_string_append(out, role == LOG_ROLE_USER ? "{\"role\":\"user\",\"parts\":[{\"text\":"
+                                               : "{\"role\":\"model\",\"parts\":[{\"text\":");
+    json_append_string(out, text, strlen(text));
+    g_string_append(out, "}]}");
+}
+
+void context_init(void) {
+    g_mutex_init(&conv_context.lock);
+    g_queue_init(&conv_context.turns);
+    conv_context.prefix = g_string_new(NULL);
+    const char *env = getenv("GEMINI_CONTEXT_TOKENS");
+    gint64 window = env ? g_ascii_strtoll(env, NULL, 10) : 0;
+    conv_context.window = window > 0 ? (gsize)window : CONTEXT_DEFAULT_TOKENS;
+}
+
+void context_add_turn(int role, const char *text) {
+    ContextTurn *t = g_new0(ContextTurn, 1);
+    t->tokens = context_estimate_tokens(text);
+    t->role = role;
+    g_mutex_lock(&conv_context.lock);
+    if (!g_queue_is_empty(&conv_context.turns)) g_string_append_c(conv_context.prefix, ',');
+    gsize before = conv_context.prefix->len;
+    context_append_turn(conv_context.prefix, role, text);
+    t->frag_len = conv_context.prefix->len - before;
+    g_queue_push_tail(&conv_context.turns, t);
+    conv_context.tokens += t->tokens;
+    g_mutex_unlock(&conv_context.lock);
+}
+
+/* Drop turns from the front until the rest fits the budget, then any model turns left at
+ * the head: contents has to open with a user turn, so a reply never outlives its prompt. */
+static void context_trim_locked(gsize budget) {
+    ContextTurn *t;
+    while ((t = g_queue_peek_head(&conv_context.turns)) && (conv_context.tokens > budget || t->role != LOG_ROLE_USER)) {
+        g_queue_pop_head(&conv_context.turns);
+        conv_context.tokens -= t->tokens;
+        conv_context.prefix_start += t->frag_len;
+        if (!g_queue_is_empty(&conv_context.turns)) conv_context.prefix_start++; /* comma */
+        g_free(t);
+    }
+    if (g_queue_is_empty(&conv_context.turns)) {
+        g_string_truncate(conv_context.prefix, 0);
+        conv_context.prefix_start = 0;
+    } else if (conv_context.prefix_start > conv_context.prefix->len / 2) {
+        g_string_erase(conv_context.prefix, 0, (gssize)conv_context.prefix_start);
+        conv_context.prefix_start = 0;
+    }
+}
+
+/* Write a request body into body (reset first) with as much history as fits, followed
+ * by message as the new user turn. */
+void context_build_payload(GString *body, const char *message) {
+    gsize reserve = context_estimate_tokens(message) + REQUEST_MAX_OUTPUT_TOKENS;
+    g_string_truncate(body, 0);
+    g_string_append(body, "{\"contents\":[");
+    g_mutex_lock(&conv_context.lock);
+    context_trim_locked(conv_context.window > reserve ? conv_context.window - reserve : 0);
+    gsize prefix_len = conv_context.prefix->len - conv_context.prefix_start;
+    g_string_append_len(body, conv_context.prefix->str + conv_context.prefix_start, (gssize)prefix_len);
+    g_mutex_unlock(&conv_context.lock);
+    if (prefix_len > 0) g_string_append_c(body, ',');
+    context_append_turn(body, LOG_ROLE_USER, message);
+    g_string_append_printf(body, "],\"generationConfig\":{\"maxOutputTokens\":%d,\"temperature\":", REQUEST_MAX_OUTPUT_TOKENS);
+    json_append_double(body, REQUEST_TEMPERATURE);
+    g_string_append(body, "}}");
+}
+
+/* Attach a request body and charge its estimated cost (prompt plus the output
+ * allowance) against the TPM budget. */
+void net_request_set_body(NetRequest *req, const char *body, gsize len) {
+    req->tokens = len / 4 + REQUEST_MAX_OUTPUT_TOKENS;
+    curl_easy_setopt(req->curl, CURLOPT_POSTFIELDSIZE, (long)len);
+    curl_easy_setopt(req->curl, CURLOPT_COPYPOSTFIELDS, body);
+}
+
+/* Legacy :generate body: a single prompt.text with top-level parameters. */
+void build_legacy_payload(GString *body, const char *message) {
+    g_string_truncate(body, 0);
+    g_string_append(body, "{\"prompt\":{\"text\":");
+    json_append_string(body, message, strlen(message));
+    g_string_append_printf(body, "},\"maxOutputTokens\":%d,\"temperature\":", REQUEST_MAX_OUTPUT_TOKENS);
+    json_append_double(body, REQUEST_TEMPERATURE);
+    g_string_append_c(body, '}');
+}
+
+/* Response cache. Replies to identical requests are served locally: the key is a
+ * BLAKE2b hash of the endpoint (scheme, host and path; the query holding the API key is
+ * left out) and the exact request body, which carries the model parameters, the prompt
+ * and whatever history went with it. A small in-memory LRU sits in front of one file
+ * per entry under the user cache dir. GEMINI_CACHE_TTL sets the lifetime in seconds (0
+ * turns caching off) and GEMINI_CACHE_MAX_MB bounds the disk store. With
+ * GEMINI_HISTORY_ENCRYPT=1 nothing is written to disk. */
+#define RESPONSE_CACHE_DEFAULT_TTL_SEC (24 * 60 * 60)
+#define RESPONSE_CACHE_DEFAULT_MAX_MB 64
+#define RESPONSE_CACHE_MEM_ENTRIES 128
+#define RESPONSE_CACHE_MEM_BYTES (4 * 1024 * 1024)
+static const char *RESPONSE_CACHE_MAGIC = "GEMINIRC1";
+
+typedef struct {
+    guint8 key[RESPONSE_CACHE_KEY_BYTES];
+    gint64 stored; /* wall-clock seconds */
+    gchar *text;
+    gsize len;
+    GList link;    /* in ResponseCache.lru, most recent first */
+} CachedResponse;
+
+typedef struct {
+    GMutex lock;
+    GHashTable *entries; /* key -> CachedResponse */
+    GQueue lru;
+    gsize mem_bytes;
+    gchar *dir;          /* NULL when the disk tier is off */
+    gint64 ttl;          /* 0 when caching is off */
+    goffset disk_bytes;
+    goffset disk_max;
+} ResponseCache;
+static ResponseCache resp_cache;
+
+static guint response_cache_hash(gconstpointer key) {
+    guint h;
+    memcpy(&h, key, sizeof(h));
+    return h;
+}
+
+static gboolean response_cache_equal(gconstpointer a, gconstpointer b) {
+    return memcmp(a, b, RESPONSE_CACHE_KEY_BYTES) == 0;
+}
+
+static void cached_response_free(gpointer data) {
+    CachedResponse *e = (CachedResponse*)data;
+    g_free(e->text);
+    g_free(e);
+}
+
+void response_cache_key(guint8 key[RESPONSE_CACHE_KEY_BYTES], const char *url, const char *body, gsize body_len) {
+    crypto_generichash_state st;
+    const char *query = strchr(url, '?');
+    guint64 url_len = query ? (guint64)(query - url) : strlen(url);
+    guint64 len = body_len;
+    crypto_generichash_init(&st, NULL, 0, RESPONSE_CACHE_KEY_BYTES);
+    crypto_generichash_update(&st, (const unsigned char*)&url_len, sizeof(url_len));
+    crypto_generichash_update(&st, (const unsigned char*)url, url_len);
+    crypto_generichash_update(&st, (const unsigned char*)&len, sizeof(len));
+    crypto_generichash_update(&st, (const unsigned char*)body, body_len);
+    crypto_generichash_final(&st, key, RESPONSE_CACHE_KEY_BYTES);
+}
+
+static gchar *response_cache_file(const guint8 key[RESPONSE_CACHE_KEY_BYTES]) {
+    char hex[RESPONSE_CACHE_KEY_BYTES * 2 + 1];
+    sodium_bin2hex(hex, sizeof(hex), key, RESPONSE_CACHE_KEY_BYTES);
+    return g_build_filename(resp_cache.dir, hex, NULL);
+}
+
+typedef struct { gchar *path; gint64 mtime; goffset size; } CacheFileInfo;
+
+static gint cache_file_info_cmp(gconstpointer a, gconstpointer b) {
+    const CacheFileInfo *x = (const CacheFileInfo*)a, *y = (const CacheFileInfo*)b;
+    return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+/* Drop expired files and, if the store is over target bytes, the oldest of the rest.
+ * Returns the bytes left on disk. */
+static goffset response_cache_prune_disk(const char *dir, gint64 ttl, goffset target) {
+    GDir *d = g_dir_open(dir, 0, NULL);
+    if (!d) return 0;
+    GArray *files = g_array_new(FALSE, FALSE, sizeof(CacheFileInfo));
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+    goffset total = 0;
+    const gchar *name;
+    while ((name = g_dir_read_name(d))) {
+        CacheFileInfo fi = { g_build_filename(dir, name, NULL), 0, 0 };
+        struct stat st;
+        if (stat(fi.path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            g_free(fi.path);
+            continue;
+        }
+        if (now - (gint64)st.st_mtime > ttl) {
+            unlink(fi.path);
+            g_free(fi.path);
+            continue;
+        }
+        fi.mtime = (gint64)st.st_mtime;
+        fi.size = (goffset)st.st_size;
+        total += fi.size;
+        g_array_append_val(files, fi);
+    }
+    g_dir_close(d);
+    g_array_sort(files, cache_file_info_cmp);
+    for (guint i = 0; i < files->len; i++) {
+        CacheFileInfo *fi = &g_array_index(files, CacheFileInfo, i);
+        if (total > target && unlink(fi->path) == 0) total -= fi->size;
+        g_free(fi->path);
+    }
+    g_array_free(files, TRUE);
+    return total;
+}
+
+void response_cache_init(void) {
+    const char *ttl_env = getenv("GEMINI_CACHE_TTL");
+    const char *max_env = getenv("GEMINI_CACHE_MAX_MB");
+    const char *encrypt_env = getenv("GEMINI_HISTORY_ENCRYPT");
+    g_mutex_init(&resp_cache.lock);
+    g_queue_init(&resp_cache.lru);
+    resp_cache.entries = g_hash_table_new_full(response_cache_hash, response_cache_equal, NULL, cached_response_free);
+    resp_cache.ttl = ttl_env && *ttl_env ? g_ascii_strtoll(ttl_env, NULL, 10) : RESPONSE_CACHE_DEFAULT_TTL_SEC;
+    if (resp_cache.ttl < 0) resp_cache.ttl = 0;
+    gint64 max_mb = max_env && *max_env ? g_ascii_strtoll(max_env, NULL, 10) : RESPONSE_CACHE_DEFAULT_MAX_MB;
+    resp_cache.disk_max = (goffset)MAX(max_mb, 0) * 1024 * 1024;
+    if (resp_cache.ttl == 0 || resp_cache.disk_max == 0 || (encrypt_env && strcmp(encrypt_env, "1") == 0)) return;
+
+    gchar *dir = g_build_filename(g_get_user_cache_dir(), "gemini-gtk", "responses", NULL);
+    if (g_mkdir_with_parents(dir, 0700) != 0) {
+        g_warning("Response cache disabled on disk: cannot create %s", dir);
+        g_free(dir);
+        return;
+    }
+    resp_cache.dir = dir;
+    resp_cache.disk_bytes = response_cache_prune_disk(dir, resp_cache.ttl, resp_cache.disk_max);
+}
+
+static void response_cache_evict_locked(CachedResponse *e) {
+    g_queue_unlink(&resp_cache.lru, &e->link);
+    resp_cache.mem_bytes -= e->len;
+    g_hash_table_remove(resp_cache.entries, e->key);
+}
+
+static void response_cache_insert_locked(const guint8 key[RESPONSE_CACHE_KEY_BYTES], gint64 stored, const char *text, gsize len) {
+    CachedResponse *old = g_hash_table_lookup(resp_cache.entries, key);
+    if (old) response_cache_evict_locked(old);
+    if (len > RESPONSE_CACHE_MEM_BYTES) return;
+    CachedResponse *e = g_new0(CachedResponse, 1);
+    memcpy(e->key, key, RESPONSE_CACHE_KEY_BYTES);
+    e->stored = stored;
+    e->text = g_strndup(text, len);
+    e->len = len;
+    e->link.data = e;
+    g_queue_push_head_link(&resp_cache.lru, &e->link);
+    g_hash_table_insert(resp_cache.entries, e->key, e);
+    resp_cache.mem_bytes += len;
+    while (resp_cache.lru.length > RESPONSE_CACHE_MEM_ENTRIES || resp_cache.mem_bytes > RESPONSE_CACHE_MEM_BYTES) {
+        response_cache_evict_locked((CachedResponse*)g_queue_peek_tail(&resp_cache.lru));
+    }
+}
+
+/* Returns a copy of the cached reply (and its age in seconds), or NULL on a miss. */
+gchar *response_cache_lookup(const guint8 key[RESPONSE_CACHE_KEY_BYTES], gint64 *age) {
+    if (resp_cache.ttl == 0) return NULL;
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+    gchar *out = NULL;
+    g_mutex_lock(&resp_cache.lock);
+    CachedResponse *e = g_hash_table_lookup(resp_cache.entries, key);
+    if (e && now - e->stored > resp_cache.ttl) {
+        response_cache_evict_locked(e);
+        e = NULL;
+    }
+    if (e) {
+        g_queue_unlink(&resp_cache.lru, &e->link);
+        g_queue_push_head_link(&resp_cache.lru, &e->link);
+        out = g_strndup(e->text, e->len);
+        *age = now - e->stored;
+    }
+    g_mutex_unlock(&resp_cache.lock);
+    if (out || !resp_cache.dir) return out;
+
+    /* Second tier: one file per key, MAGIC | stored (gint64) | text. */
+    gchar *path = response_cache_file(key);
+    gchar *content = NULL;
+    gsize len = 0;
+    gsize hdr = strlen(RESPONSE_CACHE_MAGIC) + sizeof(gint64);
+    if (g_file_get_contents(path, &content, &len, NULL) && len >= hdr &&
+        memcmp(content, RESPONSE_CACHE_MAGIC, strlen(RESPONSE_CACHE_MAGIC)) == 0) {
+        gint64 stored;
+        memcpy(&stored, content + strlen(RESPONSE_CACHE_MAGIC), sizeof(stored));
+        if (now - stored <= resp_cache.ttl) {
+            out = g_strndup(content + hdr, len - hdr);
+            *age = now - stored;
+            g_mutex_lock(&resp_cache.lock);
+            response_cache_insert_locked(key, stored, out, len - hdr);
+            g_mutex_unlock(&resp_cache.lock);
+        } else {
+            unlink(path);
+        }
+    }
+    g_free(content);
+    g_free(path);
+    return out;
+}
+
+/* Remember a successful reply; called from the network worker. */
+void response_cache_store(const guint8 key[RESPONSE_CACHE_KEY_BYTES], const char *text, gsize len) {
+    if (resp_cache.ttl == 0 || len == 0) return;
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+    g_mutex_lock(&resp_cache.lock);
+    response_cache_insert_locked(key, now, text, len);
+    g_mutex_unlock(&resp_cache.lock);
+    if (!resp_cache.dir) return;
+
+    gsize hdr = strlen(RESPONSE_CACHE_MAGIC) + sizeof(gint64);
+    if ((goffset)(hdr + len) > resp_cache.disk_max) return;
+    gchar *buf = g_malloc(hdr + len);
+    memcpy(buf, RESPONSE_CACHE_MAGIC, strlen(RESPONSE_CACHE_MAGIC));
+    memcpy(buf + strlen(RESPONSE_CACHE_MAGIC), &now, sizeof(now));
+    memcpy(buf + hdr, text, len);
+    gchar *path = response_cache_file(key);
+    if (g_file_set_contents(path, buf, (gssize)(hdr + len), NULL)) {
+        g_mutex_lock(&resp_cache.lock);
+        resp_cache.disk_bytes += (goffset)(hdr + len);
+        gboolean prune = resp_cache.disk_bytes > resp_cache.disk_max;
+        g_mutex_unlock(&resp_cache.lock);
+        if (prune) {
+            goffset left = response_cache_prune_disk(resp_cache.dir, resp_cache.ttl, resp_cache.disk_max * 3 / 4);
+            g_mutex_lock(&resp_cache.lock);
+            resp_cache.disk_bytes = left;
+            g_mutex_unlock(&resp_cache.lock);
+        }
+    }
+    g_free(path);
+    g_free(buf);
+}
+
+void response_cache_clear(void) {
+    g_mutex_lock(&resp_cache.lock);
+    if (resp_cache.entries) g_hash_table_destroy(resp_cache.entries);
+    resp_cache.entries = NULL;
+    g_queue_init(&resp_cache.lru);
+    resp_cache.mem_bytes = 0;
+    resp_cache.ttl = 0;
+    g_mutex_unlock(&resp_cache.lock);
+    g_free(resp_cache.dir);
+    resp_cache.dir = NULL;
+}
+
+/* Streaming mode: each SSE event is a GenerateContentResponse carrying the next slice
+ * of candidates[0].content.parts[].text, which goes straight into chat_view. */
+static const char *DEFAULT_STREAM_ENDPOINT = "https://generativelanguage.googleapis.com/v1beta/models/gemini-1.5-flash:streamGenerateContent";
+
+gchar *make_stream_url(const char *url) {
+    const char *query = strchr(url, '?');
+    gsize base_len = query ? (gsize)(query - url) : strlen(url);
+    gchar *base = g_strndup(url, base_len);
+    gchar *stream_base;
+    if (g_str_has_suffix(base, ":streamGenerateContent")) {
+        stream_base = g_strdup(base);
+    } else if (g_str_has_suffix(base, ":generateContent")) {
+        stream_base = g_strdup_printf("%.*s:streamGenerateContent", (int)(base_len - strlen(":generateContent")), base);
+    } else {
+        /* Legacy :generate endpoints have no streaming variant. */
+        stream_base = g_strdup(DEFAULT_STREAM_ENDPOINT);
+    }
+    gchar *out = g_strdup_printf("%s?alt=sse%s%s", stream_base, query ? "&" : "", query ? query + 1 : "");
+    g_free(stream_base);
+    g_free(base);
+    return out;
+}
+
+/* Request URL and headers for the configured endpoint. The first GEMINI_ENDPOINT entry
+ * is used as-is (the network worker moves failover requests to the others); otherwise
+ * the default endpoint gets the key as a query parameter, or an Authorization header
+ * for non-API-key credentials. */
+gchar *gemini_build_request(const char *api_key, struct curl_slist **headers) {
+    gchar **endpoints = net_endpoint_list();
+    const char *env_endpoint = endpoints[0];
+    gchar *request_url = NULL;
+
+    if (env_endpoint && strlen(env_endpoint) > 0) {
+        /* Use the user-provided endpoint as-is. Prefer Authorization header for non-API-key credentials. */
+        request_url = g_strdup(env_endpoint);
+        if (api_key && strncmp(api_key, "AIza", 4) != 0) {
+            gchar *auth = g_strdup_printf("Authorization: Bearer %s", api_key);
+            *headers = curl_slist_append(*headers, "Content-Type: application/json");
+            *headers = curl_slist_append(*headers, auth);
+            g_free(auth);
+        } else {
+            /* API key: user may include it in the endpoint or we'll add it as a query param later */
+            *headers = curl_slist_append(*headers, "Content-Type: application/json");
+        }
+    } else {
+        /* Default endpoint -- if this returns 404 you may need to set GEMINI_ENDPOINT to the correct URL */
+        const char *default_ep = "https://generativelanguage.googleapis.com/v1beta2/models/text-bison-001:generate";
+        if (api_key && strncmp(api_key, "AIza", 4) == 0) {
+            request_url = g_strdup_printf("%s?key=%s", default_ep, api_key);
+        } else {
+            request_url = g_strdup(default_ep);
+            gchar *auth = g_strdup_printf("Authorization: Bearer %s", api_key);
+            *headers = curl_slist_append(*headers, "Content-Type: application/json");
+            *headers = curl_slist_append(*headers, auth);
+            g_free(auth);
+        }
+    }
+    g_strfreev(endpoints);
+    return request_url;
+}
+
+/* Startup is split so a front end can put its window up first: the cheap, main-thread
+ * parts (context, credential cache and its re-lock timer) run in gemini_core_start,
+ * while libsodium, curl/TLS, the transport, the network worker and the response cache
+ * (which prunes its disk tier) come up on a background thread. Anything that hashes,
+ * encrypts or talks to the network calls gemini_core_wait_ready first. */
+static struct {
+    GMutex lock;
+    GCond cond;
+    GThread *thread;
+    gboolean started;
+    gboolean ready;
+    gboolean ok;
+} core_start;
+
+static gpointer gemini_core_start_thread(gpointer data) {
+    gboolean ok = sodium_init() >= 0;
+    if (!ok) {
+        g_printerr("libsodium initialization failed\n");
+    } else {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        transport_init();
+        net_worker_start();
+        response_cache_init();
+    }
+    g_mutex_lock(&core_start.lock);
+    core_start.ok = ok;
+    core_start.ready = TRUE;
+    g_cond_broadcast(&core_start.cond);
+    g_mutex_unlock(&core_start.lock);
+    return NULL;
+}
+
+void gemini_core_start(void) {
+    if (core_start.started) return;
+    core_start.started = TRUE;
+    context_init();
+    credential_cache_init();
+    core_start.thread = g_thread_new("gemini-init", gemini_core_start_thread, NULL);
+}
+
+gboolean gemini_core_wait_ready(void) {
+    g_mutex_lock(&core_start.lock);
+    while (!core_start.ready) g_cond_wait(&core_start.cond, &core_start.lock);
+    gboolean ok = core_start.ok;
+    g_mutex_unlock(&core_start.lock);
+    return ok;
+}
+
+gboolean gemini_core_init(void) {
+    gemini_core_start();
+    return gemini_core_wait_ready();
+}
+
+void gemini_core_shutdown(void) {
+    if (!core_start.started) return;
+    gboolean ok = gemini_core_wait_ready();
+    g_thread_join(core_start.thread);
+    core_start.thread = NULL;
+    credential_cache_clear();
+    if (!ok) return;
+    net_worker_stop();
+    response_cache_clear();
+    transport_cleanup();
+    curl_global_cleanup();
+}
@@ -0,0 +1,194 @@
+#ifndef GEMINI_CORE_H
+#define GEMINI_CORE_H
+
+#include <glib.h>
+#include <curl/curl.h>
+#include <json-c/json.h>
+
+/* Start and stop the engine: libsodium, curl, transport, network worker, credential
+ * and response caches. The conversation log is opened separately by the caller.
+ * gemini_core_init blocks until everything is up; gemini_core_start returns at once
+ * and leaves the slow parts to a background thread, after which callers must
+ * gemini_core_wait_ready (FALSE if libsodium failed) before using the engine. */
+gboolean gemini_core_init(void);
+void gemini_core_start(void);
+gboolean gemini_core_wait_ready(void);
+void gemini_core_shutdown(void);
+
+/* Key files */
+gchar *get_api_key_enc_path(void);
+gchar *get_api_key_plain_path(void);
+
+/* Passphrase prompt and error reporting supplied by the front end. purpose names what the
+ * passphrase protects ("the API key", "the chat history") for the prompt text. */
+typedef struct {
+    char *(*passphrase)(const char *purpose, gboolean confirm, gpointer user_data); /* g_malloc'd, or NULL */
+    void (*report)(const char *message, gpointer user_data);
+    gpointer user_data;
+} GeminiCredentialUI;
+
+gboolean encrypt_and_store_api_key(const GeminiCredentialUI *ui, const char *api_key);
+char *read_and_decrypt_api_key(const GeminiCredentialUI *ui);
+void credential_cache_init(void);
+void credential_cache_store(const char *api_key);
+void credential_cache_clear(void);
+
+/* Credential backends. get_api_key tries them in GEMINI_CREDENTIAL_BACKENDS order;
+ * backfill backends receive a key found by a later one. */
+typedef struct {
+    const char *name;
+    char *(*load)(const GeminiCredentialUI *ui);                          /* g_malloc'd, or NULL */
+    gboolean (*store)(const GeminiCredentialUI *ui, const char *api_key); /* NULL if read-only */
+    gboolean backfill;
+} CredentialBackend;
+
+extern const CredentialBackend credential_backend_keyring; /* Linux kernel keyring */
+extern const CredentialBackend credential_backend_file;    /* api_key.enc */
+extern const CredentialBackend credential_backend_plain;   /* api_key.txt, read-only */
+
+char *get_api_key(const GeminiCredentialUI *ui); /* free with free_api_key */
+gboolean credential_store(const GeminiCredentialUI *ui, const char *api_key);
+void free_api_key(char *api_key);
+
+/* Curl response buffer */
+struct CurlResponse { char *data; size_t len; size_t cap; };
+size_t curl_write_cb(void *ptr, size_t size, size_t nmemb, void *userp);
+
+/* Incremental JSON stream */
+typedef void (*JsonStreamFn)(json_object *obj, gpointer user_data);
+
+typedef struct {
+    json_tokener *tok;
+    gboolean sse;
+    int state;
+    char field[8];
+    size_t field_len;
+    JsonStreamFn on_object;
+    gpointer user_data;
+} JsonStream;
+
+void json_stream_init(JsonStream *js, gboolean sse, JsonStreamFn on_object, gpointer user_data);
+void json_stream_feed(JsonStream *js, const char *data, size_t len);
+void json_stream_clear(JsonStream *js);
+
+/* JSON writing and reply extraction */
+void json_append_string(GString *out, const char *s, gsize len);
+void json_append_double(GString *out, double v);
+gchar *extract_reply_text(const char *data, gsize len);
+
+/* Transport */
+void transport_init(void);
+void transport_cleanup(void);
+double transport_ttfb_ms(CURL *curl, gboolean *reused);
+
+/* Network worker. Requests given a flight key (the response cache hash) are
+ * single-flight: one submitted while an identical one is in flight attaches to that
+ * transfer and receives the same bytes and result, with coalesced set. Requests marked
+ * failover whose URL belongs to a GEMINI_ENDPOINT entry may be sent to another entry:
+ * around unhealthy endpoints, on retry, and as a hedge when the first answer is slow. */
+#define RESPONSE_CACHE_KEY_BYTES 32
+
+typedef struct NetRequest NetRequest;
+typedef void (*NetRequestDone)(NetRequest *req);
+
+struct NetRequest {
+    guint64 id;
+    CURL *curl;
+    struct curl_slist *headers;
+    struct CurlResponse resp;
+    CURLcode result;
+    long http_code;
+    gboolean finished;
+    gboolean cancelled;
+    NetRequestDone on_done; /* called on the worker thread */
+    size_t (*on_data)(NetRequest *req, const char *data, size_t len); /* optional, worker thread */
+    gpointer user_data;
+    GDestroyNotify destroy;
+    int priority;        /* higher is admitted first when requests are queued */
+    gsize tokens;        /* estimated cost against the TPM budget */
+    gboolean retryable;  /* may be resent after 429/5xx or a transfer that got nothing */
+    guint attempts;      /* retries so far */
+    gboolean coalesced;  /* result came from an identical request's transfer */
+    gboolean failover;   /* may go to (and be hedged on) other configured endpoints */
+    gint64 timeout_ms;   /* limit on the first byte and on gaps between bytes; 0 = GEMINI_TIMEOUT_MS */
+    gchar *url;          /* set with net_request_set_url */
+    /* worker-internal */
+    int state;
+    GSource *retry_timer;
+    gint64 queued_at;
+    gboolean has_flight_key;
+    guint8 flight_key[RESPONSE_CACHE_KEY_BYTES];
+    NetRequest *leader;     /* transfer this request is attached to */
+    GPtrArray *followers;   /* requests attached to this one's transfer */
+    GString *flight_data;   /* bytes seen so far, replayed to late followers */
+    gint64 deadline;
+    int endpoint;           /* endpoint of the transfer on curl, -1 if none */
+    int race;
+    CURL *hedge;            /* duplicate transfer racing curl on another endpoint */
+    int hedge_endpoint;
+    GSource *hedge_timer;
+};
+
+NetRequest *net_request_new(NetRequestDone on_done, gpointer user_data, GDestroyNotify destroy);
+void net_request_set_url(NetRequest *req, const char *url);
+void net_request_set_body(NetRequest *req, const char *body, gsize len);
+void net_request_set_flight_key(NetRequest *req, const guint8 key[RESPONSE_CACHE_KEY_BYTES]);
+long net_request_http_code(NetRequest *req); /* for on_data: the status of the shared transfer */
+guint64 net_worker_submit(NetRequest *req);
+void net_worker_cancel(guint64 id);
+void net_worker_start(void);
+void net_worker_stop(void);
+gchar **net_endpoint_list(void); /* GEMINI_ENDPOINT entries in order; g_strfreev */
+void net_endpoints_dump_json(GString *out);
+
+/* Latency statistics (milliseconds). Network phases are recorded by the worker. */
+typedef enum {
+    STAT_KEY, STAT_PAYLOAD, STAT_QUEUE, STAT_DNS, STAT_CONNECT, STAT_TLS,
+    STAT_TTFB, STAT_TOTAL, STAT_PARSE, STAT_UI_INSERT, STAT_FIRST_PAINT, STAT_PHASES
+} StatPhase;
+
+typedef struct { guint64 count; double p50, p95, p99, max; } StatSummary;
+
+void stats_record(StatPhase phase, double ms);
+void stats_summary(StatPhase phase, StatSummary *out);
+const char *stats_phase_name(StatPhase phase);
+void stats_dump_json(GString *out);
+
+typedef enum {
+    STAT_COUNT_FLIGHTS, STAT_COUNT_COALESCED, STAT_COUNT_HEDGES, STAT_COUNT_HEDGE_WINS,
+    STAT_COUNT_FAILOVERS, STAT_COUNTERS
+} StatCounter;
+
+void stats_count(StatCounter counter);
+guint64 stats_counter(StatCounter counter);
+const char *stats_counter_name(StatCounter counter);
+
+/* Conversation log */
+enum { LOG_ROLE_USER = 0, LOG_ROLE_MODEL = 1 };
+/* Chat backend a turn was exchanged with; records older than the tag read as Gemini. */
+enum { LOG_BACKEND_GEMINI = 0, LOG_BACKEND_OLLAMA = 1 };
+
+void conversation_log_open(void);
+gboolean conversation_log_append(int role, int backend, const char *text);
+gsize conversation_log_count(void);
+char *conversation_log_read(gsize i, int *role, int *backend, gint64 *timestamp);
+void conversation_log_close(void);
+gboolean history_unlock(const GeminiCredentialUI *ui, const char *legacy_api_key);
+gboolean history_has_legacy_records(void);
+
+/* Context and request bodies */
+void context_init(void);
+void context_add_turn(int role, const char *text);
+void context_build_payload(GString *body, const char *message);
+void build_legacy_payload(GString *body, const char *message);
+gchar *gemini_build_request(const char *api_key, struct curl_slist **headers);
+gchar *make_stream_url(const char *url);
+
+/* Response cache */
+void response_cache_init(void);
+void response_cache_key(guint8 key[RESPONSE_CACHE_KEY_BYTES], const char *url, const char *body, gsize body_len);
+gchar *response_cache_lookup(const guint8 key[RESPONSE_CACHE_KEY_BYTES], gint64 *age);
+void response_cache_store(const guint8 key[RESPONSE_CACHE_KEY_BYTES], const char *text, gsize len);
+void response_cache_clear(void);
+
+#endif
@@ -3,75 +3,352 @@
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <signal.h>
 
 #include <gtk/gtk.h>
-#include <curl/curl.h>
-#include <json-c/json.h>
-#include <sodium.h>
+#include <glib-unix.h>
+
+#include "gemini_core.h"
+#include "batch.h"
 
 typedef struct {
     GtkWidget *window;
     GtkWidget *api_key_entry;
     GtkWidget *stack;
     GtkWidget *chat_view; /* GtkTextView */
+    struct Transcript *transcript;
     GtkWidget *chat_input_entry;
     GtkWidget *chat_send_button;
+    GtkWidget *chat_cancel_button;
+    GtkWidget *chat_stream_toggle;
+    GtkWidget *chat_backend_combo;
     GtkWidget *endpoint_entry;
+    GtkWidget *stats_label;
+    GeminiCredentialUI cred_ui;
+    gboolean history_pending; /* encrypted history waits for the first unlock */
 } AppWidgets;
 
-static const char *MAGIC = "GEMINIENC1";
+/* Monotonic time at the top of main, for the first_paint stat. */
+static gint64 startup_time;
+
+/* Chat transcript. Everything shown in chat_view is kept in a compact append-only store
+ * (one GString plus line offsets); the GtkTextBuffer only holds a window of roughly
+ * TRANSCRIPT_WINDOW_LINES of it. Lines that fall far out of view are dropped from the
+ * buffer and paged back in from the store when the user scrolls toward them, so layout
+ * and wrapping cost stays flat however long the session runs. UI thread only. */
+#define TRANSCRIPT_WINDOW_LINES 2000
+#define TRANSCRIPT_PAGE_LINES 500
+
+typedef struct Transcript {
+    GString *text;
+    GArray *line_starts; /* gsize offset of each line in text */
+    guint win_start;     /* first store line held in the buffer */
+    gsize win_end;       /* store offset where the buffer ends */
+    gboolean attached;   /* buffer reaches the end of the store and follows new text */
+    gboolean after_cr;   /* the last append ended in a \r, now stored as \n */
+    guint page_idle;
+} Transcript;
+
+static Transcript *transcript_new(void) {
+    Transcript *t = g_new0(Transcript, 1);
+    t->text = g_string_sized_new(64 * 1024);
+    t->line_starts = g_array_new(FALSE, FALSE, sizeof(gsize));
+    gsize zero = 0;
+    g_array_append_val(t->line_starts, zero);
+    t->attached = TRUE;
+    return t;
+}
 
-static gchar *get_api_key_enc_path(void) {
-    const gchar *config_dir = g_get_user_config_dir();
-    return g_build_filename(config_dir, "gemini-gtk", "api_key.enc", NULL);
+static gsize transcript_line_offset(Transcript *t, guint line) {
+    return line < t->line_starts->len ? g_array_index(t->line_starts, gsize, line) : t->text->len;
 }
 
-static gchar *get_api_key_plain_path(void) {
-    const gchar *config_dir = g_get_user_config_dir();
-    return g_build_filename(config_dir, "gemini-gtk", "api_key.txt", NULL);
-}
-
-/* Curl response */
-struct CurlResponse { char *data; size_t len; };
-static size_t curl_write_cb(void *ptr, size_t size, size_t nmemb, void *userp) {
-    size_t realsize = size * nmemb;
-    struct CurlResponse *r = (struct CurlResponse*)userp;
-    char *newp = realloc(r->data, r->len + realsize + 1);
-    if (!newp) return 0;
-    r->data = newp;
-    memcpy(&(r->data[r->len]), ptr, realsize);
-    r->len += realsize;
-    r->data[r->len] = '\0';
-    return realsize;
-}
-
-/* UI helpers */
-typedef struct { AppWidgets *app; char *text; } UIMessage;
-static gboolean idle_append_ui_message(gpointer data) {
-    UIMessage *m = (UIMessage*)data;
-    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(m->app->chat_view));
+/* Index of the line containing store offset off. */
+static guint transcript_line_of(Transcript *t, gsize off) {
+    guint lo = 0, hi = t->line_starts->len;
+    while (hi - lo > 1) {
+        guint mid = lo + (hi - lo) / 2;
+        if (g_array_index(t->line_starts, gsize, mid) <= off) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static guint transcript_window_lines(Transcript *t) {
+    return transcript_line_of(t, t->win_end) - t->win_start + 1;
+}
+
+static void transcript_store(Transcript *t, const char *text, gsize len) {
+    gsize base = t->text->len;
+    g_string_append_len(t->text, text, (gssize)len);
+    for (const char *p = text; (p = memchr(p, '\n', len - (gsize)(p - text))) != NULL; p++) {
+        gsize start = base + (gsize)(p - text) + 1;
+        g_array_append_val(t->line_starts, start);
+    }
+}
+
+/* Drop the first n window lines from the buffer, keeping the visible text in place. */
+static void transcript_trim_top(AppWidgets *app, guint n, gboolean keep_view) {
+    Transcript *t = app->transcript;
+    GtkTextView *view = GTK_TEXT_VIEW(app->chat_view);
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(view);
+    GtkTextMark *anchor = NULL;
+    if (keep_view) {
+        GdkRectangle rect;
+        GtkTextIter top;
+        gtk_text_view_get_visible_rect(view, &rect);
+        gtk_text_view_get_line_at_y(view, &top, rect.y, NULL);
+        anchor = gtk_text_buffer_create_mark(buffer, NULL, &top, TRUE);
+    }
+    GtkTextIter start, cut;
+    gtk_text_buffer_get_start_iter(buffer, &start);
+    gtk_text_buffer_get_iter_at_line(buffer, &cut, (gint)n);
+    gtk_text_buffer_delete(buffer, &start, &cut);
+    t->win_start += n;
+    if (anchor) {
+        gtk_text_view_scroll_to_mark(view, anchor, 0.0, TRUE, 0.0, 0.0);
+        gtk_text_buffer_delete_mark(buffer, anchor);
+    }
+}
+
+/* Keep only the first keep window lines in the buffer; the rest stays in the store. */
+static void transcript_trim_bottom(AppWidgets *app, guint keep) {
+    Transcript *t = app->transcript;
+    gsize cut_off = transcript_line_offset(t, t->win_start + keep);
+    if (cut_off >= t->win_end) return;
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(app->chat_view));
+    GtkTextIter cut, end;
+    gtk_text_buffer_get_iter_at_line(buffer, &cut, (gint)keep);
+    gtk_text_buffer_get_end_iter(buffer, &end);
+    gtk_text_buffer_delete(buffer, &cut, &end);
+    t->win_end = cut_off;
+    t->attached = FALSE;
+}
+
+static void transcript_page_older(AppWidgets *app) {
+    Transcript *t = app->transcript;
+    if (t->win_start == 0) return;
+    guint n = MIN(TRANSCRIPT_PAGE_LINES, t->win_start);
+    gsize from = transcript_line_offset(t, t->win_start - n);
+    gsize to = transcript_line_offset(t, t->win_start);
+    GtkTextView *view = GTK_TEXT_VIEW(app->chat_view);
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(view);
+    GtkTextIter start;
+    gtk_text_buffer_get_start_iter(buffer, &start);
+    /* Right gravity: the mark ends up after the inserted page, on the old first line. */
+    GtkTextMark *anchor = gtk_text_buffer_create_mark(buffer, NULL, &start, FALSE);
+    gtk_text_buffer_insert(buffer, &start, t->text->str + from, (gint)(to - from));
+    t->win_start -= n;
+    gtk_text_view_scroll_to_mark(view, anchor, 0.0, TRUE, 0.0, 0.0);
+    gtk_text_buffer_delete_mark(buffer, anchor);
+    if (transcript_window_lines(t) > TRANSCRIPT_WINDOW_LINES) transcript_trim_bottom(app, TRANSCRIPT_WINDOW_LINES);
+}
+
+static void transcript_page_newer(AppWidgets *app) {
+    Transcript *t = app->transcript;
+    if (t->attached) return;
+    gsize from = t->win_end;
+    gsize to = transcript_line_offset(t, transcript_line_of(t, from) + TRANSCRIPT_PAGE_LINES + 1);
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(app->chat_view));
+    GtkTextIter end;
+    gtk_text_buffer_get_end_iter(buffer, &end);
+    gtk_text_buffer_insert(buffer, &end, t->text->str + from, (gint)(to - from));
+    t->win_end = to;
+    t->attached = to == t->text->len;
+    guint lines = transcript_window_lines(t);
+    if (lines > TRANSCRIPT_WINDOW_LINES) transcript_trim_top(app, lines - TRANSCRIPT_WINDOW_LINES, TRUE);
+}
+
+static gboolean transcript_page_idle(gpointer data) {
+    AppWidgets *app = (AppWidgets*)data;
+    Transcript *t = app->transcript;
+    t->page_idle = 0;
+    GtkAdjustment *vadj = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(app->chat_view));
+    gdouble value = gtk_adjustment_get_value(vadj);
+    gdouble page = gtk_adjustment_get_page_size(vadj);
+    if (value <= page) transcript_page_older(app);
+    else if (value + 2 * page >= gtk_adjustment_get_upper(vadj)) transcript_page_newer(app);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_transcript_scrolled(GtkAdjustment *vadj, gpointer user_data) {
+    AppWidgets *app = (AppWidgets*)user_data;
+    Transcript *t = app->transcript;
+    if (t->page_idle) return;
+    gdouble value = gtk_adjustment_get_value(vadj);
+    gdouble page = gtk_adjustment_get_page_size(vadj);
+    gboolean near_top = value <= page && t->win_start > 0;
+    gboolean near_bottom = value + 2 * page >= gtk_adjustment_get_upper(vadj) && !t->attached;
+    if (near_top || near_bottom) t->page_idle = g_idle_add(transcript_page_idle, app);
+}
+
+/* GtkTextBuffer ends lines at \n, \r\n, a lone \r and U+2029; line_starts counts only
+ * \n. Reduce text to valid UTF-8 with \n breaks so both always agree on line numbers.
+ * Returns NULL when text is already in that form. */
+static gchar *transcript_normalize(Transcript *t, const char *text, gsize *len) {
+    static const char para_sep[] = "\xe2\x80\xa9";
+    gchar *valid = g_utf8_validate(text, (gssize)*len, NULL) ? NULL : g_utf8_make_valid(text, (gssize)*len);
+    const char *src = valid ? valid : text;
+    gsize n = valid ? strlen(valid) : *len;
+    gboolean skip_lf = t->after_cr;
+    t->after_cr = n > 0 && src[n - 1] == '\r';
+    if (!(skip_lf && n > 0 && src[0] == '\n') && !memchr(src, '\r', n) && !g_strstr_len(src, (gssize)n, para_sep)) {
+        *len = n;
+        return valid;
+    }
+    GString *out = g_string_sized_new(n);
+    for (gsize i = skip_lf && n > 0 && src[0] == '\n' ? 1 : 0; i < n; i++) {
+        if (src[i] == '\r') {
+            g_string_append_c(out, '\n');
+            if (i + 1 < n && src[i + 1] == '\n') i++;
+        } else if (src[i] == para_sep[0] && n - i >= 3 && memcmp(src + i, para_sep, 3) == 0) {
+            g_string_append_c(out, '\n');
+            i += 2;
+        } else {
+            g_string_append_c(out, src[i]);
+        }
+    }
+    g_free(valid);
+    *len = out->len;
+    return g_string_free(out, FALSE);
+}
+
+/* Record text in the store and, if the window is following the tail, show it. */
+static void transcript_append(AppWidgets *app, const char *text, gsize len, gboolean at_bottom) {
+    Transcript *t = app->transcript;
+    gchar *clean = transcript_normalize(t, text, &len);
+    if (clean) text = clean;
+    transcript_store(t, text, len);
+    guint lines = transcript_window_lines(t);
+    if (!t->attached || (!at_bottom && lines > 2 * TRANSCRIPT_WINDOW_LINES)) {
+        /* The user is reading history: stop growing the buffer, page in on scroll-down. */
+        t->attached = FALSE;
+        g_free(clean);
+        return;
+    }
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(app->chat_view));
     GtkTextIter end_iter;
     gtk_text_buffer_get_end_iter(buffer, &end_iter);
-    gtk_text_buffer_insert(buffer, &end_iter, m->text, -1);
-    gtk_text_buffer_insert(buffer, &end_iter, "\n", -1);
-    g_free(m->text);
-    g_free(m);
+    gtk_text_buffer_insert(buffer, &end_iter, text, (gint)len);
+    g_free(clean);
+    t->win_end = t->text->len;
+    lines = transcript_window_lines(t);
+    if (at_bottom && lines > TRANSCRIPT_WINDOW_LINES) transcript_trim_top(app, lines - TRANSCRIPT_WINDOW_LINES, FALSE);
+}
+
+/* UI helpers. Any thread pushes messages onto a lock-free MPSC list; the UI thread
+ * drains it once per frame (from a tick callback on chat_view) and inserts everything
+ * that arrived since the last frame as a single buffer edit. */
+typedef struct UIMessage { struct UIMessage *next; AppWidgets *app; char *text; gboolean newline; } UIMessage;
+static UIMessage *ui_queue_head;
+static gint ui_queue_pending; /* 1 while a wake-up is scheduled and not yet drained */
+
+static void ui_flush(AppWidgets *app, GString *batch) {
+    if (batch->len == 0) return;
+    GtkTextBuffer *buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(app->chat_view));
+    /* Follow the output only if the user has not scrolled up to read history. */
+    GtkAdjustment *vadj = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(app->chat_view));
+    gboolean at_bottom = !vadj ||
+        gtk_adjustment_get_value(vadj) + gtk_adjustment_get_page_size(vadj) >= gtk_adjustment_get_upper(vadj) - 1.0;
+    gint64 start = g_get_monotonic_time();
+    transcript_append(app, batch->str, batch->len, at_bottom);
+    if (at_bottom && app->transcript->attached) {
+        GtkTextIter end_iter;
+        gtk_text_buffer_get_end_iter(buffer, &end_iter);
+        GtkTextMark *mark = gtk_text_buffer_get_mark(buffer, "ui-end");
+        if (!mark) mark = gtk_text_buffer_create_mark(buffer, "ui-end", &end_iter, FALSE);
+        else gtk_text_buffer_move_mark(buffer, mark, &end_iter);
+        gtk_text_view_scroll_mark_onscreen(GTK_TEXT_VIEW(app->chat_view), mark);
+    }
+    stats_record(STAT_UI_INSERT, (g_get_monotonic_time() - start) / 1000.0);
+    g_string_truncate(batch, 0);
+}
+
+static void ui_queue_drain(void) {
+    g_atomic_int_set(&ui_queue_pending, 0);
+    UIMessage *list;
+    do {
+        list = g_atomic_pointer_get(&ui_queue_head);
+    } while (!g_atomic_pointer_compare_and_exchange(&ui_queue_head, list, NULL));
+
+    /* The list was built by prepending; reverse it back into arrival order. */
+    UIMessage *fifo = NULL;
+    while (list) {
+        UIMessage *next = list->next;
+        list->next = fifo;
+        fifo = list;
+        list = next;
+    }
+
+    GString *batch = g_string_new(NULL);
+    AppWidgets *app = NULL;
+    while (fifo) {
+        UIMessage *m = fifo;
+        fifo = m->next;
+        if (app && m->app != app) ui_flush(app, batch);
+        app = m->app;
+        g_string_append(batch, m->text);
+        if (m->newline) g_string_append_c(batch, '\n');
+        g_free(m->text);
+        g_free(m);
+    }
+    if (app) ui_flush(app, batch);
+    g_string_free(batch, TRUE);
+}
+
+static gboolean ui_queue_tick(GtkWidget *widget, GdkFrameClock *clock, gpointer data) {
+    ui_queue_drain();
     return G_SOURCE_REMOVE;
 }
 
+static gboolean ui_queue_wake(gpointer data) {
+    AppWidgets *app = (AppWidgets*)data;
+    /* An unmapped view gets no frames, so don't wait for one. */
+    if (gtk_widget_get_mapped(app->chat_view)) gtk_widget_add_tick_callback(app->chat_view, ui_queue_tick, NULL, NULL);
+    else ui_queue_drain();
+    return G_SOURCE_REMOVE;
+}
+
+static void ui_queue_push(UIMessage *m) {
+    AppWidgets *app = m->app; /* m may be drained and freed as soon as it is published */
+    UIMessage *head;
+    do {
+        head = g_atomic_pointer_get(&ui_queue_head);
+        m->next = head;
+    } while (!g_atomic_pointer_compare_and_exchange(&ui_queue_head, head, m));
+    if (g_atomic_int_compare_and_exchange(&ui_queue_pending, 0, 1)) g_idle_add(ui_queue_wake, app);
+}
+
+/* Messages are made valid UTF-8 here, one by one: raw server bodies pass through, and a
+ * bad byte would make GTK reject the whole frame's batched insert. Takes text. */
+static void ui_queue_text(AppWidgets *app, gchar *text, gboolean newline) {
+    UIMessage *m = g_new0(UIMessage, 1);
+    m->app = app;
+    if (g_utf8_validate(text, -1, NULL)) {
+        m->text = text;
+    } else {
+        m->text = g_utf8_make_valid(text, -1);
+        g_free(text);
+    }
+    m->newline = newline;
+    ui_queue_push(m);
+}
+
 static void schedule_append(AppWidgets *app, const char *text_fmt, ...) {
     va_list ap;
     va_start(ap, text_fmt);
     gchar *msg = g_strdup_vprintf(text_fmt, ap);
     va_end(ap);
-    UIMessage *m = g_new0(UIMessage, 1);
-    m->app = app;
-    m->text = msg;
-    g_idle_add(idle_append_ui_message, m);
+    ui_queue_text(app, msg, TRUE);
+}
+
+/* Append text without the trailing newline; used for streamed deltas. */
+static void schedule_insert(AppWidgets *app, const char *text) {
+    ui_queue_text(app, g_strdup(text), FALSE);
 }
 
 /* Passphrase prompt */
-static char *prompt_passphrase(GtkWindow *parent, gboolean confirm) {
+static char *prompt_passphrase(GtkWindow *parent, const char *purpose, gboolean confirm) {
     GtkWidget *dialog = gtk_dialog_new_with_buttons(confirm ? "Enter passphrase (confirm)" : "Enter passphrase",
                                                     parent,
                                                     GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
@@ -79,7 +356,10 @@ static char *prompt_passphrase(GtkWindow *parent, gboolean confirm) {
                                                     "_OK", GTK_RESPONSE_OK,
                                                     NULL);
     GtkWidget *content = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
-    GtkWidget *label = gtk_label_new(confirm ? "Passphrase (will be used to encrypt the API key). Type twice to confirm:" : "Passphrase to decrypt the API key:");
+    gchar *text = confirm ? g_strdup_printf("Passphrase (will be used to encrypt %s). Type twice to confirm:", purpose)
+                          : g_strdup_printf("Passphrase to decrypt %s:", purpose);
+    GtkWidget *label = gtk_label_new(text);
+    g_free(text);
     gtk_box_pack_start(GTK_BOX(content), label, FALSE, FALSE, 6);
     GtkWidget *entry1 = gtk_entry_new();
     gtk_entry_set_visibility(GTK_ENTRY(entry1), FALSE);
@@ -107,138 +387,13 @@ static char *prompt_passphrase(GtkWindow *parent, gboolean confirm) {
     return result;
 }
 
-/* Encryption storage */
-static gboolean encrypt_and_store_api_key(AppWidgets *app, const char *api_key) {
-    char *pass = prompt_passphrase(GTK_WINDOW(app->window), TRUE);
-    if (!pass) return FALSE;
-
-    unsigned char salt[crypto_pwhash_SALTBYTES];
-    randombytes_buf(salt, sizeof(salt));
-
-    unsigned char key[crypto_aead_xchacha20poly1305_ietf_KEYBYTES];
-    if (crypto_pwhash(key, sizeof key, pass, strlen(pass), salt,
-                      crypto_pwhash_OPSLIMIT_INTERACTIVE, crypto_pwhash_MEMLIMIT_INTERACTIVE,
-                      crypto_pwhash_ALG_DEFAULT) != 0) {
-        schedule_append(app, "Error deriving key from passphrase (out of memory)");
-        sodium_memzero(pass, strlen(pass));
-        g_free(pass);
-        return FALSE;
-    }
-
-    const unsigned char *m = (const unsigned char*)api_key;
-    unsigned long long mlen = strlen(api_key);
-    unsigned char nonce[crypto_aead_xchacha20poly1305_ietf_NPUBBYTES];
-    randombytes_buf(nonce, sizeof(nonce));
-    unsigned long long clen = mlen + crypto_aead_xchacha20poly1305_ietf_ABYTES;
-    unsigned char *cipher = malloc(clen);
-    unsigned long long actual_clen = 0;
-
-    crypto_aead_xchacha20poly1305_ietf_encrypt(cipher, &actual_clen,
-                                               m, mlen,
-                                               NULL, 0, NULL,
-                                               nonce, key);
-
-    gchar *path = get_api_key_enc_path();
-    size_t magic_len = strlen(MAGIC);
-    size_t total = magic_len + sizeof(salt) + sizeof(nonce) + actual_clen;
-    unsigned char *buf = malloc(total);
-    unsigned char *p = buf;
-    memcpy(p, MAGIC, magic_len); p += magic_len;
-    memcpy(p, salt, sizeof(salt)); p += sizeof(salt);
-    memcpy(p, nonce, sizeof(nonce)); p += sizeof(nonce);
-    memcpy(p, cipher, actual_clen);
-
-    GError *error = NULL;
-    gboolean ok = g_file_set_contents(path, (const char*)buf, total, &error);
-    if (!ok) {
-        schedule_append(app, "Failed to write encrypted key: %s", error ? error->message : "unknown");
-        if (error) g_error_free(error);
-    }
-
-    sodium_memzero(key, sizeof(key));
-    sodium_memzero(pass, strlen(pass));
-    g_free(pass);
-    free(buf);
-    free(cipher);
-    g_free(path);
-    return ok;
+static char *app_passphrase(const char *purpose, gboolean confirm, gpointer user_data) {
+    AppWidgets *app = (AppWidgets*)user_data;
+    return prompt_passphrase(GTK_WINDOW(app->window), purpose, confirm);
 }
 
-static char *read_and_decrypt_api_key(AppWidgets *app) {
-    gchar *enc_path = get_api_key_enc_path();
-    char *data = NULL;
-    gsize length = 0;
-    GError *error = NULL;
-    if (!g_file_get_contents(enc_path, &data, &length, &error)) {
-        g_free(enc_path);
-        if (error) g_error_free(error);
-        return NULL;
-    }
-
-    size_t magic_len = strlen(MAGIC);
-    if (length < magic_len) {
-        g_free(enc_path);
-        g_free(data);
-        return NULL;
-    }
-    if (memcmp(data, MAGIC, magic_len) != 0) {
-        char *plain = g_strdup(data);
-        g_free(enc_path);
-        g_free(data);
-        return plain;
-    }
-
-    const unsigned char *p = (const unsigned char*)data + magic_len;
-    const unsigned char *salt = p; p += crypto_pwhash_SALTBYTES;
-    const unsigned char *nonce = p; p += crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
-    const unsigned char *cipher = p;
-    size_t cipherlen = length - (magic_len + crypto_pwhash_SALTBYTES + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES);
-
-    char *pass = prompt_passphrase(GTK_WINDOW(app->window), FALSE);
-    if (!pass) {
-        g_free(enc_path);
-        g_free(data);
-        return NULL;
-    }
-
-    unsigned char key[crypto_aead_xchacha20poly1305_ietf_KEYBYTES];
-    if (crypto_pwhash(key, sizeof key, pass, strlen(pass), salt,
-                      crypto_pwhash_OPSLIMIT_INTERACTIVE, crypto_pwhash_MEMLIMIT_INTERACTIVE,
-                      crypto_pwhash_ALG_DEFAULT) != 0) {
-        schedule_append(app, "Error deriving key from passphrase");
-        sodium_memzero(pass, strlen(pass));
-        g_free(pass);
-        g_free(enc_path);
-        g_free(data);
-        return NULL;
-    }
-
-    unsigned long long mlen = 0;
-    unsigned char *m = malloc(cipherlen + 1);
-    if (crypto_aead_xchacha20poly1305_ietf_decrypt(m, &mlen,
-                                                  NULL,
-                                                  cipher, cipherlen,
-                                                  NULL, 0,
-                                                  nonce, key) != 0) {
-        schedule_append(app, "Incorrect passphrase or corrupted file");
-        sodium_memzero(key, sizeof(key));
-        sodium_memzero(pass, strlen(pass));
-        g_free(pass);
-        free(m);
-        g_free(enc_path);
-        g_free(data);
-        return NULL;
-    }
-
-    char *out = g_strndup((char*)m, (gsize)mlen);
-
-    sodium_memzero(key, sizeof(key));
-    sodium_memzero(pass, strlen(pass));
-    g_free(pass);
-    free(m);
-    g_free(enc_path);
-    g_free(data);
-    return out;
+static void app_report(const char *message, gpointer user_data) {
+    schedule_append((AppWidgets*)user_data, "%s", message);
 }
 
 /* Endpoint storage and testing */
@@ -268,64 +423,58 @@ static void load_endpoint_file(AppWidgets *app) {
     char *content = NULL;
     gsize len = 0;
     GError *error = NULL;
-    const char *env = getenv("GEMINI_ENDPOINT");
+    gchar **env = net_endpoint_list(); /* the first entry is where requests are built for */
     if (g_file_get_contents(path, &content, &len, &error)) {
         gtk_entry_set_text(GTK_ENTRY(app->endpoint_entry), content);
         g_free(content);
-    } else if (env && strlen(env) > 0) {
-        gtk_entry_set_text(GTK_ENTRY(app->endpoint_entry), env);
+    } else if (env[0]) {
+        gtk_entry_set_text(GTK_ENTRY(app->endpoint_entry), env[0]);
     } else {
         gtk_entry_set_text(GTK_ENTRY(app->endpoint_entry), "https://generativelanguage.googleapis.com/v1beta2/models/text-bison-001:generate");
     }
     if (error) g_error_free(error);
+    g_strfreev(env);
     g_free(path);
 }
 
-typedef struct { AppWidgets *app; gchar *endpoint; } EndpointTestData;
-static gpointer endpoint_test_thread(gpointer user_data) {
-    EndpointTestData *td = (EndpointTestData*)user_data;
+typedef struct { AppWidgets *app; gchar *endpoint; guint8 cache_key[RESPONSE_CACHE_KEY_BYTES]; } EndpointTestData;
+static void endpoint_test_data_free(gpointer data) {
+    EndpointTestData *td = (EndpointTestData*)data;
+    g_free(td->endpoint);
+    g_free(td);
+}
+
+static void endpoint_test_done(NetRequest *req) {
+    EndpointTestData *td = (EndpointTestData*)req->user_data;
     AppWidgets *app = td->app;
     const char *url = td->endpoint;
+    CURLcode cres = req->result;
+    long http_code = req->http_code;
 
-    struct CurlResponse resp = { .data = malloc(1), .len = 0 };
-    struct curl_slist *headers = NULL;
-    CURL *curl = curl_easy_init();
-    if (!curl) {
-        schedule_append(app, "Test: failed to init curl");
-        g_free(td->endpoint);
-        g_free(td);
-        return NULL;
+    if (req->cancelled) {
+        schedule_append(app, "[Test] Cancelled: %s", url);
+        return;
     }
-
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    const char *payload = "{\"prompt\":{\"text\":\"test\"},\"temperature\":0.2,\"maxOutputTokens\":16}";
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &resp);
-
-    CURLcode cres = curl_easy_perform(curl);
-    long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+    if (req->coalesced) {
+        schedule_append(app, "[Test] Request URL: %s", url);
+        schedule_append(app, "[Test] Shared the response of an identical test already in flight");
+        return;
+    }
+    gboolean reused = FALSE;
+    double ttfb = transport_ttfb_ms(req->curl, &reused);
     schedule_append(app, "[Test] Request URL: %s", url);
     schedule_append(app, "[Test] HTTP status: %ld", http_code);
+    if (cres == CURLE_OK) schedule_append(app, "[Test] Time to first byte: %.1f ms (%s connection)", ttfb, reused ? "reused" : "new");
     if (cres != CURLE_OK) {
         schedule_append(app, "[Test] Network error: %s", curl_easy_strerror(cres));
     } else if (http_code == 404) {
         schedule_append(app, "[Test] 404 Not Found: endpoint likely incorrect or API not enabled.");
-        if (resp.len > 0) schedule_append(app, "%s", resp.data);
+        if (req->resp.len > 0) schedule_append(app, "%s", req->resp.data);
     } else {
-        if (resp.len > 0) schedule_append(app, "[Test] Response: %s", resp.data);
+        if (http_code == 200) response_cache_store(td->cache_key, req->resp.data, req->resp.len);
+        if (req->resp.len > 0) schedule_append(app, "[Test] Response: %s", req->resp.data);
         else schedule_append(app, "[Test] Empty response (check credentials/endpoint)");
     }
-
-    free(resp.data);
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-    g_free(td->endpoint);
-    g_free(td);
-    return NULL;
 }
 
 static void on_save_endpoint_button_clicked(GtkButton *button, gpointer user_data) {
@@ -335,158 +484,505 @@ static void on_save_endpoint_button_clicked(GtkButton *button, gpointer user_dat
 
 static void on_test_endpoint_button_clicked(GtkButton *button, gpointer user_data) {
     AppWidgets *app = (AppWidgets*)user_data;
+    if (!gemini_core_wait_ready()) {
+        schedule_append(app, "Test: engine failed to start");
+        return;
+    }
     const char *ep = gtk_entry_get_text(GTK_ENTRY(app->endpoint_entry));
     EndpointTestData *td = g_new0(EndpointTestData, 1);
     td->app = app;
     td->endpoint = g_strdup(ep);
-    g_thread_new("endpoint-test", endpoint_test_thread, td);
+
+    const char *payload = "{\"prompt\":{\"text\":\"test\"},\"temperature\":0.2,\"maxOutputTokens\":16}";
+    response_cache_key(td->cache_key, td->endpoint, payload, strlen(payload));
+    gint64 age = 0;
+    gchar *cached = response_cache_lookup(td->cache_key, &age);
+    if (cached) {
+        schedule_append(app, "[Test] Request URL: %s", td->endpoint);
+        schedule_append(app, "[Test] Served from response cache (stored %" G_GINT64_FORMAT " s ago)", age);
+        schedule_append(app, "[Test] Response: %s", cached);
+        g_free(cached);
+        endpoint_test_data_free(td);
+        return;
+    }
+
+    NetRequest *req = net_request_new(endpoint_test_done, td, endpoint_test_data_free);
+    if (!req) {
+        schedule_append(app, "Test: failed to init curl");
+        endpoint_test_data_free(td);
+        return;
+    }
+    req->headers = curl_slist_append(req->headers, "Content-Type: application/json");
+    curl_easy_setopt(req->curl, CURLOPT_URL, td->endpoint);
+    net_request_set_body(req, payload, strlen(payload));
+    net_request_set_flight_key(req, td->cache_key);
+    req->priority = 1;
+    req->retryable = TRUE;
+    net_worker_submit(req);
 }
 
 
-/* Background request thread */
-typedef struct { AppWidgets *app; char *message; } GeminiThreadData;
-static gpointer gemini_request_thread(gpointer user_data) {
-    GeminiThreadData *td = (GeminiThreadData*)user_data;
-    AppWidgets *app = td->app;
+/* Chat requests. The request is built on the UI thread (so a passphrase prompt on a
+ * credential-cache miss runs where GTK expects it) and performed by the network worker. */
+typedef struct ChatBackend ChatBackend;
 
-    char *api_key = read_and_decrypt_api_key(app);
-    if (!api_key) {
-        gchar *plain_path = get_api_key_plain_path();
-        gchar *content = NULL;
-        gsize len = 0;
-        GError *gerr = NULL;
-        if (g_file_get_contents(plain_path, &content, &len, &gerr)) {
-            api_key = content;
-        }
-        g_free(plain_path);
+typedef struct {
+    AppWidgets *app;
+    const ChatBackend *backend;
+    char *message;
+    gchar *request_url;
+    gboolean stream;
+    gboolean streamed; /* at least one delta has been rendered */
+    JsonStream js;
+    GString *reply;    /* streamed text, for the conversation log */
+    gint64 parse_us;   /* time spent parsing streamed chunks */
+    guint8 cache_key[RESPONSE_CACHE_KEY_BYTES];
+} GeminiRequestData;
+static void gemini_request_data_free(gpointer data) {
+    GeminiRequestData *td = (GeminiRequestData*)data;
+    if (td->stream) json_stream_clear(&td->js);
+    if (td->reply) g_string_free(td->reply, TRUE);
+    g_free(td->message);
+    g_free(td->request_url);
+    g_free(td);
+}
+
+/* GEMINI_HISTORY_ENCRYPT=1: the conversation log is sealed with a history key of its own,
+ * unlocked by passphrase on the first send (history_unlock). */
+static gboolean history_encrypted(void) {
+    const char *encrypt_env = getenv("GEMINI_HISTORY_ENCRYPT");
+    return encrypt_env && strcmp(encrypt_env, "1") == 0;
+}
+
+static void stream_render(GeminiRequestData *td, const char *text);
+
+/* Chat backends. A backend turns a prompt into a request (URL, headers, body) and
+ * decodes its streamed chunks; queueing, caching, coalescing, rendering and the
+ * conversation log are shared.
+ *   Gemini  the configured Gemini endpoint, SSE when streaming, API key required.
+ *   Ollama  a local server (OLLAMA_HOST, default http://localhost:11434) via
+ *           /api/generate. Always streamed: the NDJSON lines are fed to the chat view
+ *           as they arrive. keep_alive (OLLAMA_KEEP_ALIVE, default 30m) keeps the model
+ *           (OLLAMA_MODEL) loaded between prompts, the model is warmed up when the
+ *           backend is picked, and the conversation continues through the context
+ *           tokens each reply ends with. Requests go through the shared transport, so
+ *           the keep-alive connection to the server is reused.
+ * The network worker's GEMINI_TIMEOUT_MS limits the wait for the first byte and the gaps
+ * after it, not the whole reply. Streamed replies get the backend's longer limit: a
+ * remote model can think for a while before the first event, and a local one may have
+ * to be loaded from disk first.
+ * Turns are logged with the backend they went to and restored under its label; only
+ * Gemini turns enter the generateContent context, so neither model sees the other's
+ * answers. */
+struct ChatBackend {
+    const char *id;
+    const char *label;        /* prefix for replies in the chat view */
+    gboolean needs_api_key;
+    gboolean always_streams;
+    gboolean sse;             /* stream framing: SSE events or NDJSON lines */
+    gboolean cacheable;       /* replies may be served from the response cache */
+    gboolean shares_context;  /* turns feed the generateContent context */
+    int log_backend;          /* LOG_BACKEND_* tag for the conversation log */
+    gint64 stream_timeout_ms; /* first-byte and stall limit for streamed requests */
+    gchar *(*build)(const char *api_key, const char *message, gboolean stream,
+                    struct curl_slist **headers, GString *body); /* returns the URL */
+    JsonStreamFn stream_object;
+};
+
+static void gemini_stream_object(json_object *chunk, gpointer user_data) {
+    GeminiRequestData *td = (GeminiRequestData*)user_data;
+    json_object *candidates = NULL, *content = NULL, *parts = NULL;
+    if (!json_object_object_get_ex(chunk, "candidates", &candidates) ||
+        json_object_get_type(candidates) != json_type_array) return;
+    json_object *first = json_object_array_get_idx(candidates, 0);
+    if (!first || !json_object_object_get_ex(first, "content", &content) ||
+        !json_object_object_get_ex(content, "parts", &parts) ||
+        json_object_get_type(parts) != json_type_array) return;
+    size_t n = json_object_array_length(parts);
+    for (size_t i = 0; i < n; i++) {
+        json_object *text = NULL;
+        if (!json_object_object_get_ex(json_object_array_get_idx(parts, i), "text", &text)) continue;
+        stream_render(td, json_object_get_string(text));
     }
+}
 
-    if (!api_key) {
-        schedule_append(app, "No API key available. Please save one.");
-        g_free(td->message);
-        g_free(td);
-        return NULL;
+static gchar *gemini_backend_build(const char *api_key, const char *message, gboolean stream,
+                                   struct curl_slist **headers, GString *body) {
+    gchar *url = gemini_build_request(api_key, headers);
+    if (stream) {
+        gchar *stream_url = make_stream_url(url);
+        g_free(url);
+        url = stream_url;
     }
+    if (stream || strstr(url, ":generateContent")) context_build_payload(body, message);
+    else build_legacy_payload(body, message);
+    return url;
+}
 
-    const char *env_endpoint = getenv("GEMINI_ENDPOINT");
-    gchar *request_url = NULL;
-    struct curl_slist *headers = NULL;
-    CURL *curl = NULL;
-    struct CurlResponse resp = { .data = malloc(1), .len = 0 };
-
-    if (env_endpoint && strlen(env_endpoint) > 0) {
-        /* Use the user-provided endpoint as-is. Prefer Authorization header for non-API-key credentials. */
-        request_url = g_strdup(env_endpoint);
-        if (api_key && strncmp(api_key, "AIza", 4) != 0) {
-            gchar *auth = g_strdup_printf("Authorization: Bearer %s", api_key);
-            headers = curl_slist_append(headers, "Content-Type: application/json");
-            headers = curl_slist_append(headers, auth);
-            g_free(auth);
-        } else {
-            /* API key: user may include it in the endpoint or we'll add it as a query param later */
-            headers = curl_slist_append(headers, "Content-Type: application/json");
-        }
-    } else {
-        /* Default endpoint -- if this returns 404 you may need to set GEMINI_ENDPOINT to the correct URL */
-        const char *default_ep = "https://generativelanguage.googleapis.com/v1beta2/models/text-bison-001:generate";
-        if (api_key && strncmp(api_key, "AIza", 4) == 0) {
-            request_url = g_strdup_printf("%s?key=%s", default_ep, api_key);
-        } else {
-            request_url = g_strdup(default_ep);
-            gchar *auth = g_strdup_printf("Authorization: Bearer %s", api_key);
-            headers = curl_slist_append(headers, "Content-Type: application/json");
-            headers = curl_slist_append(headers, auth);
-            g_free(auth);
-        }
+#define GEMINI_STREAM_TIMEOUT_MS (5 * 60 * 1000)
+
+static const ChatBackend gemini_backend = {
+    "gemini", "Gemini", TRUE, FALSE, TRUE, TRUE, TRUE, LOG_BACKEND_GEMINI, GEMINI_STREAM_TIMEOUT_MS,
+    gemini_backend_build, gemini_stream_object
+};
+
+#define OLLAMA_TIMEOUT_MS (10 * 60 * 1000)
+#define OLLAMA_DEFAULT_HOST "http://localhost:11434"
+#define OLLAMA_DEFAULT_MODEL "llama3.2"
+#define OLLAMA_DEFAULT_KEEP_ALIVE "30m"
+
+/* Context tokens returned with the last Ollama reply; written on the worker thread. */
+static GMutex ollama_lock;
+static gchar *ollama_context;
+
+static gchar *ollama_url(const char *path) {
+    const char *host = getenv("OLLAMA_HOST");
+    if (!host || !*host) host = OLLAMA_DEFAULT_HOST;
+    gsize len = strlen(host);
+    while (len > 0 && host[len - 1] == '/') len--;
+    return g_strdup_printf("%s%.*s%s", strstr(host, "://") ? "" : "http://", (int)len, host, path);
+}
+
+static const char *ollama_env(const char *name, const char *fallback) {
+    const char *v = getenv(name);
+    return v && *v ? v : fallback;
+}
+
+static void ollama_append_common(GString *body) {
+    const char *model = ollama_env("OLLAMA_MODEL", OLLAMA_DEFAULT_MODEL);
+    const char *keep_alive = ollama_env("OLLAMA_KEEP_ALIVE", OLLAMA_DEFAULT_KEEP_ALIVE);
+    g_string_append(body, "{\"model\":");
+    json_append_string(body, model, strlen(model));
+    g_string_append(body, ",\"keep_alive\":");
+    json_append_string(body, keep_alive, strlen(keep_alive));
+}
+
+static gchar *ollama_backend_build(const char *api_key, const char *message, gboolean stream,
+                                   struct curl_slist **headers, GString *body) {
+    *headers = curl_slist_append(*headers, "Content-Type: application/json");
+    g_string_truncate(body, 0);
+    ollama_append_common(body);
+    g_string_append(body, ",\"stream\":true,\"prompt\":");
+    json_append_string(body, message, strlen(message));
+    g_mutex_lock(&ollama_lock);
+    if (ollama_context) {
+        g_string_append(body, ",\"context\":");
+        g_string_append(body, ollama_context);
     }
+    g_mutex_unlock(&ollama_lock);
+    g_string_append_c(body, '}');
+    return ollama_url("/api/generate");
+}
 
-    curl = curl_easy_init();
-    if (!curl) {
-        schedule_append(app, "Error: failed to initialize curl");
-        g_free(api_key);
-        g_free(td->message);
-        g_free(td);
-        curl_slist_free_all(headers);
-        return NULL;
-    }
-
-    json_object *jroot = json_object_new_object();
-    json_object *prompt = json_object_new_object();
-    json_object_object_add(prompt, "text", json_object_new_string(td->message));
-    json_object_object_add(jroot, "prompt", prompt);
-    json_object_object_add(jroot, "maxOutputTokens", json_object_new_int(512));
-    json_object_object_add(jroot, "temperature", json_object_new_double(0.2));
-    const char *payload = json_object_to_json_string(jroot);
-
-    curl_easy_setopt(curl, CURLOPT_URL, request_url);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &resp);
-
-    CURLcode cres = curl_easy_perform(curl);
-    long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-    schedule_append(app, "Request URL: %s", request_url);
+static void ollama_stream_object(json_object *chunk, gpointer user_data) {
+    GeminiRequestData *td = (GeminiRequestData*)user_data;
+    json_object *field = NULL;
+    if (json_object_object_get_ex(chunk, "error", &field)) {
+        schedule_append(td->app, "Ollama error: %s", json_object_get_string(field));
+        return;
+    }
+    if (json_object_object_get_ex(chunk, "response", &field)) {
+        const char *text = json_object_get_string(field);
+        if (text && *text) stream_render(td, text);
+    }
+    if (json_object_object_get_ex(chunk, "context", &field) && json_object_get_type(field) == json_type_array) {
+        gchar *context = g_strdup(json_object_to_json_string_ext(field, JSON_C_TO_STRING_PLAIN));
+        g_mutex_lock(&ollama_lock);
+        g_free(ollama_context);
+        ollama_context = context;
+        g_mutex_unlock(&ollama_lock);
+    }
+}
+
+static const ChatBackend ollama_backend = {
+    "ollama", "Ollama", FALSE, TRUE, FALSE, FALSE, FALSE, LOG_BACKEND_OLLAMA, OLLAMA_TIMEOUT_MS,
+    ollama_backend_build, ollama_stream_object
+};
+
+static const ChatBackend *const chat_backends[] = { &gemini_backend, &ollama_backend };
+
+static const ChatBackend *chat_backend_active(AppWidgets *app) {
+    const char *id = gtk_combo_box_get_active_id(GTK_COMBO_BOX(app->chat_backend_combo));
+    for (gsize i = 0; id && i < G_N_ELEMENTS(chat_backends); i++) {
+        if (strcmp(id, chat_backends[i]->id) == 0) return chat_backends[i];
+    }
+    return &gemini_backend;
+}
+
+static const ChatBackend *chat_backend_for_log(int log_backend) {
+    for (gsize i = 0; i < G_N_ELEMENTS(chat_backends); i++) {
+        if (chat_backends[i]->log_backend == log_backend) return chat_backends[i];
+    }
+    return &gemini_backend;
+}
+
+static void chat_record_turns(const ChatBackend *backend, const char *message, const char *reply) {
+    conversation_log_append(LOG_ROLE_USER, backend->log_backend, message);
+    conversation_log_append(LOG_ROLE_MODEL, backend->log_backend, reply);
+    if (!backend->shares_context) return;
+    context_add_turn(LOG_ROLE_USER, message);
+    context_add_turn(LOG_ROLE_MODEL, reply);
+}
+
+static void stream_render(GeminiRequestData *td, const char *text) {
+    if (!td->streamed) {
+        schedule_insert(td->app, td->backend->label);
+        schedule_insert(td->app, ": ");
+        td->streamed = TRUE;
+    }
+    schedule_insert(td->app, text);
+    g_string_append(td->reply, text);
+}
+
+static size_t gemini_stream_data(NetRequest *req, const char *data, size_t len) {
+    GeminiRequestData *td = (GeminiRequestData*)req->user_data;
+    long http_code = net_request_http_code(req);
+    /* Error bodies are plain JSON, not a stream: keep them for the completion handler. */
+    if (http_code != 200) return curl_write_cb((void*)data, 1, len, &req->resp);
+    gint64 start = g_get_monotonic_time();
+    json_stream_feed(&td->js, data, len);
+    td->parse_us += g_get_monotonic_time() - start;
+    return len;
+}
+
+/* The user turn is recorded together with the reply, so a prompt re-sent while its first
+ * copy is still in flight builds the same body and coalesces with it; the shared reply
+ * is recorded once, by the request that carried the transfer. */
+static void gemini_record_exchange(NetRequest *req, const char *reply, gsize len) {
+    GeminiRequestData *td = (GeminiRequestData*)req->user_data;
+    if (req->coalesced) return;
+    chat_record_turns(td->backend, td->message, reply);
+    if (td->backend->cacheable) response_cache_store(td->cache_key, reply, len);
+}
+
+static void gemini_request_done(NetRequest *req) {
+    GeminiRequestData *td = (GeminiRequestData*)req->user_data;
+    AppWidgets *app = td->app;
+    CURLcode cres = req->result;
+    long http_code = req->http_code;
+    const struct CurlResponse *resp = &req->resp;
+
+    if (td->streamed) schedule_insert(app, "\n");
+    if (req->cancelled) {
+        schedule_append(app, "Request cancelled.");
+        return;
+    }
+    gboolean reused = FALSE;
+    double ttfb = transport_ttfb_ms(req->curl, &reused);
+    schedule_append(app, "Request URL: %s", td->request_url);
     schedule_append(app, "HTTP status: %ld", http_code);
+    if (req->coalesced) schedule_append(app, "Shared the response of an identical request already in flight");
+    else if (cres == CURLE_OK) schedule_append(app, "Time to first byte: %.1f ms (%s connection)", ttfb, reused ? "reused" : "new");
+    if (req->attempts > 0) schedule_append(app, "Retried %u time%s after throttling or a transient error", req->attempts, req->attempts == 1 ? "" : "s");
 
     if (cres != CURLE_OK) {
         schedule_append(app, "Network error: %s", curl_easy_strerror(cres));
     } else if (http_code == 404) {
-        schedule_append(app, "Error 404: endpoint not found. Try setting the GEMINI_ENDPOINT environment variable to the correct API URL.");
-        if (resp.len > 0) schedule_append(app, "%s", resp.data);
+        if (td->backend == &ollama_backend) {
+            schedule_append(app, "Error 404: model not found. Pull it with `ollama pull %s` or set OLLAMA_MODEL.",
+                            ollama_env("OLLAMA_MODEL", OLLAMA_DEFAULT_MODEL));
+        } else {
+            schedule_append(app, "Error 404: endpoint not found. Try setting the GEMINI_ENDPOINT environment variable to the correct API URL.");
+        }
+        if (resp->len > 0) schedule_append(app, "%s", resp->data);
+    } else if (td->stream && http_code == 200) {
+        stats_record(STAT_PARSE, td->parse_us / 1000.0);
+        if (!td->streamed) schedule_append(app, "%s: (empty response)", td->backend->label);
+        else gemini_record_exchange(req, td->reply->str, td->reply->len);
     } else {
         gchar *out = NULL;
-        if (resp.len > 0) {
-            json_object *rjson = json_tokener_parse(resp.data);
-            if (rjson) {
-                json_object *candidate = NULL;
-                if (json_object_object_get_ex(rjson, "candidates", &candidate)) {
-                    if (json_object_get_type(candidate) == json_type_array) {
-                        json_object *first = json_object_array_get_idx(candidate, 0);
-                        if (first) {
-                            if (json_object_get_type(first) == json_type_string) {
-                                out = g_strdup(json_object_get_string(first));
-                            } else if (json_object_get_type(first) == json_type_object) {
-                                json_object *content = NULL;
-                                if (json_object_object_get_ex(first, "content", &content)) {
-                                    out = g_strdup(json_object_get_string(content));
-                                } else if (json_object_object_get_ex(first, "text", &content)) {
-                                    out = g_strdup(json_object_get_string(content));
-                                }
-                            }
-                        }
-                    }
-                }
-                if (!out && json_object_object_get_ex(rjson, "output", &candidate)) {
-                    out = g_strdup(json_object_get_string(candidate));
-                }
-                if (!out && json_object_object_get_ex(rjson, "response", &candidate)) {
-                    out = g_strdup(json_object_get_string(candidate));
-                }
-                if (!out) out = g_strdup(resp.data);
-                json_object_put(rjson);
-            } else {
-                out = g_strdup(resp.data);
-            }
+        if (resp->len > 0) {
+            gint64 start = g_get_monotonic_time();
+            out = extract_reply_text(resp->data, resp->len);
+            stats_record(STAT_PARSE, (g_get_monotonic_time() - start) / 1000.0);
+            if (!out) out = g_strdup(resp->data);
         } else {
             out = g_strdup("(empty response)");
         }
-        schedule_append(app, "Gemini: %s", out);
+        schedule_append(app, "%s: %s", td->backend->label, out);
+        if (http_code == 200 && resp->len > 0) gemini_record_exchange(req, out, strlen(out));
         g_free(out);
     }
+}
 
-    free(resp.data);
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
-    g_free(request_url);
-    json_object_put(jroot);
-    g_free(api_key);
-    g_free(td->message);
-    g_free(td);
+static void gemini_request_start(AppWidgets *app, const char *message) {
+    if (!gemini_core_wait_ready()) {
+        schedule_append(app, "Error: engine failed to start");
+        return;
+    }
+    const ChatBackend *backend = chat_backend_active(app);
+    char *api_key = NULL;
+    if (backend->needs_api_key) {
+        gint64 start = g_get_monotonic_time();
+        api_key = get_api_key(&app->cred_ui);
+        stats_record(STAT_KEY, (g_get_monotonic_time() - start) / 1000.0);
+        if (!api_key) {
+            schedule_append(app, "No API key available. Please save one.");
+            return;
+        }
+    }
+
+    GeminiRequestData *td = g_new0(GeminiRequestData, 1);
+    td->app = app;
+    td->backend = backend;
+    td->message = g_strdup(message);
+    td->stream = backend->always_streams ||
+                 gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(app->chat_stream_toggle));
+    if (td->stream) {
+        json_stream_init(&td->js, backend->sse, backend->stream_object, td);
+        td->reply = g_string_new(NULL);
+    }
+
+    /* Reused across sends; curl copies the body, so it is free again right away. */
+    static GString *payload = NULL;
+    if (!payload) payload = g_string_sized_new(4096);
+    struct curl_slist *headers = NULL;
+    gint64 start = g_get_monotonic_time();
+    td->request_url = backend->build(api_key, td->message, td->stream, &headers, payload);
+    stats_record(STAT_PAYLOAD, (g_get_monotonic_time() - start) / 1000.0);
+    if (api_key) free_api_key(api_key);
+
+    response_cache_key(td->cache_key, td->request_url, payload->str, payload->len);
+    gint64 age = 0;
+    gchar *cached = backend->cacheable ? response_cache_lookup(td->cache_key, &age) : NULL;
+    if (cached) {
+        schedule_append(app, "Served from response cache (stored %" G_GINT64_FORMAT " s ago)", age);
+        schedule_append(app, "%s: %s", backend->label, cached);
+        chat_record_turns(backend, td->message, cached);
+        g_free(cached);
+        curl_slist_free_all(headers);
+        gemini_request_data_free(td);
+        return;
+    }
+
+    NetRequest *req = net_request_new(gemini_request_done, td, gemini_request_data_free);
+    if (!req) {
+        schedule_append(app, "Error: failed to initialize curl");
+        curl_slist_free_all(headers);
+        gemini_request_data_free(td);
+        return;
+    }
+    req->headers = headers;
+    if (td->stream) {
+        req->on_data = gemini_stream_data;
+        req->timeout_ms = backend->stream_timeout_ms;
+    }
+
+    net_request_set_url(req, td->request_url);
+    net_request_set_body(req, payload->str, payload->len);
+    net_request_set_flight_key(req, td->cache_key);
+    req->priority = 1; /* interactive sends go ahead of batch work */
+    req->retryable = TRUE;
+    req->failover = TRUE;
+    net_worker_submit(req);
+}
+
+/* Ollama warm-up: an empty generate request loads the model and applies keep_alive, so
+ * the first prompt does not pay for the load. Runs off the UI thread because it has to
+ * wait for the engine to finish starting. */
+static void ollama_warm_up_done(NetRequest *req) {
+    AppWidgets *app = (AppWidgets*)req->user_data;
+    if (req->cancelled) return;
+    if (req->result != CURLE_OK) {
+        gchar *url = ollama_url("");
+        schedule_append(app, "Ollama is not reachable at %s: %s", url, curl_easy_strerror(req->result));
+        g_free(url);
+    } else if (req->http_code == 404) {
+        schedule_append(app, "Ollama has no model %s. Pull it with `ollama pull %s` or set OLLAMA_MODEL.",
+                        ollama_env("OLLAMA_MODEL", OLLAMA_DEFAULT_MODEL), ollama_env("OLLAMA_MODEL", OLLAMA_DEFAULT_MODEL));
+    } else if (req->http_code != 200) {
+        schedule_append(app, "Ollama warm-up failed with HTTP %ld", req->http_code);
+    }
+}
+
+static gpointer ollama_warm_up_thread(gpointer user_data) {
+    AppWidgets *app = (AppWidgets*)user_data;
+    if (!gemini_core_wait_ready()) return NULL;
+    NetRequest *req = net_request_new(ollama_warm_up_done, app, NULL);
+    if (!req) return NULL;
+    GString *body = g_string_new(NULL);
+    ollama_append_common(body);
+    g_string_append_c(body, '}');
+    gchar *url = ollama_url("/api/generate");
+    req->headers = curl_slist_append(NULL, "Content-Type: application/json");
+    req->timeout_ms = OLLAMA_TIMEOUT_MS; /* loading the model is the slow part */
+    curl_easy_setopt(req->curl, CURLOPT_URL, url);
+    net_request_set_body(req, body->str, body->len);
+    net_worker_submit(req);
+    g_free(url);
+    g_string_free(body, TRUE);
     return NULL;
 }
 
+static void ollama_warm_up(AppWidgets *app) {
+    g_thread_unref(g_thread_new("ollama-warmup", ollama_warm_up_thread, app));
+}
+
+static void on_chat_backend_changed(GtkComboBox *combo, gpointer user_data) {
+    AppWidgets *app = (AppWidgets*)user_data;
+    const ChatBackend *backend = chat_backend_active(app);
+    gtk_widget_set_sensitive(app->chat_stream_toggle, !backend->always_streams);
+    if (backend == &ollama_backend) ollama_warm_up(app);
+}
+
+/* Show the tail of the conversation log when the window opens, each reply under the label
+ * of the backend that wrote it, and seed the context with the Gemini turns.
+ * With GEMINI_HISTORY_ENCRYPT=1 the records can only be read once the key is unlocked, so
+ * this waits for the first send instead of prompting before the window is up. */
+#define HISTORY_RESTORE_RECORDS 50
+
+static void restore_recent_history(AppWidgets *app) {
+    gsize n = conversation_log_count();
+    gsize first = n > HISTORY_RESTORE_RECORDS ? n - HISTORY_RESTORE_RECORDS : 0;
+    for (gsize i = first; i < n; i++) {
+        int role = 0, log_backend = LOG_BACKEND_GEMINI;
+        char *text = conversation_log_read(i, &role, &log_backend, NULL);
+        if (!text) continue;
+        const ChatBackend *backend = chat_backend_for_log(log_backend);
+        schedule_append(app, "%s: %s", role == LOG_ROLE_USER ? "You" : backend->label, text);
+        if (backend->shares_context) context_add_turn(role, text);
+        g_free(text);
+    }
+}
+
+/* Stats panel and dumps */
+static void stats_format_table(GString *out) {
+    g_string_append_printf(out, "%-12s %8s %9s %9s %9s %9s\n", "phase", "count", "p50 ms", "p95 ms", "p99 ms", "max ms");
+    for (int i = 0; i < STAT_PHASES; i++) {
+        StatSummary sum;
+        stats_summary((StatPhase)i, &sum);
+        g_string_append_printf(out, "%-12s %8" G_GUINT64_FORMAT " %9.1f %9.1f %9.1f %9.1f\n",
+                               stats_phase_name((StatPhase)i), sum.count, sum.p50, sum.p95, sum.p99, sum.max);
+    }
+    g_string_append_c(out, '\n');
+    for (int i = 0; i < STAT_COUNTERS; i++) {
+        g_string_append_printf(out, "%-12s %8" G_GUINT64_FORMAT "\n", stats_counter_name((StatCounter)i), stats_counter((StatCounter)i));
+    }
+}
+
+static gboolean stats_refresh(gpointer user_data) {
+    AppWidgets *app = (AppWidgets*)user_data;
+    const char *visible = gtk_stack_get_visible_child_name(GTK_STACK(app->stack));
+    if (!visible || strcmp(visible, "stats_view") != 0) return G_SOURCE_CONTINUE;
+    GString *text = g_string_new(NULL);
+    stats_format_table(text);
+    gtk_label_set_text(GTK_LABEL(app->stats_label), text->str);
+    g_string_free(text, TRUE);
+    return G_SOURCE_CONTINUE;
+}
+
+static void stats_dump(void) {
+    GString *out = g_string_new(NULL);
+    stats_dump_json(out);
+    g_printerr("%s\n", out->str);
+    g_string_free(out, TRUE);
+}
+
+static gboolean on_sigusr1(gpointer user_data) {
+    stats_dump();
+    return G_SOURCE_CONTINUE;
+}
+
 /* UI callbacks */
 static void on_open_key_button_clicked(GtkButton *button, gpointer user_data) {
     GError *error = NULL;
@@ -500,6 +996,10 @@ static void on_open_key_button_clicked(GtkButton *button, gpointer user_data) {
 static void on_save_key_button_clicked(GtkButton *button, gpointer user_data) {
     AppWidgets *app = (AppWidgets*)user_data;
     const char *api_key = gtk_entry_get_text(GTK_ENTRY(app->api_key_entry));
+    if (!gemini_core_wait_ready()) {
+        schedule_append(app, "Error: engine failed to start");
+        return;
+    }
 
     gchar *enc_path = get_api_key_enc_path();
     gchar *dir_path = g_path_get_dirname(enc_path);
@@ -512,102 +1012,157 @@ static void on_save_key_button_clicked(GtkButton *button, gpointer user_data) {
     }
     g_free(dir_path);
 
-    if (encrypt_and_store_api_key(app, api_key)) {
+    if (credential_store(&app->cred_ui, api_key)) {
         gtk_stack_set_visible_child_name(GTK_STACK(app->stack), "chat_view");
         gtk_window_set_title(GTK_WINDOW(app->window), "Gemini Chat");
     }
     g_free(enc_path);
 }
 
-static void load_api_key(AppWidgets *app) {
-    gchar *enc_path = get_api_key_enc_path();
-    if (g_file_test(enc_path, G_FILE_TEST_EXISTS)) {
-        char *dec = read_and_decrypt_api_key(app);
-        if (dec) {
-            gtk_entry_set_text(GTK_ENTRY(app->api_key_entry), dec);
-            g_free(dec);
-            gtk_stack_set_visible_child_name(GTK_STACK(app->stack), "chat_view");
-            gtk_window_set_title(GTK_WINDOW(app->window), "Gemini Chat");
-            g_free(enc_path);
-            return;
-        }
-    }
-    g_free(enc_path);
-
-    gchar *plain_path = get_api_key_plain_path();
-    gchar *content = NULL;
-    gsize length = 0;
-    GError *error = NULL;
-    if (g_file_get_contents(plain_path, &content, &length, &error)) {
-        gtk_entry_set_text(GTK_ENTRY(app->api_key_entry), content);
-        g_free(content);
-        gtk_stack_set_visible_child_name(GTK_STACK(app->stack), "chat_view");
-        gtk_window_set_title(GTK_WINDOW(app->window), "Gemini Chat");
-    } else {
-        gtk_stack_set_visible_child_name(GTK_STACK(app->stack), "key_input_view");
-        gtk_window_set_title(GTK_WINDOW(app->window), "Gemini API Key Manager");
-        if (error) g_error_free(error);
-    }
-    g_free(plain_path);
-}
-
 static void on_chat_send_button_clicked(GtkButton *button, gpointer user_data) {
     AppWidgets *app = (AppWidgets*)user_data;
     const char *message = gtk_entry_get_text(GTK_ENTRY(app->chat_input_entry));
     if (!message || strlen(message) == 0) return;
 
+    if (app->history_pending) {
+        if (!gemini_core_wait_ready()) {
+            schedule_append(app, "Error: engine failed to start");
+            return;
+        }
+        /* The API key only opens records sealed before history.key existed. */
+        char *api_key = history_has_legacy_records() ? get_api_key(&app->cred_ui) : NULL;
+        gboolean unlocked = history_unlock(&app->cred_ui, api_key);
+        free_api_key(api_key);
+        if (!unlocked) {
+            schedule_append(app, "Chat history is locked; not sending until it is unlocked.");
+            return;
+        }
+        app->history_pending = FALSE;
+        restore_recent_history(app);
+    }
+
     schedule_append(app, "You: %s", message);
 
-    GeminiThreadData *td = g_new0(GeminiThreadData, 1);
-    td->app = app;
-    td->message = g_strdup(message);
-    g_thread_new("gemini-request", gemini_request_thread, td);
+    gemini_request_start(app, message);
 
     gtk_entry_set_text(GTK_ENTRY(app->chat_input_entry), "");
 }
 
-static void activate(GtkApplication *app_instance, gpointer user_data) {
-    AppWidgets *w = g_new0(AppWidgets, 1);
-    w->window = gtk_application_window_new(app_instance);
-    gtk_window_set_title(GTK_WINDOW(w->window), "Gemini API Key Manager");
-    gtk_window_set_default_size(GTK_WINDOW(w->window), 600, 400);
+static void on_chat_cancel_button_clicked(GtkButton *button, gpointer user_data) {
+    net_worker_cancel(0);
+}
 
-    w->stack = gtk_stack_new();
-    gtk_container_add(GTK_CONTAINER(w->window), w->stack);
+static void on_stats_back_button_clicked(GtkButton *button, gpointer user_data) {
+    AppWidgets *app = (AppWidgets*)user_data;
+    gtk_stack_set_visible_child_name(GTK_STACK(app->stack), "chat_view");
+}
 
+/* Lazily built pages. Only the chat page exists at startup; the key/endpoint page is
+ * built the first time it is needed and the stats page when it is first opened. */
+static void ensure_key_page(AppWidgets *app) {
+    if (app->api_key_entry) return;
     GtkWidget *api_key_vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 10);
     gtk_container_set_border_width(GTK_CONTAINER(api_key_vbox), 10);
-    gtk_stack_add_named(GTK_STACK(w->stack), api_key_vbox, "key_input_view");
 
     GtkWidget *api_label = gtk_label_new("Google Gemini API Key:");
     gtk_box_pack_start(GTK_BOX(api_key_vbox), api_label, FALSE, FALSE, 0);
 
-    w->api_key_entry = gtk_entry_new();
-    gtk_entry_set_placeholder_text(GTK_ENTRY(w->api_key_entry), "Enter your API key here");
-    gtk_box_pack_start(GTK_BOX(api_key_vbox), w->api_key_entry, FALSE, FALSE, 0);
+    app->api_key_entry = gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(app->api_key_entry), "Enter your API key here");
+    gtk_box_pack_start(GTK_BOX(api_key_vbox), app->api_key_entry, FALSE, FALSE, 0);
 
     GtkWidget *open_button = gtk_button_new_with_label("Get API Key");
     g_signal_connect(open_button, "clicked", G_CALLBACK(on_open_key_button_clicked), NULL);
     gtk_box_pack_start(GTK_BOX(api_key_vbox), open_button, FALSE, FALSE, 0);
 
     GtkWidget *save_button = gtk_button_new_with_label("Save API Key");
-    g_signal_connect(save_button, "clicked", G_CALLBACK(on_save_key_button_clicked), w);
+    g_signal_connect(save_button, "clicked", G_CALLBACK(on_save_key_button_clicked), app);
     gtk_box_pack_start(GTK_BOX(api_key_vbox), save_button, FALSE, FALSE, 0);
 
     GtkWidget *endpoint_label = gtk_label_new("API Endpoint (optional):");
     gtk_box_pack_start(GTK_BOX(api_key_vbox), endpoint_label, FALSE, FALSE, 0);
-    w->endpoint_entry = gtk_entry_new();
-    gtk_entry_set_placeholder_text(GTK_ENTRY(w->endpoint_entry), "https://generativelanguage.googleapis.com/....");
-    gtk_box_pack_start(GTK_BOX(api_key_vbox), w->endpoint_entry, FALSE, FALSE, 0);
+    app->endpoint_entry = gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(app->endpoint_entry), "https://generativelanguage.googleapis.com/....");
+    gtk_box_pack_start(GTK_BOX(api_key_vbox), app->endpoint_entry, FALSE, FALSE, 0);
 
     GtkWidget *save_ep_button = gtk_button_new_with_label("Save Endpoint");
-    g_signal_connect(save_ep_button, "clicked", G_CALLBACK(on_save_endpoint_button_clicked), w);
+    g_signal_connect(save_ep_button, "clicked", G_CALLBACK(on_save_endpoint_button_clicked), app);
     gtk_box_pack_start(GTK_BOX(api_key_vbox), save_ep_button, FALSE, FALSE, 0);
 
     GtkWidget *test_ep_button = gtk_button_new_with_label("Test Endpoint");
-    g_signal_connect(test_ep_button, "clicked", G_CALLBACK(on_test_endpoint_button_clicked), w);
+    g_signal_connect(test_ep_button, "clicked", G_CALLBACK(on_test_endpoint_button_clicked), app);
     gtk_box_pack_start(GTK_BOX(api_key_vbox), test_ep_button, FALSE, FALSE, 0);
 
+    gtk_widget_show_all(api_key_vbox);
+    gtk_stack_add_named(GTK_STACK(app->stack), api_key_vbox, "key_input_view");
+    load_endpoint_file(app);
+}
+
+static void show_key_page(AppWidgets *app) {
+    ensure_key_page(app);
+    gtk_stack_set_visible_child_name(GTK_STACK(app->stack), "key_input_view");
+    gtk_window_set_title(GTK_WINDOW(app->window), "Gemini API Key Manager");
+}
+
+static void ensure_stats_page(AppWidgets *app) {
+    if (app->stats_label) return;
+    GtkWidget *stats_vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 10);
+    gtk_container_set_border_width(GTK_CONTAINER(stats_vbox), 10);
+    app->stats_label = gtk_label_new(NULL);
+    gtk_label_set_selectable(GTK_LABEL(app->stats_label), TRUE);
+    gtk_label_set_xalign(GTK_LABEL(app->stats_label), 0.0);
+    gtk_label_set_yalign(GTK_LABEL(app->stats_label), 0.0);
+    gtk_style_context_add_class(gtk_widget_get_style_context(app->stats_label), "monospace");
+    gtk_box_pack_start(GTK_BOX(stats_vbox), app->stats_label, TRUE, TRUE, 0);
+    GtkWidget *stats_back = gtk_button_new_with_label("Back to chat");
+    g_signal_connect(stats_back, "clicked", G_CALLBACK(on_stats_back_button_clicked), app);
+    gtk_box_pack_start(GTK_BOX(stats_vbox), stats_back, FALSE, FALSE, 0);
+
+    gtk_widget_show_all(stats_vbox);
+    gtk_stack_add_named(GTK_STACK(app->stack), stats_vbox, "stats_view");
+    g_timeout_add_seconds(1, stats_refresh, app);
+}
+
+static gboolean on_first_draw(GtkWidget *widget, cairo_t *cr, gpointer user_data) {
+    double ms = (g_get_monotonic_time() - startup_time) / 1000.0;
+    stats_record(STAT_FIRST_PAINT, ms);
+    g_debug("first paint %.1f ms after start", ms);
+    g_signal_handlers_disconnect_by_func(widget, on_first_draw, user_data);
+    return FALSE;
+}
+
+/* Startup only checks that a key file exists; decrypting it (and any passphrase prompt)
+ * is left to get_api_key on the first send. */
+static void load_api_key(AppWidgets *app) {
+    if (!chat_backend_active(app)->needs_api_key) return;
+    gchar *enc_path = get_api_key_enc_path();
+    gchar *plain_path = get_api_key_plain_path();
+    if (!g_file_test(enc_path, G_FILE_TEST_EXISTS) && !g_file_test(plain_path, G_FILE_TEST_EXISTS)) {
+        show_key_page(app);
+    }
+    g_free(plain_path);
+    g_free(enc_path);
+}
+
+static void on_stats_button_clicked(GtkButton *button, gpointer user_data) {
+    AppWidgets *app = (AppWidgets*)user_data;
+    ensure_stats_page(app);
+    gtk_stack_set_visible_child_name(GTK_STACK(app->stack), "stats_view");
+    stats_refresh(app);
+}
+
+static void activate(GtkApplication *app_instance, gpointer user_data) {
+    AppWidgets *w = g_new0(AppWidgets, 1);
+    w->window = gtk_application_window_new(app_instance);
+    w->cred_ui.passphrase = app_passphrase;
+    w->cred_ui.report = app_report;
+    w->cred_ui.user_data = w;
+    gtk_window_set_title(GTK_WINDOW(w->window), "Gemini Chat");
+    gtk_window_set_default_size(GTK_WINDOW(w->window), 600, 400);
+
+    w->stack = gtk_stack_new();
+    gtk_container_add(GTK_CONTAINER(w->window), w->stack);
+
     GtkWidget *chat_vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 10);
     gtk_container_set_border_width(GTK_CONTAINER(chat_vbox), 10);
     gtk_stack_add_named(GTK_STACK(w->stack), chat_vbox, "chat_view");
@@ -615,8 +1170,12 @@ static void activate(GtkApplication *app_instance, gpointer user_data) {
     w->chat_view = gtk_text_view_new();
     gtk_text_view_set_editable(GTK_TEXT_VIEW(w->chat_view), FALSE);
     gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(w->chat_view), GTK_WRAP_WORD);
+    w->transcript = transcript_new();
     GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
     gtk_container_add(GTK_CONTAINER(scrolled), w->chat_view);
+    /* After the add: the scrolled window hands the view its own adjustment. */
+    g_signal_connect(gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(scrolled)), "value-changed",
+                     G_CALLBACK(on_transcript_scrolled), w);
     gtk_box_pack_start(GTK_BOX(chat_vbox), scrolled, TRUE, TRUE, 0);
 
     GtkWidget *hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
@@ -627,23 +1186,63 @@ static void activate(GtkApplication *app_instance, gpointer user_data) {
     w->chat_send_button = gtk_button_new_with_label("Send");
     g_signal_connect(w->chat_send_button, "clicked", G_CALLBACK(on_chat_send_button_clicked), w);
     gtk_box_pack_start(GTK_BOX(hbox), w->chat_send_button, FALSE, FALSE, 0);
-
+    w->chat_stream_toggle = gtk_check_button_new_with_label("Stream");
+    const char *stream_env = getenv("GEMINI_STREAM");
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(w->chat_stream_toggle), stream_env && strcmp(stream_env, "1") == 0);
+    gtk_box_pack_start(GTK_BOX(hbox), w->chat_stream_toggle, FALSE, FALSE, 0);
+    w->chat_backend_combo = gtk_combo_box_text_new();
+    for (gsize i = 0; i < G_N_ELEMENTS(chat_backends); i++) {
+        gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(w->chat_backend_combo), chat_backends[i]->id, chat_backends[i]->label);
+    }
+    const char *backend_env = getenv("GEMINI_BACKEND");
+    if (!backend_env || !gtk_combo_box_set_active_id(GTK_COMBO_BOX(w->chat_backend_combo), backend_env)) {
+        gtk_combo_box_set_active_id(GTK_COMBO_BOX(w->chat_backend_combo), gemini_backend.id);
+    }
+    on_chat_backend_changed(GTK_COMBO_BOX(w->chat_backend_combo), w);
+    g_signal_connect(w->chat_backend_combo, "changed", G_CALLBACK(on_chat_backend_changed), w);
+    gtk_box_pack_start(GTK_BOX(hbox), w->chat_backend_combo, FALSE, FALSE, 0);
+    w->chat_cancel_button = gtk_button_new_with_label("Cancel");
+    g_signal_connect(w->chat_cancel_button, "clicked", G_CALLBACK(on_chat_cancel_button_clicked), w);
+    gtk_box_pack_start(GTK_BOX(hbox), w->chat_cancel_button, FALSE, FALSE, 0);
+    GtkWidget *stats_button = gtk_button_new_with_label("Stats");
+    g_signal_connect(stats_button, "clicked", G_CALLBACK(on_stats_button_clicked), w);
+    gtk_box_pack_start(GTK_BOX(hbox), stats_button, FALSE, FALSE, 0);
+
+    w->history_pending = history_encrypted();
+    if (!w->history_pending) restore_recent_history(w);
     load_api_key(w);
-    load_endpoint_file(w);
 
+    g_signal_connect(w->window, "draw", G_CALLBACK(on_first_draw), w);
     gtk_widget_show_all(w->window);
 }
 
 int main(int argc, char **argv) {
-    if (sodium_init() < 0) {
-        g_printerr("libsodium initialization failed\n");
-        return 1;
+    startup_time = g_get_monotonic_time();
+    /* Headless mode never touches GTK, so it runs without a display. */
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0) return batch_main(argc, argv);
+
+    /* --dump-stats: print the latency summary as JSON on exit. GApplication would
+     * treat it as a file to open, so it is taken out of argv first. */
+    gboolean dump_stats = FALSE;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dump-stats") != 0) continue;
+        dump_stats = TRUE;
+        memmove(&argv[i], &argv[i + 1], (size_t)(argc - i) * sizeof(char*));
+        argc--;
+        i--;
     }
-    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    /* The window goes up while libsodium, curl/TLS and the network worker start in
+     * the background; the first send or key save waits for them. */
+    gemini_core_start();
+    conversation_log_open();
+    g_unix_signal_add(SIGUSR1, on_sigusr1, NULL);
     GtkApplication *app = gtk_application_new("com.example.GeminiApp", G_APPLICATION_DEFAULT_FLAGS);
     g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
     int status = g_application_run(G_APPLICATION(app), argc, argv);
     g_object_unref(app);
-        curl_global_cleanup();
+    if (dump_stats) stats_dump();
+    gemini_core_shutdown();
+    conversation_log_close();
         return status;
-}
\ No newline at end of file
+}
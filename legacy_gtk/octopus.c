@@ -0,0 +1,928 @@
+/* octopus: the encrypted store written by scripts/octopus_init.sh and read back by
+ * scripts/octopus_extract.sh.
+ *
+ *   octopus create  -p PASSFILE -f ARCHIVE [-j N] [--chunk-size MiB] [--level 0-9] PATH...
+ *   octopus extract -p PASSFILE -f ARCHIVE [-C DIR] [-j N] [--owner UID:GID] [PATH...]
+ *   octopus list    -p PASSFILE -f ARCHIVE
+ *
+ * "-p -" reads the password from stdin; -j defaults to the number of cores. extract
+ * --owner runs as that user once the archive is open, so a root caller (reading a
+ * root-owned store) restores into DEST with the user's rights only; paths that lead
+ * through a symlink in DEST are refused and outputs are never followed. File contents
+ * are concatenated into one logical stream cut into fixed-size chunks. Each chunk is
+ * deflated on its own and sealed as a one-message libsodium secretstream with the
+ * archive header and the chunk number as associated data, so chunks are compressed,
+ * sealed and restored on all cores in any order and cannot be moved between positions
+ * or archives. The index of chunks and entries, sealed the same way, sits at the end:
+ * extracting some paths reads only the chunks that cover them.
+ *
+ * Layout, integers little endian:
+ *   header   "OCTOPUS1" | alg u8 | ops u64 | mem u64 | salt[16] | archive id[16] | chunk size u32
+ *   chunks   secretstream header[24] | ciphertext (deflated or stored)
+ *   index    secretstream header[24] | ciphertext of the deflated index
+ *   trailer  "OCTOIDX1" | index offset u64 | index size u64 | index raw size u64
+ * The key is Argon2id over the password with the salt and limits from the header. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <grp.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <glib.h>
+#include <sodium.h>
+#include <zlib.h>
+
+#define OCT_MAGIC "OCTOPUS1"
+#define OCT_TRAILER_MAGIC "OCTOIDX1"
+#define OCT_MAGIC_LEN 8
+#define OCT_ID_BYTES 16
+#define OCT_HEADER_LEN (OCT_MAGIC_LEN + 1 + 8 + 8 + crypto_pwhash_SALTBYTES + OCT_ID_BYTES + 4)
+#define OCT_TRAILER_LEN (OCT_MAGIC_LEN + 8 + 8 + 8)
+#define OCT_AD_LEN (OCT_HEADER_LEN + 8)
+#define OCT_SEAL_OVERHEAD (crypto_secretstream_xchacha20poly1305_HEADERBYTES + crypto_secretstream_xchacha20poly1305_ABYTES)
+#define OCT_INDEX_CHUNK G_MAXUINT64
+#define OCT_DEFAULT_CHUNK_MIB 1
+#define OCT_MAX_CHUNK_MIB 64
+#define OCT_CHUNK_DEFLATE 0x01
+
+typedef enum { OCT_FILE = 0, OCT_DIR = 1, OCT_SYMLINK = 2 } OctType;
+
+typedef struct {
+    guint8 type;
+    guint32 mode;
+    gint64 mtime;
+    guint64 size;
+    guint64 offset;   /* start of the contents in the logical stream */
+    gchar *path;      /* relative archive path */
+    gchar *link;      /* symlink target */
+    gchar *source;    /* create: path on disk; extract: output path */
+    gboolean selected;
+} OctEntry;
+
+typedef struct {
+    guint64 offset;   /* in the archive file */
+    guint32 stored;   /* sealed size */
+    guint32 raw;      /* size in the logical stream */
+    guint8 flags;
+    guint64 start;    /* logical stream offset, derived from the raw sizes */
+} OctChunk;
+
+typedef struct {
+    int fd;
+    unsigned char header[OCT_HEADER_LEN];
+    unsigned char key[crypto_secretstream_xchacha20poly1305_KEYBYTES];
+    guint32 chunk_size;
+    GArray *chunks;     /* OctChunk */
+    GPtrArray *entries; /* OctEntry*, files in stream order */
+} OctArchive;
+
+static void put_u32(unsigned char *p, guint32 v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static void put_u64(unsigned char *p, guint64 v) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static guint32 get_u32(const unsigned char *p) {
+    guint32 v = 0;
+    for (int i = 3; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+static guint64 get_u64(const unsigned char *p) {
+    guint64 v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+static void oct_entry_free(gpointer data) {
+    OctEntry *e = (OctEntry*)data;
+    g_free(e->path);
+    g_free(e->link);
+    g_free(e->source);
+    g_free(e);
+}
+
+static void oct_archive_clear(OctArchive *ar) {
+    if (ar->fd >= 0) close(ar->fd);
+    if (ar->chunks) g_array_free(ar->chunks, TRUE);
+    if (ar->entries) g_ptr_array_free(ar->entries, TRUE);
+    sodium_memzero(ar->key, sizeof ar->key);
+}
+
+static gboolean write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FALSE;
+        p += n;
+        len -= (size_t)n;
+    }
+    return TRUE;
+}
+
+static gboolean pwrite_all(int fd, const void *buf, size_t len, off_t off) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FALSE;
+        p += n;
+        off += n;
+        len -= (size_t)n;
+    }
+    return TRUE;
+}
+
+static gboolean pread_all(int fd, void *buf, size_t len, off_t off) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = pread(fd, p, len, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FALSE;
+        p += n;
+        off += n;
+        len -= (size_t)n;
+    }
+    return TRUE;
+}
+
+/* Password file contents without the trailing newline; "-" reads stdin. */
+static gchar *read_password(const char *path) {
+    gchar *data = NULL;
+    if (strcmp(path, "-") == 0) {
+        GString *in = g_string_new(NULL);
+        char buf[256];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof buf, stdin)) > 0) g_string_append_len(in, buf, (gssize)n);
+        sodium_memzero(buf, sizeof buf);
+        data = g_string_free(in, FALSE);
+    } else if (!g_file_get_contents(path, &data, NULL, NULL)) {
+        g_printerr("octopus: cannot read password file %s\n", path);
+        return NULL;
+    }
+    g_strstrip(data);
+    if (!*data) {
+        g_printerr("octopus: empty password\n");
+        g_free(data);
+        return NULL;
+    }
+    return data;
+}
+
+static gboolean oct_derive_key(OctArchive *ar, const char *password) {
+    const unsigned char *p = ar->header + OCT_MAGIC_LEN;
+    int alg = p[0];
+    guint64 ops = get_u64(p + 1), mem = get_u64(p + 9);
+    if (alg != crypto_pwhash_ALG_ARGON2ID13 || ops < crypto_pwhash_OPSLIMIT_MIN || ops > 64 ||
+        mem < crypto_pwhash_MEMLIMIT_MIN || mem > (G_GUINT64_CONSTANT(1) << 32)) {
+        g_printerr("octopus: unsupported key derivation parameters\n");
+        return FALSE;
+    }
+    if (crypto_pwhash(ar->key, sizeof ar->key, password, strlen(password), p + 17, ops, (size_t)mem, alg) != 0) {
+        g_printerr("octopus: key derivation failed (out of memory?)\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void oct_ad(const OctArchive *ar, guint64 chunk_no, unsigned char *ad) {
+    memcpy(ad, ar->header, OCT_HEADER_LEN);
+    put_u64(ad + OCT_HEADER_LEN, chunk_no);
+}
+
+/* out must hold len + OCT_SEAL_OVERHEAD bytes. */
+static gboolean oct_seal(const OctArchive *ar, guint64 chunk_no, const unsigned char *in, size_t len, unsigned char *out) {
+    crypto_secretstream_xchacha20poly1305_state st;
+    unsigned char ad[OCT_AD_LEN];
+    oct_ad(ar, chunk_no, ad);
+    if (crypto_secretstream_xchacha20poly1305_init_push(&st, out, ar->key) != 0) return FALSE;
+    return crypto_secretstream_xchacha20poly1305_push(&st, out + crypto_secretstream_xchacha20poly1305_HEADERBYTES, NULL,
+                                                      in, len, ad, sizeof ad,
+                                                      crypto_secretstream_xchacha20poly1305_TAG_FINAL) == 0;
+}
+
+/* out must hold len - OCT_SEAL_OVERHEAD bytes. */
+static gboolean oct_open(const OctArchive *ar, guint64 chunk_no, const unsigned char *in, size_t len, unsigned char *out) {
+    crypto_secretstream_xchacha20poly1305_state st;
+    unsigned char ad[OCT_AD_LEN], tag = 0;
+    if (len < OCT_SEAL_OVERHEAD) return FALSE;
+    oct_ad(ar, chunk_no, ad);
+    if (crypto_secretstream_xchacha20poly1305_init_pull(&st, in, ar->key) != 0) return FALSE;
+    if (crypto_secretstream_xchacha20poly1305_pull(&st, out, NULL, &tag,
+                                                   in + crypto_secretstream_xchacha20poly1305_HEADERBYTES,
+                                                   len - crypto_secretstream_xchacha20poly1305_HEADERBYTES,
+                                                   ad, sizeof ad) != 0) return FALSE;
+    return tag == crypto_secretstream_xchacha20poly1305_TAG_FINAL;
+}
+
+/* Index: u64 chunk count, then offset u64 | stored u32 | raw u32 | flags u8 per chunk;
+ * u64 entry count, then type u8 | mode u32 | mtime u64 | size u64 | offset u64 |
+ * path len u16 | path | link len u16 | link per entry. */
+static void oct_index_write(const OctArchive *ar, GString *out) {
+    unsigned char buf[8];
+    put_u64(buf, ar->chunks->len);
+    g_string_append_len(out, (const gchar*)buf, 8);
+    for (guint i = 0; i < ar->chunks->len; i++) {
+        const OctChunk *c = &g_array_index(ar->chunks, OctChunk, i);
+        unsigned char rec[17];
+        put_u64(rec, c->offset);
+        put_u32(rec + 8, c->stored);
+        put_u32(rec + 12, c->raw);
+        rec[16] = c->flags;
+        g_string_append_len(out, (const gchar*)rec, sizeof rec);
+    }
+    put_u64(buf, ar->entries->len);
+    g_string_append_len(out, (const gchar*)buf, 8);
+    for (guint i = 0; i < ar->entries->len; i++) {
+        const OctEntry *e = g_ptr_array_index(ar->entries, i);
+        unsigned char rec[31];
+        gsize path_len = strlen(e->path), link_len = e->link ? strlen(e->link) : 0;
+        rec[0] = e->type;
+        put_u32(rec + 1, e->mode);
+        put_u64(rec + 5, (guint64)e->mtime);
+        put_u64(rec + 13, e->size);
+        put_u64(rec + 21, e->offset);
+        rec[29] = (unsigned char)path_len;
+        rec[30] = (unsigned char)(path_len >> 8);
+        g_string_append_len(out, (const gchar*)rec, sizeof rec);
+        g_string_append_len(out, e->path, (gssize)path_len);
+        buf[0] = (unsigned char)link_len;
+        buf[1] = (unsigned char)(link_len >> 8);
+        g_string_append_len(out, (const gchar*)buf, 2);
+        if (link_len) g_string_append_len(out, e->link, (gssize)link_len);
+    }
+}
+
+static gboolean oct_index_read(OctArchive *ar, const unsigned char *p, gsize len) {
+    const unsigned char *end = p + len;
+    if (end - p < 8) return FALSE;
+    guint64 n = get_u64(p);
+    p += 8;
+    if (n > (guint64)(end - p) / 17) return FALSE;
+    guint64 start = 0;
+    for (guint64 i = 0; i < n; i++, p += 17) {
+        OctChunk c = { get_u64(p), get_u32(p + 8), get_u32(p + 12), p[16], start };
+        if (c.raw > ar->chunk_size || c.stored > c.raw + OCT_SEAL_OVERHEAD + 64 + c.raw / 100) return FALSE;
+        start += c.raw;
+        g_array_append_val(ar->chunks, c);
+    }
+    if (end - p < 8) return FALSE;
+    n = get_u64(p);
+    p += 8;
+    for (guint64 i = 0; i < n; i++) {
+        if (end - p < 33) return FALSE;
+        OctEntry *e = g_new0(OctEntry, 1);
+        e->type = p[0];
+        e->mode = get_u32(p + 1);
+        e->mtime = (gint64)get_u64(p + 5);
+        e->size = get_u64(p + 13);
+        e->offset = get_u64(p + 21);
+        gsize path_len = p[29] | (p[30] << 8);
+        p += 31;
+        gboolean ok = e->type <= OCT_SYMLINK && (gsize)(end - p) >= path_len + 2 && path_len > 0 &&
+                      (e->type != OCT_FILE || (e->offset <= start && e->size <= start - e->offset));
+        gsize link_len = 0;
+        if (ok) {
+            e->path = g_strndup((const gchar*)p, path_len);
+            p += path_len;
+            link_len = p[0] | (p[1] << 8);
+            p += 2;
+            ok = (gsize)(end - p) >= link_len;
+        }
+        if (ok && link_len) {
+            e->link = g_strndup((const gchar*)p, link_len);
+            p += link_len;
+        }
+        if (!ok) {
+            oct_entry_free(e);
+            return FALSE;
+        }
+        g_ptr_array_add(ar->entries, e);
+    }
+    return p == end;
+}
+
+/* ---- create ---- */
+
+static GPtrArray *walk_entries;
+static gsize walk_prefix;
+
+static int walk_visit(const char *fpath, const struct stat *st, int flag, struct FTW *ftw) {
+    OctEntry *e = g_new0(OctEntry, 1);
+    e->mode = st->st_mode & 07777;
+    e->mtime = st->st_mtime;
+    if (S_ISREG(st->st_mode)) {
+        e->type = OCT_FILE;
+        e->size = (guint64)st->st_size;
+    } else if (S_ISDIR(st->st_mode)) {
+        e->type = OCT_DIR;
+    } else if (S_ISLNK(st->st_mode)) {
+        e->type = OCT_SYMLINK;
+        gchar target[4096];
+        ssize_t n = readlink(fpath, target, sizeof target - 1);
+        if (n < 0) {
+            g_printerr("octopus: skipping %s: %s\n", fpath, g_strerror(errno));
+            g_free(e);
+            return 0;
+        }
+        e->link = g_strndup(target, (gsize)n);
+    } else {
+        if (flag == FTW_DNR || flag == FTW_NS) g_printerr("octopus: skipping %s: not readable\n", fpath);
+        else g_printerr("octopus: skipping %s: not a file, directory or symlink\n", fpath);
+        g_free(e);
+        return 0;
+    }
+    e->source = g_strdup(fpath);
+    e->path = g_strdup(fpath + walk_prefix);
+    if (strlen(e->path) > G_MAXUINT16) {
+        g_printerr("octopus: skipping %s: path too long\n", fpath);
+        oct_entry_free(e);
+        return 0;
+    }
+    g_ptr_array_add(walk_entries, e);
+    return 0;
+}
+
+typedef struct {
+    OctArchive *ar;
+    guint64 no;
+    unsigned char *raw;
+    gsize raw_len;
+    unsigned char *out;
+    gsize out_len;
+    guint8 flags;
+    int level;
+    gboolean done;
+    gboolean ok;
+} SealJob;
+
+typedef struct {
+    GMutex lock;
+    GCond cond;
+} JobSync;
+
+static JobSync job_sync;
+
+static void seal_job_run(gpointer data, gpointer user_data) {
+    SealJob *job = (SealJob*)data;
+    uLongf packed_len = compressBound(job->raw_len);
+    unsigned char *packed = g_malloc(packed_len);
+    const unsigned char *payload = job->raw;
+    gsize payload_len = job->raw_len;
+    job->flags = 0;
+    if (job->level > 0 && compress2(packed, &packed_len, job->raw, job->raw_len, job->level) == Z_OK &&
+        packed_len < job->raw_len) {
+        payload = packed;
+        payload_len = packed_len;
+        job->flags = OCT_CHUNK_DEFLATE;
+    }
+    job->out = g_malloc(payload_len + OCT_SEAL_OVERHEAD);
+    job->out_len = payload_len + OCT_SEAL_OVERHEAD;
+    gboolean ok = oct_seal(job->ar, job->no, payload, payload_len, job->out);
+    g_free(packed);
+
+    g_mutex_lock(&job_sync.lock);
+    job->ok = ok;
+    job->done = TRUE;
+    g_cond_broadcast(&job_sync.cond);
+    g_mutex_unlock(&job_sync.lock);
+}
+
+/* Writes the oldest submitted job once it is sealed; chunks land in stream order. */
+static gboolean seal_job_retire(OctArchive *ar, GPtrArray *pending, guint64 *pos) {
+    SealJob *job = g_ptr_array_index(pending, 0);
+    g_mutex_lock(&job_sync.lock);
+    while (!job->done) g_cond_wait(&job_sync.cond, &job_sync.lock);
+    g_mutex_unlock(&job_sync.lock);
+    g_ptr_array_remove_index(pending, 0);
+
+    gboolean ok = job->ok && write_all(ar->fd, job->out, job->out_len);
+    if (ok) {
+        OctChunk c = { *pos, (guint32)job->out_len, (guint32)job->raw_len, job->flags, 0 };
+        g_array_append_val(ar->chunks, c);
+        *pos += job->out_len;
+    }
+    g_free(job->raw);
+    g_free(job->out);
+    g_free(job);
+    return ok;
+}
+
+static int oct_create(const char *password, const char *archive, char **paths, int n_paths,
+                      guint threads, guint32 chunk_size, int level) {
+    OctArchive ar = { .fd = -1 };
+    ar.chunk_size = chunk_size;
+    ar.chunks = g_array_new(FALSE, FALSE, sizeof(OctChunk));
+    ar.entries = g_ptr_array_new_with_free_func(oct_entry_free);
+
+    walk_entries = ar.entries;
+    for (int i = 0; i < n_paths; i++) {
+        gchar *path = g_strdup(paths[i]);
+        gsize len = strlen(path);
+        while (len > 1 && path[len - 1] == '/') path[--len] = '\0';
+        const char *base = strrchr(path, '/');
+        walk_prefix = base && base[1] ? (gsize)(base + 1 - path) : 0;
+        if (nftw(path, walk_visit, 64, FTW_PHYS) != 0) {
+            g_printerr("octopus: cannot read %s: %s\n", path, g_strerror(errno));
+            g_free(path);
+            oct_archive_clear(&ar);
+            return 1;
+        }
+        g_free(path);
+    }
+    guint64 total = 0;
+    for (guint i = 0; i < ar.entries->len; i++) {
+        OctEntry *e = g_ptr_array_index(ar.entries, i);
+        e->offset = total;
+        total += e->size;
+    }
+
+    unsigned char *h = ar.header;
+    memcpy(h, OCT_MAGIC, OCT_MAGIC_LEN);
+    h[OCT_MAGIC_LEN] = crypto_pwhash_ALG_ARGON2ID13;
+    put_u64(h + OCT_MAGIC_LEN + 1, crypto_pwhash_OPSLIMIT_INTERACTIVE);
+    put_u64(h + OCT_MAGIC_LEN + 9, crypto_pwhash_MEMLIMIT_INTERACTIVE);
+    randombytes_buf(h + OCT_MAGIC_LEN + 17, crypto_pwhash_SALTBYTES + OCT_ID_BYTES);
+    put_u32(h + OCT_HEADER_LEN - 4, chunk_size);
+    if (!oct_derive_key(&ar, password)) {
+        oct_archive_clear(&ar);
+        return 1;
+    }
+
+    ar.fd = open(archive, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (ar.fd < 0 || !write_all(ar.fd, ar.header, OCT_HEADER_LEN)) {
+        g_printerr("octopus: cannot write %s: %s\n", archive, g_strerror(errno));
+        oct_archive_clear(&ar);
+        return 1;
+    }
+
+    gint64 started = g_get_monotonic_time();
+    GThreadPool *pool = g_thread_pool_new(seal_job_run, NULL, (gint)threads, TRUE, NULL);
+    GPtrArray *pending = g_ptr_array_new();
+    guint64 pos = OCT_HEADER_LEN;
+    gboolean ok = TRUE;
+    SealJob *job = NULL;
+    for (guint i = 0; ok && i <= ar.entries->len; i++) {
+        OctEntry *e = i < ar.entries->len ? g_ptr_array_index(ar.entries, i) : NULL;
+        int fd = -1;
+        if (e && e->type == OCT_FILE && e->size > 0) {
+            fd = open(e->source, O_RDONLY | O_CLOEXEC);
+            if (fd < 0) g_printerr("octopus: %s: %s; storing zeros\n", e->source, g_strerror(errno));
+        } else if (e) {
+            continue;
+        }
+        guint64 left = e ? e->size : 0;
+        gboolean short_read = FALSE;
+        /* The last pass (e == NULL) only flushes the final partial chunk. */
+        while (ok && (left > 0 || (!e && job && job->raw_len > 0))) {
+            if (!job) {
+                job = g_new0(SealJob, 1);
+                job->ar = &ar;
+                job->no = ar.chunks->len + pending->len;
+                job->raw = g_malloc(chunk_size);
+                job->level = level;
+            }
+            gsize want = MIN(left, (guint64)(chunk_size - job->raw_len));
+            gsize got = 0;
+            while (fd >= 0 && got < want) {
+                ssize_t n = read(fd, job->raw + job->raw_len + got, want - got);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                got += (gsize)n;
+            }
+            if (got < want) {
+                memset(job->raw + job->raw_len + got, 0, want - got);
+                if (fd >= 0 && !short_read) g_printerr("octopus: %s shrank while reading; padding with zeros\n", e->source);
+                short_read = TRUE;
+            }
+            job->raw_len += want;
+            left -= want;
+            if (job->raw_len == chunk_size || !e) {
+                g_ptr_array_add(pending, job);
+                g_thread_pool_push(pool, job, NULL);
+                job = NULL;
+                while (ok && pending->len >= threads * 2) ok = seal_job_retire(&ar, pending, &pos);
+            }
+        }
+        if (fd >= 0) close(fd);
+    }
+    if (job) {
+        g_free(job->raw);
+        g_free(job);
+    }
+    while (pending->len > 0) ok = seal_job_retire(&ar, pending, &pos) && ok;
+    g_thread_pool_free(pool, FALSE, TRUE);
+    g_ptr_array_free(pending, TRUE);
+
+    if (ok) {
+        GString *index = g_string_new(NULL);
+        oct_index_write(&ar, index);
+        uLongf packed_len = compressBound(index->len);
+        unsigned char *packed = g_malloc(packed_len);
+        unsigned char *sealed = NULL;
+        ok = compress2(packed, &packed_len, (const Bytef*)index->str, index->len, 9) == Z_OK;
+        if (ok) {
+            sealed = g_malloc(packed_len + OCT_SEAL_OVERHEAD);
+            ok = oct_seal(&ar, OCT_INDEX_CHUNK, packed, packed_len, sealed);
+        }
+        unsigned char trailer[OCT_TRAILER_LEN];
+        memcpy(trailer, OCT_TRAILER_MAGIC, OCT_MAGIC_LEN);
+        put_u64(trailer + 8, pos);
+        put_u64(trailer + 16, packed_len + OCT_SEAL_OVERHEAD);
+        put_u64(trailer + 24, index->len);
+        ok = ok && write_all(ar.fd, sealed, packed_len + OCT_SEAL_OVERHEAD) &&
+             write_all(ar.fd, trailer, sizeof trailer) && fsync(ar.fd) == 0;
+        g_free(sealed);
+        g_free(packed);
+        g_string_free(index, TRUE);
+    }
+    if (!ok) {
+        g_printerr("octopus: failed writing %s\n", archive);
+        unlink(archive);
+    } else {
+        double secs = (g_get_monotonic_time() - started) / 1e6;
+        g_printerr("octopus: %u entries, %.1f MiB in %u chunks -> %.1f MiB, %.2f s on %u threads\n",
+                   ar.entries->len, total / 1048576.0, ar.chunks->len, pos / 1048576.0, secs, threads);
+    }
+    oct_archive_clear(&ar);
+    return ok ? 0 : 1;
+}
+
+/* ---- extract / list ---- */
+
+static gboolean oct_open_file(OctArchive *ar, const char *archive) {
+    ar->fd = open(archive, O_RDONLY | O_CLOEXEC);
+    if (ar->fd < 0) {
+        g_printerr("octopus: cannot open %s: %s\n", archive, g_strerror(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Read the index of the archive open on ar->fd. */
+static gboolean oct_load(OctArchive *ar, const char *archive, const char *password) {
+    ar->chunks = g_array_new(FALSE, FALSE, sizeof(OctChunk));
+    ar->entries = g_ptr_array_new_with_free_func(oct_entry_free);
+    struct stat st;
+    unsigned char trailer[OCT_TRAILER_LEN];
+    if (fstat(ar->fd, &st) != 0) {
+        g_printerr("octopus: cannot stat %s: %s\n", archive, g_strerror(errno));
+        return FALSE;
+    }
+    if (st.st_size < OCT_HEADER_LEN + OCT_TRAILER_LEN || !pread_all(ar->fd, ar->header, OCT_HEADER_LEN, 0) ||
+        memcmp(ar->header, OCT_MAGIC, OCT_MAGIC_LEN) != 0 ||
+        !pread_all(ar->fd, trailer, sizeof trailer, st.st_size - OCT_TRAILER_LEN) ||
+        memcmp(trailer, OCT_TRAILER_MAGIC, OCT_MAGIC_LEN) != 0) {
+        g_printerr("octopus: %s is not an octopus archive (or is truncated)\n", archive);
+        return FALSE;
+    }
+    ar->chunk_size = get_u32(ar->header + OCT_HEADER_LEN - 4);
+    guint64 index_off = get_u64(trailer + 8), index_len = get_u64(trailer + 16), index_raw = get_u64(trailer + 24);
+    guint64 limit = (guint64)st.st_size - OCT_TRAILER_LEN;
+    if (ar->chunk_size == 0 || ar->chunk_size > OCT_MAX_CHUNK_MIB * 1048576u || index_off < OCT_HEADER_LEN ||
+        index_len < OCT_SEAL_OVERHEAD || index_len > limit - index_off || index_raw > 1024u * 1048576u) {
+        g_printerr("octopus: %s has a damaged trailer\n", archive);
+        return FALSE;
+    }
+    if (!oct_derive_key(ar, password)) return FALSE;
+
+    unsigned char *sealed = g_malloc(index_len);
+    unsigned char *packed = g_malloc(index_len - OCT_SEAL_OVERHEAD);
+    unsigned char *raw = g_malloc(index_raw ? index_raw : 1);
+    uLongf raw_len = index_raw;
+    gboolean ok = pread_all(ar->fd, sealed, index_len, (off_t)index_off) &&
+                  oct_open(ar, OCT_INDEX_CHUNK, sealed, index_len, packed);
+    if (!ok) {
+        g_printerr("octopus: wrong password, or the index of %s was modified\n", archive);
+    } else if (uncompress(raw, &raw_len, packed, index_len - OCT_SEAL_OVERHEAD) != Z_OK || raw_len != index_raw ||
+               !oct_index_read(ar, raw, raw_len)) {
+        g_printerr("octopus: %s has a malformed index\n", archive);
+        ok = FALSE;
+    }
+    for (guint i = 0; ok && i < ar->chunks->len; i++) {
+        const OctChunk *c = &g_array_index(ar->chunks, OctChunk, i);
+        if (c->offset < OCT_HEADER_LEN || c->offset > index_off || c->stored > index_off - c->offset) {
+            g_printerr("octopus: %s has chunks outside the data area\n", archive);
+            ok = FALSE;
+        }
+    }
+    g_free(raw);
+    g_free(packed);
+    g_free(sealed);
+    return ok;
+}
+
+/* Archive paths are relative and never climb out of the destination. */
+static gboolean safe_path(const char *path) {
+    if (path[0] == '/') return FALSE;
+    gchar **parts = g_strsplit(path, "/", -1);
+    gboolean ok = TRUE;
+    for (int i = 0; parts[i]; i++) {
+        if (strcmp(parts[i], "..") == 0) ok = FALSE;
+    }
+    g_strfreev(parts);
+    return ok;
+}
+
+/* Create the directories leading to dest/path (and path itself when it is a directory
+ * entry), refusing to pass through anything in dest that is not a real directory: a
+ * symlink left there, or one an earlier entry restored, must not redirect writes. */
+static gboolean make_dirs_under(const char *dest, const char *path, gboolean whole) {
+    gchar **parts = g_strsplit(path, "/", -1);
+    guint n = g_strv_length(parts);
+    GString *at = g_string_new(dest);
+    gboolean ok = TRUE;
+    for (guint i = 0; ok && i + (whole ? 0 : 1) < n; i++) {
+        if (!*parts[i] || strcmp(parts[i], ".") == 0) continue;
+        g_string_append_c(at, '/');
+        g_string_append(at, parts[i]);
+        struct stat st;
+        if (lstat(at->str, &st) == 0) {
+            if (!S_ISDIR(st.st_mode)) {
+                errno = S_ISLNK(st.st_mode) ? ELOOP : ENOTDIR;
+                ok = FALSE;
+            }
+        } else {
+            ok = errno == ENOENT && mkdir(at->str, 0700) == 0;
+        }
+    }
+    g_string_free(at, TRUE);
+    g_strfreev(parts);
+    return ok;
+}
+
+/* Become the --owner user for good. Supplementary groups go first, while we may. */
+static gboolean drop_privileges(uid_t uid, gid_t gid) {
+    if (geteuid() == 0 && setgroups(0, NULL) != 0) return FALSE;
+    if (setresgid(gid, gid, gid) != 0 || setresuid(uid, uid, uid) != 0) return FALSE;
+    uid_t ru, eu, su;
+    gid_t rg, eg, sg;
+    return getresuid(&ru, &eu, &su) == 0 && getresgid(&rg, &eg, &sg) == 0 &&
+           ru == uid && eu == uid && su == uid && rg == gid && eg == gid && sg == gid;
+}
+
+typedef struct {
+    OctArchive *ar;
+    GPtrArray *files; /* selected OctEntry* with contents, in stream order */
+    gint failed;
+} RestoreRun;
+
+typedef struct {
+    RestoreRun *run;
+    guint chunk;
+} RestoreJob;
+
+static void restore_job_run(gpointer data, gpointer user_data) {
+    RestoreJob *job = (RestoreJob*)data;
+    RestoreRun *run = job->run;
+    const OctArchive *ar = run->ar;
+    const OctChunk *c = &g_array_index(ar->chunks, OctChunk, job->chunk);
+    unsigned char *sealed = g_malloc(c->stored);
+    unsigned char *payload = g_malloc(c->stored);
+    unsigned char *raw = c->flags & OCT_CHUNK_DEFLATE ? g_malloc(c->raw ? c->raw : 1) : payload;
+    gsize payload_len = c->stored - OCT_SEAL_OVERHEAD;
+    uLongf raw_len = c->raw;
+    gboolean ok = pread_all(ar->fd, sealed, c->stored, (off_t)c->offset) &&
+                  oct_open(ar, job->chunk, sealed, c->stored, payload);
+    if (!ok) g_printerr("octopus: chunk %u failed authentication\n", job->chunk);
+    if (ok && (c->flags & OCT_CHUNK_DEFLATE)) {
+        ok = uncompress(raw, &raw_len, payload, payload_len) == Z_OK && raw_len == c->raw;
+    } else if (ok) {
+        ok = payload_len == c->raw;
+    }
+
+    /* Files overlapping [start, start + raw): binary search for the first one. */
+    guint lo = 0, hi = run->files->len;
+    while (lo < hi) {
+        guint mid = (lo + hi) / 2;
+        const OctEntry *e = g_ptr_array_index(run->files, mid);
+        if (e->offset + e->size <= c->start) lo = mid + 1;
+        else hi = mid;
+    }
+    for (guint i = lo; ok && i < run->files->len; i++) {
+        const OctEntry *e = g_ptr_array_index(run->files, i);
+        if (e->offset >= c->start + c->raw) break;
+        guint64 from = MAX(e->offset, c->start), to = MIN(e->offset + e->size, c->start + c->raw);
+        int fd = open(e->source, O_WRONLY | O_CLOEXEC | O_NOFOLLOW);
+        ok = fd >= 0 && pwrite_all(fd, raw + (from - c->start), to - from, (off_t)(from - e->offset));
+        if (!ok) g_printerr("octopus: cannot write %s: %s\n", e->source, g_strerror(errno));
+        if (fd >= 0) close(fd);
+    }
+    if (!ok) g_atomic_int_set(&run->failed, 1);
+    if (raw != payload) g_free(raw);
+    g_free(payload);
+    g_free(sealed);
+    g_free(job);
+}
+
+static gboolean entry_selected(const OctEntry *e, char **paths, int n_paths) {
+    if (n_paths == 0) return TRUE;
+    for (int i = 0; i < n_paths; i++) {
+        gsize len = strlen(paths[i]);
+        while (len > 1 && paths[i][len - 1] == '/') len--;
+        if (strncmp(e->path, paths[i], len) == 0 && (e->path[len] == '\0' || e->path[len] == '/')) return TRUE;
+        /* Directories above a requested path, so they get their modes and owner too. */
+        gsize dir_len = strlen(e->path);
+        if (e->type == OCT_DIR && dir_len < len && strncmp(paths[i], e->path, dir_len) == 0 && paths[i][dir_len] == '/') return TRUE;
+    }
+    return FALSE;
+}
+
+static void apply_metadata(const OctEntry *e) {
+    struct timespec times[2] = { { 0, UTIME_OMIT }, { (time_t)e->mtime, 0 } };
+    if (e->type != OCT_SYMLINK && fchmodat(AT_FDCWD, e->source, e->mode & 07777, AT_SYMLINK_NOFOLLOW) != 0) {
+        g_printerr("octopus: chmod %s: %s\n", e->source, g_strerror(errno));
+    }
+    utimensat(AT_FDCWD, e->source, times, AT_SYMLINK_NOFOLLOW);
+}
+
+static int oct_extract(const char *password, const char *archive, const char *dest, char **paths, int n_paths,
+                       guint threads, const char *owner) {
+    OctArchive ar = { .fd = -1 };
+    unsigned long uid = 0, gid = 0;
+    if (owner && sscanf(owner, "%lu:%lu", &uid, &gid) != 2) {
+        g_printerr("octopus: --owner wants UID:GID\n");
+        return 2;
+    }
+    /* The archive is the only thing opened with the caller's rights. */
+    if (!oct_open_file(&ar, archive)) return 1;
+    if (owner && !drop_privileges((uid_t)uid, (gid_t)gid)) {
+        g_printerr("octopus: cannot switch to %s: %s\n", owner, g_strerror(errno));
+        oct_archive_clear(&ar);
+        return 1;
+    }
+    if (!oct_load(&ar, archive, password)) {
+        oct_archive_clear(&ar);
+        return 1;
+    }
+    if (g_mkdir_with_parents(dest, 0700) != 0) {
+        g_printerr("octopus: cannot create %s: %s\n", dest, g_strerror(errno));
+        oct_archive_clear(&ar);
+        return 1;
+    }
+
+    gint64 started = g_get_monotonic_time();
+    RestoreRun run = { &ar, g_ptr_array_new(), 0 };
+    gboolean *needed = g_new0(gboolean, ar.chunks->len ? ar.chunks->len : 1);
+    guint n_needed = 0, n_selected = 0;
+    guint64 bytes = 0;
+    for (guint i = 0; i < ar.entries->len; i++) {
+        OctEntry *e = g_ptr_array_index(ar.entries, i);
+        if (!entry_selected(e, paths, n_paths)) continue;
+        if (!safe_path(e->path)) {
+            g_printerr("octopus: skipping unsafe path %s\n", e->path);
+            continue;
+        }
+        e->source = g_build_filename(dest, e->path, NULL);
+        gboolean ok = make_dirs_under(dest, e->path, e->type == OCT_DIR);
+        if (ok && e->type == OCT_SYMLINK) {
+            unlink(e->source);
+            ok = symlink(e->link ? e->link : "", e->source) == 0;
+        } else if (ok && e->type == OCT_FILE) {
+            int fd = open(e->source, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600);
+            ok = fd >= 0 && ftruncate(fd, (off_t)e->size) == 0;
+            if (fd >= 0) close(fd);
+        }
+        if (!ok && errno == ELOOP) {
+            g_printerr("octopus: refusing %s: it leads through a symlink\n", e->source);
+            run.failed = 1;
+            continue;
+        }
+        if (!ok) {
+            g_printerr("octopus: cannot create %s: %s\n", e->source, g_strerror(errno));
+            run.failed = 1;
+            continue;
+        }
+        e->selected = TRUE;
+        n_selected++;
+        if (e->type != OCT_FILE || e->size == 0) continue;
+        g_ptr_array_add(run.files, e);
+        bytes += e->size;
+        /* Chunks covering [offset, offset + size): their starts are increasing. */
+        guint lo = 0, hi = ar.chunks->len;
+        while (lo < hi) {
+            guint mid = (lo + hi) / 2;
+            const OctChunk *c = &g_array_index(ar.chunks, OctChunk, mid);
+            if (c->start + c->raw <= e->offset) lo = mid + 1;
+            else hi = mid;
+        }
+        for (guint k = lo; k < ar.chunks->len && g_array_index(ar.chunks, OctChunk, k).start < e->offset + e->size; k++) {
+            if (!needed[k]) n_needed++;
+            needed[k] = TRUE;
+        }
+    }
+    if (n_paths > 0 && n_selected == 0) {
+        g_printerr("octopus: no entries match the given paths\n");
+        run.failed = 1;
+    }
+
+    GThreadPool *pool = g_thread_pool_new(restore_job_run, NULL, (gint)threads, TRUE, NULL);
+    for (guint k = 0; k < ar.chunks->len; k++) {
+        if (!needed[k]) continue;
+        RestoreJob *job = g_new0(RestoreJob, 1);
+        job->run = &run;
+        job->chunk = k;
+        g_thread_pool_push(pool, job, NULL);
+    }
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    /* Modes and times last, directories deepest first, so restoring a read-only
+     * directory's contents and its children's writes do not disturb them. */
+    for (guint i = ar.entries->len; i-- > 0;) {
+        const OctEntry *e = g_ptr_array_index(ar.entries, i);
+        if (e->selected) apply_metadata(e);
+    }
+    double secs = (g_get_monotonic_time() - started) / 1e6;
+    g_printerr("octopus: restored %u entries, %.1f MiB from %u of %u chunks, %.2f s on %u threads\n",
+               n_selected, bytes / 1048576.0, n_needed, ar.chunks->len, secs, threads);
+    g_free(needed);
+    g_ptr_array_free(run.files, TRUE);
+    oct_archive_clear(&ar);
+    return run.failed ? 1 : 0;
+}
+
+static int oct_list(const char *password, const char *archive) {
+    OctArchive ar = { .fd = -1 };
+    if (!oct_open_file(&ar, archive) || !oct_load(&ar, archive, password)) {
+        oct_archive_clear(&ar);
+        return 1;
+    }
+    for (guint i = 0; i < ar.entries->len; i++) {
+        const OctEntry *e = g_ptr_array_index(ar.entries, i);
+        gchar *when = NULL;
+        GDateTime *dt = g_date_time_new_from_unix_local(e->mtime);
+        if (dt) {
+            when = g_date_time_format(dt, "%Y-%m-%d %H:%M");
+            g_date_time_unref(dt);
+        }
+        printf("%c%04o %12" G_GUINT64_FORMAT " %s %s%s%s\n", "-dl"[e->type], e->mode, e->size,
+               when ? when : "?", e->path, e->link ? " -> " : "", e->link ? e->link : "");
+        g_free(when);
+    }
+    oct_archive_clear(&ar);
+    return 0;
+}
+
+static void usage(const char *argv0) {
+    g_printerr("usage: %s create  -p PASSFILE -f ARCHIVE [-j N] [--chunk-size MiB] [--level 0-9] PATH...\n"
+               "       %s extract -p PASSFILE -f ARCHIVE [-C DIR] [-j N] [--owner UID:GID] [PATH...]\n"
+               "       %s list    -p PASSFILE -f ARCHIVE\n", argv0, argv0, argv0);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 2;
+    }
+    const char *cmd = argv[1], *pass_file = NULL, *archive = NULL, *dest = ".", *owner = NULL;
+    int threads_arg = 0, chunk_mib = OCT_DEFAULT_CHUNK_MIB;
+    int level = 6;
+    char **paths = g_new0(char*, argc);
+    int n_paths = 0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) pass_file = argv[++i];
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) archive = argv[++i];
+        else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) dest = argv[++i];
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads_arg = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--chunk-size") == 0 && i + 1 < argc) chunk_mib = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc) level = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--owner") == 0 && i + 1 < argc) owner = argv[++i];
+        else paths[n_paths++] = argv[i];
+    }
+    gboolean create = strcmp(cmd, "create") == 0, extract = strcmp(cmd, "extract") == 0, list = strcmp(cmd, "list") == 0;
+    guint threads = threads_arg > 0 ? (guint)MIN(threads_arg, 256) : g_get_num_processors();
+    chunk_mib = CLAMP(chunk_mib, 1, OCT_MAX_CHUNK_MIB);
+    level = CLAMP(level, 0, 9);
+    if (!(create || extract || list) || !pass_file || !archive || (create && n_paths == 0)) {
+        usage(argv[0]);
+        g_free(paths);
+        return 2;
+    }
+    if (sodium_init() < 0) {
+        g_printerr("octopus: libsodium failed to initialize\n");
+        g_free(paths);
+        return 1;
+    }
+    g_mutex_init(&job_sync.lock);
+    g_cond_init(&job_sync.cond);
+    gchar *password = read_password(pass_file);
+    int rc = 1;
+    if (password) {
+        if (create) rc = oct_create(password, archive, paths, n_paths, threads, (guint32)chunk_mib * 1048576u, level);
+        else if (extract) rc = oct_extract(password, archive, dest, paths, n_paths, threads, owner);
+        else rc = oct_list(password, archive);
+        sodium_memzero(password, strlen(password));
+        g_free(password);
+    }
+    g_free(paths);
+    return rc;
+}
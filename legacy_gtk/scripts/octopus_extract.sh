@@ -2,11 +2,23 @@
 set -euo pipefail
 
 # Extract the encrypted store from /opt/octopus using the locally stored password.
-# This script will use sudo to read the encrypted file (so the user will be prompted
-# for their sudo password) and then decrypt using the password in ~/.config/octopus/password.txt
+# The octopus tool runs under sudo only to open the root-owned archive (so the user will
+# be prompted for their sudo password): --owner makes it switch to the calling user
+# before it decrypts anything or touches DEST. The password in
+# ~/.config/octopus/password.txt goes over stdin. Paths after DEST restore only those
+# entries, reading just the chunks that hold them.
+#
+# A store from before the octopus tool (/opt/octopus/store.tar.gz.enc, tar | openssl)
+# is still read with the old pipeline while no store.oct exists. To convert it,
+# extract it to a scratch directory and run scripts/octopus_init.sh on the result.
+#
+#   octopus_extract.sh [DEST] [PATH...]
 
 CONFIG_DIR="$HOME/.config/octopus"
 PASSWORD_FILE="$CONFIG_DIR/password.txt"
+OCTOPUS="${OCTOPUS:-$(dirname "$0")/../octopus}"
+STORE=/opt/octopus/store.oct
+LEGACY_STORE=/opt/octopus/store.tar.gz.enc
 
 if [ ! -f "$PASSWORD_FILE" ]; then
   echo "Password file not found at $PASSWORD_FILE" >&2
@@ -15,18 +27,27 @@ if [ ! -f "$PASSWORD_FILE" ]; then
 fi
 
 DEST="${1:-$PWD}"
+shift || true
 if [ ! -d "$DEST" ]; then
   echo "Destination directory does not exist: $DEST" >&2
   exit 2
 fi
 
-TMP_ENC=$(mktemp /tmp/octopus.XXXXXX.enc)
-
-# Use sudo to read the root-owned encrypted file into a temporary file. This will prompt for sudo password.
-sudo cat /opt/octopus/store.tar.gz.enc > "$TMP_ENC"
-
-# Decrypt using openssl reading password from the password file (no password on command line)
-openssl enc -d -aes-256-cbc -pbkdf2 -pass file:"$PASSWORD_FILE" -in "$TMP_ENC" | tar -xz -C "$DEST"
+# /opt/octopus is root-only, so even checking for the stores needs sudo (prompts once).
+if sudo test -f "$STORE"; then
+  if [ ! -x "$OCTOPUS" ]; then
+    echo "octopus tool not found at $OCTOPUS; run 'make octopus' in legacy_gtk first" >&2
+    exit 1
+  fi
+  # Root opens the store, the calling user writes DEST; the password goes over stdin, never argv.
+  sudo "$OCTOPUS" extract -p - --owner "$(id -u):$(id -g)" -f "$STORE" -C "$DEST" "$@" < "$PASSWORD_FILE"
+elif sudo test -f "$LEGACY_STORE"; then
+  echo "Reading the old-format store $LEGACY_STORE; re-run scripts/octopus_init.sh to convert it." >&2
+  # As before: root only reads the file, decryption and tar run as the user.
+  sudo cat "$LEGACY_STORE" | openssl enc -d -aes-256-cbc -pbkdf2 -pass file:"$PASSWORD_FILE" | tar -xz -C "$DEST" "$@"
+else
+  echo "No store found at $STORE; run scripts/octopus_init.sh first." >&2
+  exit 1
+fi
 
-rm -f "$TMP_ENC"
 echo "Extraction completed to $DEST"
@@ -1,11 +1,18 @@
 #!/usr/bin/env bash
 set -euo pipefail
 
-# Create ~/.config/octopus and a random password file, then create an encrypted
-# tarball of the provided source and move it into /opt/octopus owned by root.
+# Create ~/.config/octopus and a random password file, then archive the provided
+# source with the octopus tool (chunked, compressed and sealed on every core) and
+# move it into /opt/octopus owned by root.
 
 CONFIG_DIR="$HOME/.config/octopus"
 PASSWORD_FILE="$CONFIG_DIR/password.txt"
+OCTOPUS="${OCTOPUS:-$(dirname "$0")/../octopus}"
+
+if [ ! -x "$OCTOPUS" ]; then
+  echo "octopus tool not found at $OCTOPUS; run 'make octopus' in legacy_gtk first" >&2
+  exit 1
+fi
 
 mkdir -p "$CONFIG_DIR"
 
@@ -34,24 +41,24 @@ if [ ! -e "$SRC" ]; then
   exit 3
 fi
 
-TMP_ENC=$(mktemp /tmp/octopus.XXXXXX.enc)
+TMP_ENC=$(mktemp /tmp/octopus.XXXXXX.oct)
 
-# Create a pipe: tar the provided path (preserve relative name) and encrypt to tmp
-SRCDIR=$(dirname "$SRC")
-SRCBASE=$(basename "$SRC")
-
-tar -C "$SRCDIR" -czf - "$SRCBASE" | \
-  openssl enc -aes-256-cbc -salt -pbkdf2 -pass file:"$PASSWORD_FILE" -out "$TMP_ENC"
+# Archive the provided path under its own name; the key is derived from the password file.
+"$OCTOPUS" create -p "$PASSWORD_FILE" -f "$TMP_ENC" "$SRC"
 
 echo "Encrypted archive created at $TMP_ENC"
 
 # Create /opt/octopus and move the encrypted file there as root (prompts for sudo password)
 sudo mkdir -p /opt/octopus
-sudo mv "$TMP_ENC" /opt/octopus/store.tar.gz.enc
+sudo mv "$TMP_ENC" /opt/octopus/store.oct
 sudo chown root:root /opt/octopus
-sudo chown root:root /opt/octopus/store.tar.gz.enc
+sudo chown root:root /opt/octopus/store.oct
 sudo chmod 0700 /opt/octopus
-sudo chmod 0600 /opt/octopus/store.tar.gz.enc
+sudo chmod 0600 /opt/octopus/store.oct
 
-echo "Encrypted archive moved to /opt/octopus/store.tar.gz.enc (owned by root)."
-echo "To decrypt later, use scripts/octopus_extract.sh which will prompt for sudo." 
+echo "Encrypted archive moved to /opt/octopus/store.oct (owned by root)."
+if sudo test -f /opt/octopus/store.tar.gz.enc; then
+  # Same password file, so the old store stays readable by hand; the scripts now read store.oct.
+  echo "The old-format store /opt/octopus/store.tar.gz.enc is no longer used; remove it with sudo rm once it is not needed."
+fi
+echo "To decrypt later, use scripts/octopus_extract.sh which will prompt for sudo."
@@ -0,0 +1,682 @@
+// Request filter engine for the service views. Compiles Adblock Plus style filter lists
+// (and hosts-file lines) into two indexes:
+//   - a domain suffix trie holding the `||host^` and hosts entries, walked one label at
+//     a time from the TLD, so a lookup costs one step per label of the request host;
+//   - token-indexed pattern rules: every other rule is filed under its rarest literal
+//     token, and a request only tests the rules filed under tokens its URL contains.
+//     A token with one open end (`adserver.` can match `myadserver.`) is filed under
+//     its first or last three characters instead, probed as '<abc' / '>xyz'.
+// The compiled tables are typed arrays over one string table, written as-is to a binary
+// cache keyed by the lists' paths, sizes and mtimes, so a warm start maps the arrays
+// instead of re-parsing the lists. The cache is in native byte order and per machine.
+const fs = require('fs');
+const crypto = require('crypto');
+
+const CACHE_MAGIC = Buffer.from('AIBOXFLT');
+const CACHE_VERSION = 1;
+const NO_STRING = 0xffffffff;
+const EXCLUDED = 0x80000000; // domain= entry prefixed with ~
+
+const F_EXCEPTION = 1 << 0;
+const F_IMPORTANT = 1 << 1;
+const F_THIRD_PARTY = 1 << 2;
+const F_FIRST_PARTY = 1 << 3;
+const F_MATCH_CASE = 1 << 4;
+const F_PLAIN = 1 << 5; // pattern is a literal substring
+const F_REGEX = 1 << 6; // pattern is a /regular expression/ rule
+const TYPE_SHIFT = 8;
+
+const TYPES = {
+    other: 0, script: 1, image: 2, stylesheet: 3, object: 4, xmlhttprequest: 5,
+    subdocument: 6, ping: 7, media: 8, font: 9, websocket: 10
+};
+const ALL_TYPES = (1 << 11) - 1;
+const TYPE_BITS = new Map(Object.entries(TYPES).map(([name, bit]) => [name, 1 << bit]));
+const OPTION_ALIASES = { xhr: 'xmlhttprequest', css: 'stylesheet', frame: 'subdocument', '3p': 'third-party', '1p': 'first-party' };
+
+// Electron webRequest resourceType -> filter type.
+const RESOURCE_TYPES = {
+    subFrame: 'subdocument', stylesheet: 'stylesheet', script: 'script', image: 'image', font: 'font',
+    object: 'object', xhr: 'xmlhttprequest', ping: 'ping', media: 'media', webSocket: 'websocket'
+};
+
+const SECTIONS = [
+    'meta', 'strOffsets', 'strBlob', 'ruleFlags', 'rulePattern', 'ruleDomains', 'domainRefs',
+    'nodeParent', 'nodeLabel', 'nodeRules', 'trieRules', 'trieTable',
+    'tokenTable', 'tokenRules', 'bucketRules', 'fallbackRules'
+];
+const META_EDGE_KEYS = 0; // meta[0]: number of rules filed under edge keys
+
+const HOSTS_LINE = /^(?:0\.0\.0\.0|127\.0\.0\.1|::1?)\s+([^\s#]+)/;
+const HOST_RULE = /^\|\|([a-z0-9.-]+)\^$/;
+const OPTIONS = /^~?[a-z0-9-]+(?:=[^,]*)?(?:,~?[a-z0-9-]+(?:=[^,]*)?)*$/i;
+const COSMETIC = /#[@?$%]?#/;
+
+// FNV-1a over ASCII-lowercased char codes, so the raw URL can be hashed in place. Edge
+// keys ('<abc', '>xyz') hash as if the marker were the first character, and trie edges
+// start from a basis mixed with the parent node.
+const FNV_BASIS = 0x811c9dc5;
+const FNV_PRIME = 16777619;
+const PREFIX_BASIS = Math.imul(FNV_BASIS ^ 60, FNV_PRIME) >>> 0;
+const SUFFIX_BASIS = Math.imul(FNV_BASIS ^ 62, FNV_PRIME) >>> 0;
+
+function fold(c) {
+    return c >= 65 && c <= 90 ? c + 32 : c;
+}
+
+function hashRange(s, from, to, basis = FNV_BASIS) {
+    let h = basis;
+    for (let i = from; i < to; i++) h = Math.imul(h ^ fold(s.charCodeAt(i)), FNV_PRIME) >>> 0;
+    return h;
+}
+
+function edgeBasis(parent) {
+    return Math.imul(FNV_BASIS ^ parent, FNV_PRIME) >>> 0;
+}
+
+// Open addressing on pairs [hash, value + 1] in one array, so a probe touches one line.
+// Most URL tokens and host labels are in no rule; presenceBits answers that from a
+// 32 KB bit set before the (much larger) table is touched.
+function hashTable(entries) {
+    let size = 16;
+    while (size < entries.length * 2) size *= 2;
+    const table = new Uint32Array(size * 2);
+    entries.forEach(([hash, value]) => {
+        let slot = hash & (size - 1);
+        while (table[slot * 2 + 1]) slot = (slot + 1) & (size - 1);
+        table[slot * 2] = hash;
+        table[slot * 2 + 1] = value + 1;
+    });
+    return table;
+}
+
+function presenceBits(table) {
+    const bits = new Uint32Array(1 << 13);
+    for (let slot = 0; slot < table.length; slot += 2) {
+        if (table[slot + 1]) bits[table[slot] >>> 19] |= 1 << ((table[slot] >>> 14) & 31);
+    }
+    return bits;
+}
+
+function present(bits, hash) {
+    return (bits[hash >>> 19] & (1 << ((hash >>> 14) & 31))) !== 0;
+}
+
+function isTokenChar(c) {
+    return (c >= 97 && c <= 122) || (c >= 48 && c <= 57) || c === 37;
+}
+
+// ASCII code -> folded code if it is a token character, else 0.
+const TOKEN_CHARS = new Uint8Array(128);
+for (let c = 0; c < 128; c++) {
+    if (isTokenChar(fold(c))) TOKEN_CHARS[c] = fold(c);
+}
+
+function hostMatches(host, domain) {
+    return host === domain ||
+        (host.length > domain.length && host.endsWith(domain) && host.charCodeAt(host.length - domain.length - 1) === 46);
+}
+
+// Sets out.hostStart/hostEnd to the host of a URL.
+function hostBounds(out, url) {
+    const scheme = url.indexOf('://');
+    let start = scheme < 0 ? 0 : scheme + 3;
+    let end = scheme < 0 ? 0 : url.length;
+    for (let i = start; i < end; i++) {
+        const c = url.charCodeAt(i);
+        if (c === 47 || c === 63 || c === 35) end = i;
+        else if (c === 64) start = i + 1;
+    }
+    if (url.charCodeAt(start) === 91) {
+        const close = url.indexOf(']', start);
+        if (close >= 0 && close < end) end = close + 1;
+    } else {
+        const colon = url.indexOf(':', start);
+        if (colon >= 0 && colon < end) end = colon;
+    }
+    out.hostStart = start;
+    out.hostEnd = end;
+}
+
+// Host of a lowercased URL, without credentials or port.
+function urlHost(url) {
+    const bounds = {};
+    hostBounds(bounds, url);
+    return url.slice(bounds.hostStart, bounds.hostEnd);
+}
+
+// Registrable domain, approximated without a public suffix list: the last two labels,
+// or three under a two-letter TLD with a short second level (co.uk, com.au).
+function baseDomain(host) {
+    const last = host.lastIndexOf('.');
+    if (last <= 0) return host;
+    let cut = host.lastIndexOf('.', last - 1);
+    if (cut > 0 && host.length - last === 3 && last - cut <= 4) cut = host.lastIndexOf('.', cut - 1);
+    return cut < 0 ? host : host.slice(cut + 1);
+}
+
+// Index keys a matching URL is guaranteed to produce: whole tokens for runs of token
+// characters bounded by separators, edge keys for runs with one open end.
+function patternTokens(body, anchoredStart, anchoredEnd) {
+    const tokens = [];
+    const edges = [];
+    let start = -1;
+    for (let i = 0; i <= body.length; i++) {
+        if (i < body.length && isTokenChar(body.charCodeAt(i))) {
+            if (start < 0) start = i;
+            continue;
+        }
+        if (start >= 0 && i - start >= 2) {
+            const openStart = start === 0 ? !anchoredStart : body[start - 1] === '*';
+            const openEnd = i === body.length ? !anchoredEnd : body[i] === '*';
+            const token = body.slice(start, i);
+            if (!openStart && !openEnd) tokens.push(token);
+            else if (token.length >= 3 && !openStart) edges.push('<' + token.slice(0, 3));
+            else if (token.length >= 3 && !openEnd) edges.push('>' + token.slice(-3));
+        }
+        start = -1;
+    }
+    return tokens.length ? tokens : edges;
+}
+
+function patternToRegex(body, hostAnchor, startAnchor, endAnchor) {
+    let source = hostAnchor ? '^[a-z][a-z0-9+.-]*:\\/+(?:[^\\/?#]*\\.)?' : startAnchor ? '^' : '';
+    for (const ch of body) {
+        if (ch === '*') source += '.*';
+        else if (ch === '^') source += '(?:[^\\w.%-]|$)';
+        else source += ch.replace(/[.+?${}()|[\]\\/]/, '\\$&');
+    }
+    return endAnchor ? source + '$' : source;
+}
+
+// One list line -> rule description, or null for comments, cosmetic filters and rules
+// with options this engine does not implement (popup, csp, redirect, document, ...).
+function parseRule(line) {
+    line = line.trim();
+    if (!line || line[0] === '!' || line[0] === '[' || COSMETIC.test(line)) return null;
+
+    const hosts = HOSTS_LINE.exec(line);
+    if (hosts) {
+        const host = hosts[1].toLowerCase();
+        if (host === 'localhost' || host === '0.0.0.0' || host.indexOf('.') < 0) return null;
+        return { flags: ALL_TYPES << TYPE_SHIFT, host, domains: null };
+    }
+
+    let flags = 0;
+    if (line.startsWith('@@')) {
+        flags |= F_EXCEPTION;
+        line = line.slice(2);
+    }
+    let types = 0;
+    let negTypes = 0;
+    let domains = null;
+    const dollar = line.lastIndexOf('$');
+    if (dollar >= 0 && OPTIONS.test(line.slice(dollar + 1))) {
+        for (const raw of line.slice(dollar + 1).split(',')) {
+            const negated = raw[0] === '~';
+            const eq = raw.indexOf('=');
+            let name = raw.slice(negated ? 1 : 0, eq < 0 ? raw.length : eq).toLowerCase();
+            name = OPTION_ALIASES[name] || name;
+            if (name === 'third-party') flags |= negated ? F_FIRST_PARTY : F_THIRD_PARTY;
+            else if (name === 'first-party') flags |= negated ? F_THIRD_PARTY : F_FIRST_PARTY;
+            else if (name === 'important') flags |= F_IMPORTANT;
+            else if (name === 'match-case') flags |= F_MATCH_CASE;
+            else if (name === 'domain' && eq > 0) {
+                domains = raw.slice(eq + 1).toLowerCase().split('|').filter(Boolean);
+            } else if (TYPE_BITS.has(name)) {
+                if (negated) negTypes |= TYPE_BITS.get(name);
+                else types |= TYPE_BITS.get(name);
+            } else {
+                return null;
+            }
+        }
+        line = line.slice(0, dollar);
+    }
+    const typeMask = (types || ALL_TYPES) & ~negTypes;
+    if (!typeMask) return null;
+    flags |= typeMask << TYPE_SHIFT;
+
+    if (line.length > 2 && line[0] === '/' && line.endsWith('/')) {
+        const source = line.slice(1, -1);
+        try {
+            new RegExp(source);
+        } catch (err) {
+            return null;
+        }
+        return { flags: flags | F_REGEX, pattern: source, tokens: [], domains };
+    }
+
+    const lower = line.toLowerCase();
+    const host = HOST_RULE.exec(lower);
+    if (host) return { flags, host: host[1], domains };
+
+    let body = flags & F_MATCH_CASE ? line : lower;
+    const hostAnchor = body.startsWith('||');
+    const startAnchor = !hostAnchor && body[0] === '|';
+    if (hostAnchor || startAnchor) body = body.slice(hostAnchor ? 2 : 1);
+    const endAnchor = body.endsWith('|');
+    if (endAnchor) body = body.slice(0, -1);
+    body = body.replace(/^\*+|\*+$/g, '');
+    if (!body && !hostAnchor && !startAnchor && !endAnchor) {
+        // Matches every URL: only meaningful when scoped to some pages.
+        if (!domains) return null;
+        return { flags: flags | F_PLAIN, pattern: '', tokens: [], domains };
+    }
+
+    const tokens = patternTokens(body.toLowerCase(), hostAnchor || startAnchor, endAnchor || body.endsWith('^'));
+    if (!hostAnchor && !startAnchor && !endAnchor && !/[*^]/.test(body)) {
+        return { flags: flags | F_PLAIN, pattern: body, tokens, domains };
+    }
+    return { flags, pattern: patternToRegex(body, hostAnchor, startAnchor, endAnchor), tokens, domains };
+}
+
+// Rule descriptions -> the flat tables FilterEngine runs on.
+function buildTables(rules) {
+    const strings = [];
+    const stringIds = new Map();
+    const intern = s => {
+        let id = stringIds.get(s);
+        if (id === undefined) {
+            id = strings.length;
+            strings.push(s);
+            stringIds.set(s, id);
+        }
+        return id;
+    };
+
+    const keyCounts = new Map();
+    rules.forEach(rule => {
+        if (rule.tokens) rule.tokens.forEach(t => keyCounts.set(t, (keyCounts.get(t) || 0) + 1));
+    });
+
+    const n = rules.length;
+    const ruleFlags = new Uint32Array(n);
+    const rulePattern = new Uint32Array(n).fill(NO_STRING);
+    const ruleDomains = new Uint32Array(n + 1);
+    const domainRefs = [];
+    const root = { children: new Map(), rules: [] };
+    const buckets = new Map(); // key hash -> rule indexes
+    const fallbackRules = [];
+    let edgeKeyRules = 0;
+
+    rules.forEach((rule, i) => {
+        ruleFlags[i] = rule.flags;
+        ruleDomains[i] = domainRefs.length;
+        if (rule.domains) {
+            rule.domains.forEach(d => {
+                domainRefs.push(d[0] === '~' ? (intern(d.slice(1)) | EXCLUDED) >>> 0 : intern(d));
+            });
+        }
+        if (rule.host !== undefined) {
+            let node = root;
+            const labels = rule.host.split('.').filter(Boolean);
+            for (let l = labels.length - 1; l >= 0; l--) {
+                let next = node.children.get(labels[l]);
+                if (!next) {
+                    next = { children: new Map(), rules: [] };
+                    node.children.set(labels[l], next);
+                }
+                node = next;
+            }
+            node.rules.push(i);
+            return;
+        }
+        rulePattern[i] = intern(rule.pattern);
+        let best = null;
+        rule.tokens.forEach(t => {
+            if (best === null || keyCounts.get(t) < keyCounts.get(best) ||
+                (keyCounts.get(t) === keyCounts.get(best) && t.length > best.length)) {
+                best = t;
+            }
+        });
+        if (best === null) {
+            fallbackRules.push(i);
+        } else {
+            if (best[0] === '<' || best[0] === '>') edgeKeyRules++;
+            const h = hashRange(best, 0, best.length);
+            if (!buckets.has(h)) buckets.set(h, []);
+            buckets.get(h).push(i);
+        }
+    });
+    ruleDomains[n] = domainRefs.length;
+
+    // Trie nodes numbered breadth first; an edge is found by hashing (parent, label)
+    // into trieTable and confirmed against nodeParent/nodeLabel.
+    const nodes = [root];
+    const nodeParent = [0];
+    const nodeLabel = [NO_STRING];
+    const nodeRules = [0];
+    const trieRules = [];
+    const edges = [];
+    for (let i = 0; i < nodes.length; i++) {
+        nodes[i].children.forEach((child, label) => {
+            edges.push([hashRange(label, 0, label.length, edgeBasis(i)), nodes.length]);
+            nodeParent.push(i);
+            nodeLabel.push(intern(label));
+            nodes.push(child);
+        });
+        trieRules.push(...nodes[i].rules);
+        nodeRules.push(trieRules.length);
+    }
+
+    const tokenRules = [0];
+    const bucketRules = [];
+    const tokenEntries = [];
+    buckets.forEach((list, hash) => {
+        tokenEntries.push([hash, tokenRules.length - 1]);
+        bucketRules.push(...list);
+        tokenRules.push(bucketRules.length);
+    });
+
+    const encoded = strings.map(s => Buffer.from(s, 'utf8'));
+    const strOffsets = new Uint32Array(encoded.length + 1);
+    encoded.forEach((b, i) => {
+        strOffsets[i + 1] = strOffsets[i] + b.length;
+    });
+
+    return {
+        meta: Uint32Array.from([edgeKeyRules]),
+        strOffsets,
+        strBlob: new Uint8Array(Buffer.concat(encoded)),
+        ruleFlags,
+        rulePattern,
+        ruleDomains,
+        domainRefs: Uint32Array.from(domainRefs),
+        nodeParent: Uint32Array.from(nodeParent),
+        nodeLabel: Uint32Array.from(nodeLabel),
+        nodeRules: Uint32Array.from(nodeRules),
+        trieRules: Uint32Array.from(trieRules),
+        trieTable: hashTable(edges),
+        tokenTable: hashTable(tokenEntries),
+        tokenRules: Uint32Array.from(tokenRules),
+        bucketRules: Uint32Array.from(bucketRules),
+        fallbackRules: Uint32Array.from(fallbackRules)
+    };
+}
+
+// Matching hashes the URL in place; the lowercased copy is only made when a candidate
+// rule has to be tested against it.
+class FilterEngine {
+    constructor(tables) {
+        Object.assign(this, tables);
+        this.ruleCount = this.ruleFlags.length;
+        this.stringCache = new Array(this.strOffsets.length - 1);
+        this.regexes = new Array(this.ruleCount);
+        this.seen = new Uint32Array(this.ruleCount);
+        this.stamp = 0;
+        this.blob = Buffer.from(this.strBlob.buffer, this.strBlob.byteOffset, this.strBlob.byteLength);
+        this.edgeKeys = this.meta[META_EDGE_KEYS] > 0;
+        this.trieMask = this.trieTable.length / 2 - 1;
+        this.tokenMask = this.tokenTable.length / 2 - 1;
+        this.trieBits = presenceBits(this.trieTable);
+        this.tokenBits = presenceBits(this.tokenTable);
+
+        // Per-request state, set by shouldBlock.
+        this.url = '';
+        this.lower = null;
+        this.hostStart = 0;
+        this.hostEnd = 0;
+        this.sourceUrl = '';
+        this.source = undefined;
+        this.thirdParty = undefined;
+        this.typeBit = 0;
+        this.blocked = false;
+        this.excepted = false;
+    }
+
+    static compile(texts) {
+        const seen = new Set();
+        const rules = [];
+        texts.forEach(text => {
+            text.split(/\r?\n/).forEach(line => {
+                if (seen.has(line)) return;
+                seen.add(line);
+                const rule = parseRule(line);
+                if (rule) rules.push(rule);
+            });
+        });
+        return new FilterEngine(buildTables(rules));
+    }
+
+    string(id) {
+        let s = this.stringCache[id];
+        if (s === undefined) {
+            s = this.blob.toString('utf8', this.strOffsets[id], this.strOffsets[id + 1]);
+            this.stringCache[id] = s;
+        }
+        return s;
+    }
+
+    regex(rule) {
+        let re = this.regexes[rule];
+        if (re === undefined) {
+            const flags = this.ruleFlags[rule];
+            re = new RegExp(this.string(this.rulePattern[rule]), flags & F_REGEX && !(flags & F_MATCH_CASE) ? 'i' : '');
+            this.regexes[rule] = re;
+        }
+        return re;
+    }
+
+    lowerUrl() {
+        if (this.lower === null) this.lower = this.url.toLowerCase();
+        return this.lower;
+    }
+
+    // Child of node along the host label url[from, to), or -1.
+    child(node, from, to) {
+        const hash = hashRange(this.url, from, to, edgeBasis(node));
+        if (!present(this.trieBits, hash)) return -1;
+        for (let slot = hash & this.trieMask; this.trieTable[slot * 2 + 1]; slot = (slot + 1) & this.trieMask) {
+            if (this.trieTable[slot * 2] !== hash) continue;
+            const next = this.trieTable[slot * 2 + 1] - 1;
+            if (this.nodeParent[next] === node && this.labelEquals(this.string(this.nodeLabel[next]), from, to)) return next;
+        }
+        return -1;
+    }
+
+    labelEquals(label, from, to) {
+        if (label.length !== to - from) return false;
+        for (let i = 0; i < label.length; i++) {
+            if (label.charCodeAt(i) !== fold(this.url.charCodeAt(from + i))) return false;
+        }
+        return true;
+    }
+
+    sourceHost() {
+        if (this.source === undefined) this.source = this.sourceUrl ? urlHost(this.sourceUrl.toLowerCase()) : '';
+        return this.source;
+    }
+
+    domainsAllow(rule) {
+        const host = this.sourceHost();
+        let included = false;
+        let hasIncludes = false;
+        for (let i = this.ruleDomains[rule]; i < this.ruleDomains[rule + 1]; i++) {
+            const ref = this.domainRefs[i];
+            if (ref & EXCLUDED) {
+                if (host && hostMatches(host, this.string((ref & ~EXCLUDED) >>> 0))) return false;
+            } else {
+                hasIncludes = true;
+                if (!included && host && hostMatches(host, this.string(ref))) included = true;
+            }
+        }
+        return included || !hasIncludes;
+    }
+
+    // Tests rules[from, to); true means an important rule blocked the request.
+    checkRules(rules, from, to, hostRules) {
+        for (let i = from; i < to; i++) {
+            const rule = rules[i];
+            if (this.seen[rule] === this.stamp) continue;
+            this.seen[rule] = this.stamp;
+            const flags = this.ruleFlags[rule];
+            if (!((flags >>> TYPE_SHIFT) & this.typeBit)) continue;
+            if (flags & (F_THIRD_PARTY | F_FIRST_PARTY)) {
+                const source = this.sourceHost();
+                if (!source) continue;
+                if (this.thirdParty === undefined) {
+                    this.thirdParty = baseDomain(this.lowerUrl().slice(this.hostStart, this.hostEnd)) !== baseDomain(source);
+                }
+                if (flags & F_THIRD_PARTY ? !this.thirdParty : this.thirdParty) continue;
+            }
+            if (this.ruleDomains[rule] !== this.ruleDomains[rule + 1] && !this.domainsAllow(rule)) continue;
+            if (!hostRules) {
+                if (flags & F_PLAIN) {
+                    if (!(flags & F_MATCH_CASE ? this.url : this.lowerUrl()).includes(this.string(this.rulePattern[rule]))) continue;
+                } else if (!this.regex(rule).test(flags & (F_MATCH_CASE | F_REGEX) ? this.url : this.lowerUrl())) {
+                    continue;
+                }
+            }
+            if (flags & F_EXCEPTION) this.excepted = true;
+            else if (flags & F_IMPORTANT) return true;
+            else this.blocked = true;
+        }
+        return false;
+    }
+
+    checkBucket(hash) {
+        if (!present(this.tokenBits, hash)) return false;
+        for (let slot = hash & this.tokenMask; this.tokenTable[slot * 2 + 1]; slot = (slot + 1) & this.tokenMask) {
+            if (this.tokenTable[slot * 2] === hash) {
+                const b = this.tokenTable[slot * 2 + 1] - 1;
+                return this.checkRules(this.bucketRules, this.tokenRules[b], this.tokenRules[b + 1], false);
+            }
+        }
+        return false;
+    }
+
+    // url: request URL; type: filter type name (see TYPES); sourceUrl: the page making
+    // the request, for $third-party and $domain= (may be empty).
+    shouldBlock(url, type, sourceUrl) {
+        this.url = url;
+        this.lower = null;
+        this.sourceUrl = sourceUrl || '';
+        this.source = undefined;
+        this.thirdParty = undefined;
+        this.typeBit = TYPE_BITS.get(type) || TYPE_BITS.get('other');
+        this.blocked = false;
+        this.excepted = false;
+        if (++this.stamp === 0xffffffff) {
+            this.seen.fill(0);
+            this.stamp = 1;
+        }
+        hostBounds(this, url);
+
+        let node = 0;
+        for (let end = this.hostEnd; end > this.hostStart && node >= 0;) {
+            let dot = end - 1;
+            while (dot >= this.hostStart && url.charCodeAt(dot) !== 46) dot--;
+            node = this.child(node, dot + 1, end);
+            if (node >= 0 && this.checkRules(this.trieRules, this.nodeRules[node], this.nodeRules[node + 1], true)) return true;
+            end = dot;
+        }
+
+        const len = url.length;
+        for (let i = 0, start = -1, hash = 0, prefix = 0; i <= len; i++) {
+            const code = i < len ? url.charCodeAt(i) : 0;
+            const c = code < 128 ? TOKEN_CHARS[code] : 0;
+            if (c) {
+                if (start < 0) {
+                    start = i;
+                    hash = FNV_BASIS;
+                    prefix = PREFIX_BASIS;
+                }
+                hash = Math.imul(hash ^ c, FNV_PRIME) >>> 0;
+                if (i - start < 3) prefix = Math.imul(prefix ^ c, FNV_PRIME) >>> 0;
+                continue;
+            }
+            if (start >= 0 && i - start >= 2) {
+                if (this.checkBucket(hash)) return true;
+                if (this.edgeKeys && i - start >= 3) {
+                    let suffix = SUFFIX_BASIS;
+                    for (let k = i - 3; k < i; k++) suffix = Math.imul(suffix ^ TOKEN_CHARS[url.charCodeAt(k)], FNV_PRIME) >>> 0;
+                    if (this.checkBucket(prefix) || this.checkBucket(suffix)) return true;
+                }
+            }
+            start = -1;
+        }
+        if (this.checkRules(this.fallbackRules, 0, this.fallbackRules.length, false)) return true;
+        return this.blocked && !this.excepted;
+    }
+
+    // Binary cache: magic, then version, byte-order mark and section count as native
+    // u32s, the 32-byte source key, and each section as a u32 byte length followed by
+    // its bytes padded to 4.
+    serialize(key) {
+        const parts = [CACHE_MAGIC, Buffer.from(new Uint32Array([CACHE_VERSION, 0x01020304, SECTIONS.length]).buffer), key];
+        SECTIONS.forEach(name => {
+            const arr = this[name];
+            const bytes = Buffer.from(arr.buffer, arr.byteOffset, arr.byteLength);
+            parts.push(Buffer.from(new Uint32Array([bytes.length]).buffer), bytes);
+            if (bytes.length % 4) parts.push(Buffer.alloc(4 - bytes.length % 4));
+        });
+        return Buffer.concat(parts);
+    }
+
+    static deserialize(buf, key) {
+        if (buf.byteOffset % 4) buf = Buffer.from(buf);
+        const header = CACHE_MAGIC.length + 12;
+        if (buf.length < header + 32 || !buf.subarray(0, CACHE_MAGIC.length).equals(CACHE_MAGIC)) return null;
+        const words = new Uint32Array(buf.buffer, buf.byteOffset + CACHE_MAGIC.length, 3);
+        if (words[0] !== CACHE_VERSION || words[1] !== 0x01020304 || words[2] !== SECTIONS.length) return null;
+        if (!buf.subarray(header, header + 32).equals(key)) return null;
+        const tables = {};
+        let off = header + 32;
+        for (const name of SECTIONS) {
+            if (off + 4 > buf.length) return null;
+            const len = new Uint32Array(buf.buffer, buf.byteOffset + off, 1)[0];
+            off += 4;
+            if (off + len > buf.length) return null;
+            tables[name] = name === 'strBlob'
+                ? new Uint8Array(buf.buffer, buf.byteOffset + off, len)
+                : new Uint32Array(buf.buffer, buf.byteOffset + off, len / 4);
+            off += len + (len % 4 ? 4 - len % 4 : 0);
+        }
+        return new FilterEngine(tables);
+    }
+}
+
+function cacheKey(listPaths) {
+    const hash = crypto.createHash('sha256');
+    hash.update(`v${CACHE_VERSION}\n`);
+    listPaths.forEach(p => {
+        try {
+            const st = fs.statSync(p);
+            hash.update(`${p}\0${st.size}\0${st.mtimeMs}\n`);
+        } catch (err) {
+            hash.update(`${p}\0missing\n`);
+        }
+    });
+    return hash.digest();
+}
+
+// Loads the engine for listPaths from cachePath, compiling the lists and rewriting the
+// cache when it is missing or stale. Returns { engine, fromCache, loadMs }.
+function loadFilterEngine(listPaths, cachePath) {
+    const started = process.hrtime.bigint();
+    const key = cacheKey(listPaths);
+    let engine = null;
+    if (cachePath) {
+        try {
+            engine = FilterEngine.deserialize(fs.readFileSync(cachePath), key);
+        } catch (err) {
+            engine = null;
+        }
+    }
+    const fromCache = Boolean(engine);
+    if (!engine) {
+        const texts = listPaths.filter(p => fs.existsSync(p)).map(p => fs.readFileSync(p, 'utf8'));
+        engine = FilterEngine.compile(texts);
+        if (cachePath) {
+            try {
+                fs.writeFileSync(`${cachePath}.tmp`, engine.serialize(key));
+                fs.renameSync(`${cachePath}.tmp`, cachePath);
+            } catch (err) {
+                console.error('Filter cache not written:', err.message);
+            }
+        }
+    }
+    return { engine, fromCache, loadMs: Number(process.hrtime.bigint() - started) / 1e6 };
+}
+
+module.exports = { FilterEngine, loadFilterEngine, parseRule, RESOURCE_TYPES, urlHost };
@@ -3,11 +3,29 @@ const path = require('path');
 const fs = require('fs');
 const os = require('os');
 const { exec } = require('child_process');
+const { loadFilterEngine, RESOURCE_TYPES } = require('./filter_engine');
 
 let mainWindow;
-const views = {}; // Key: serviceId -> BrowserView
+const views = {}; // Key: serviceId -> live BrowserView
+const viewState = {}; // Key: serviceId -> { lastActive, lastUrl, discards, loadMs }
 const TAB_HEIGHT = 50;
 let currentMode = 'standard'; // 'standard', 'enterprise', or 'media'
+let activeViewId = null;
+
+// View lifecycle. Views are created the first time their tab is shown. At most
+// MAX_LIVE_VIEWS stay alive; beyond that, and for any background tab idle longer than
+// VIEW_IDLE_MS, the least recently used ones are discarded (webContents closed, so the
+// renderer process exits) and reloaded at their last URL when reactivated.
+const MAX_LIVE_VIEWS = Math.max(1, parseInt(process.env.AIBOX_MAX_LIVE_VIEWS || '4', 10) || 4);
+const VIEW_IDLE_MS = Math.max(0, parseFloat(process.env.AIBOX_VIEW_IDLE_MINUTES || '15') || 0) * 60 * 1000;
+const VIEW_SWEEP_MS = 60 * 1000;
+
+// Request filtering. The built-in list plus any lists named in AIBOX_FILTER_LISTS
+// (path-separated) or dropped into <userData>/filters/*.txt, compiled once into
+// <userData>/filter-cache.bin (see filter_engine.js). AIBOX_FILTER_RECORD=<file> appends
+// every checked request to <file> for bench/filter_bench.js to replay.
+let filterEngine = null;
+const filterStats = { rules: 0, fromCache: false, loadMs: 0, checked: 0, blocked: 0 };
 
 // Service Configuration
 const standardServices = [
@@ -33,6 +51,8 @@ const mediaServices = [
     { id: 'pika', url: 'https://pika.art/' }
 ];
 
+const allServices = [...standardServices, ...enterpriseServices, ...mediaServices];
+
 // Dark Mode Enforcement
 nativeTheme.themeSource = 'dark';
 
@@ -55,40 +75,182 @@ function createWindow() {
     mainWindow.loadFile(path.join(__dirname, 'index.html'));
 
     setupAdBlocking();
-    initializeViews([...standardServices, ...enterpriseServices, ...mediaServices]);
 
-    // Initial render (defaults to Standard)
-    setActiveMode('standard');
+    // Initial render (defaults to Standard); only its first tab gets a view
+    mainWindow.webContents.once('did-finish-load', () => setActiveMode('standard'));
 
     mainWindow.on('resize', () => {
         const active = mainWindow.getBrowserView();
         if (active) updateViewBounds(active);
     });
+
+    const sweep = setInterval(discardIdleViews, VIEW_SWEEP_MS);
+    const telemetry = startViewTelemetry();
+    mainWindow.on('closed', () => {
+        clearInterval(sweep);
+        if (telemetry) clearInterval(telemetry);
+        Object.keys(views).forEach(id => delete views[id]);
+        activeViewId = null;
+        mainWindow = null;
+    });
+}
+
+function filterListPaths() {
+    const lists = [path.join(__dirname, 'filters', 'default.txt')];
+    (process.env.AIBOX_FILTER_LISTS || '').split(path.delimiter).filter(Boolean).forEach(p => lists.push(p));
+    const userDir = path.join(app.getPath('userData'), 'filters');
+    if (fs.existsSync(userDir)) {
+        fs.readdirSync(userDir).filter(name => name.endsWith('.txt')).sort()
+            .forEach(name => lists.push(path.join(userDir, name)));
+    }
+    return lists;
+}
+
+// The page a request belongs to, for $third-party and $domain= rules.
+function requestSource(details) {
+    try {
+        if (details.frame && details.frame.url) return details.frame.url;
+    } catch (err) {
+        // Frame already gone; fall back to the referrer.
+    }
+    return details.referrer || '';
 }
 
 function setupAdBlocking() {
-    const filter = {
-        urls: ['*://*.doubleclick.net/*', '*://*.googleadservices.com/*', '*://*.googlesyndication.com/*', '*://*.moatads.com/*']
-    };
+    if (!filterEngine) {
+        const loaded = loadFilterEngine(filterListPaths(), path.join(app.getPath('userData'), 'filter-cache.bin'));
+        filterEngine = loaded.engine;
+        filterStats.rules = filterEngine.ruleCount;
+        filterStats.fromCache = loaded.fromCache;
+        filterStats.loadMs = Math.round(loaded.loadMs * 10) / 10;
+    }
+    const record = process.env.AIBOX_FILTER_RECORD ? fs.createWriteStream(process.env.AIBOX_FILTER_RECORD, { flags: 'a' }) : null;
+
+    session.defaultSession.webRequest.onBeforeRequest((details, callback) => {
+        // Top-level navigations and non-web schemes (the app's own file:// UI) pass.
+        if (details.resourceType === 'mainFrame' || !/^(?:https?|wss?):/.test(details.url)) {
+            callback({});
+            return;
+        }
+        const type = RESOURCE_TYPES[details.resourceType] || 'other';
+        const source = requestSource(details);
+        if (record) record.write(`${type}\t${details.url}\t${source}\n`);
+        filterStats.checked++;
+        const cancel = filterEngine.shouldBlock(details.url, type, source);
+        if (cancel) filterStats.blocked++;
+        callback({ cancel });
+    });
+}
 
-    session.defaultSession.webRequest.onBeforeRequest(filter, (details, callback) => {
-        callback({ cancel: true });
+function findService(viewId) {
+    return allServices.find(service => service.id === viewId);
+}
+
+function getOrCreateView(viewId) {
+    if (views[viewId]) return views[viewId];
+    const service = findService(viewId);
+    if (!service) return null;
+
+    const state = viewState[viewId] || (viewState[viewId] = { lastActive: 0, lastUrl: null, discards: 0, loadMs: null });
+    const view = new BrowserView({
+        webPreferences: {
+            nodeIntegration: false,
+            contextIsolation: true
+        }
+    });
+    const started = Date.now();
+    view.webContents.once('did-finish-load', () => {
+        state.loadMs = Date.now() - started;
     });
+    view.webContents.on('did-navigate', (event, url) => {
+        state.lastUrl = url;
+    });
+    view.webContents.on('did-navigate-in-page', (event, url) => {
+        state.lastUrl = url;
+    });
+    view.webContents.loadURL(state.lastUrl || service.url);
+    views[viewId] = view;
+    return view;
+}
+
+function discardView(viewId) {
+    const view = views[viewId];
+    if (!view || viewId === activeViewId) return;
+
+    const state = viewState[viewId];
+    if (!view.webContents.isDestroyed()) {
+        state.lastUrl = view.webContents.getURL() || state.lastUrl;
+        view.webContents.close();
+    }
+    state.discards++;
+    delete views[viewId];
+}
+
+// Least recently used first, never the active view.
+function backgroundViewsByAge() {
+    return Object.keys(views)
+        .filter(id => id !== activeViewId)
+        .sort((a, b) => viewState[a].lastActive - viewState[b].lastActive);
+}
+
+function enforceViewCap() {
+    const excess = Object.keys(views).length - MAX_LIVE_VIEWS;
+    backgroundViewsByAge().slice(0, Math.max(0, excess)).forEach(discardView);
 }
 
-function initializeViews(serviceList) {
-    serviceList.forEach(service => {
-        const view = new BrowserView({
-            webPreferences: {
-                nodeIntegration: false,
-                contextIsolation: true
+function discardIdleViews() {
+    if (VIEW_IDLE_MS === 0) return;
+    const now = Date.now();
+    backgroundViewsByAge()
+        .filter(id => now - viewState[id].lastActive > VIEW_IDLE_MS)
+        .forEach(discardView);
+}
+
+// Per-view telemetry: renderer memory and CPU from app.getAppMetrics(), matched by
+// process id, plus lifecycle counters. Available over IPC ('get-view-telemetry'), and
+// logged every AIBOX_TELEMETRY_SECONDS when that is set, together with filterStats.
+function collectViewTelemetry() {
+    const metrics = {};
+    app.getAppMetrics().forEach(metric => {
+        metrics[metric.pid] = metric;
+    });
+
+    return allServices.map(service => {
+        const state = viewState[service.id];
+        const view = views[service.id];
+        const entry = {
+            id: service.id,
+            live: Boolean(view),
+            active: service.id === activeViewId,
+            idleSeconds: state && state.lastActive ? Math.round((Date.now() - state.lastActive) / 1000) : null,
+            discards: state ? state.discards : 0,
+            loadMs: state ? state.loadMs : null,
+            pid: null,
+            workingSetKB: null,
+            cpuPercent: null
+        };
+        if (view && !view.webContents.isDestroyed()) {
+            const metric = metrics[view.webContents.getOSProcessId()];
+            entry.pid = view.webContents.getOSProcessId();
+            if (metric) {
+                entry.workingSetKB = metric.memory.workingSetSize;
+                entry.cpuPercent = Math.round(metric.cpu.percentCPUUsage * 10) / 10;
             }
-        });
-        view.webContents.loadURL(service.url);
-        views[service.id] = view;
+        }
+        return entry;
     });
 }
 
+function startViewTelemetry() {
+    const seconds = parseFloat(process.env.AIBOX_TELEMETRY_SECONDS || '0');
+    if (!(seconds > 0)) return null;
+    return setInterval(() => {
+        const live = collectViewTelemetry().filter(entry => entry.live);
+        const totalKB = live.reduce((sum, entry) => sum + (entry.workingSetKB || 0), 0);
+        console.log(JSON.stringify({ time: new Date().toISOString(), liveViews: live.length, totalWorkingSetKB: totalKB, views: live, filter: filterStats }));
+    }, seconds * 1000);
+}
+
 function updateViewBounds(view) {
     const contentBounds = mainWindow.getContentBounds();
     view.setBounds({
@@ -119,11 +281,15 @@ function setActiveMode(mode) {
 }
 
 function setActiveView(viewId) {
-    const view = views[viewId];
+    const view = getOrCreateView(viewId);
     if (!view) return;
 
+    if (activeViewId && viewState[activeViewId]) viewState[activeViewId].lastActive = Date.now();
+    activeViewId = viewId;
+    viewState[viewId].lastActive = Date.now();
     mainWindow.setBrowserView(view);
     updateViewBounds(view);
+    enforceViewCap();
 }
 
 app.whenReady().then(() => {
@@ -146,6 +312,10 @@ ipcMain.on('switch-mode', (event, mode) => {
     setActiveMode(mode);
 });
 
+ipcMain.on('get-view-telemetry', (event) => {
+    event.reply('view-telemetry', collectViewTelemetry());
+});
+
 ipcMain.on('integrate-desktop', (event) => {
     const homeDir = os.homedir();
     const applicationsDir = path.join(homeDir, '.local', 'share', 'applications');